@@ -2049,7 +2049,8 @@ namespace c0 {
         else if(type == TokenType::CHAR) {
             if(typeTest == TokenType::DOUBLE)
                 _instructions[_current_func].emplace_back(Operation::D2I);
-            _instructions[_current_func].emplace_back(Operation::I2C);
+            if(typeTest != TokenType::CHAR)
+                _instructions[_current_func].emplace_back(Operation::I2C);
             _instructions[_current_func].emplace_back(Operation::ISTORE);
         }
 
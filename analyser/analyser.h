@@ -39,6 +39,8 @@ namespace c0 {
         std::map<int32_t, std::tuple<std::string, std::string> > getConst() {return _runtime_consts;}
 
         std::map<int32_t, std::tuple<int32_t, int32_t, int32_t, int32_t> > getFuncs(){return _runtime_funcs;}
+
+        std::map<int32_t, std::pair<TokenType, std::vector<TokenType> > > getFuncTypes(){return _funcs;}
 	private:
 		// 所有的递归子程序
 
@@ -1,6 +1,8 @@
 #include "fmt/core.h"
 #include "tokenizer/tokenizer.h"
 #include "analyser/analyser.h"
+#include "vm/vm.h"
+#include "vm/verifier.h"
 
 namespace fmt {
 	template<>
@@ -467,6 +469,51 @@ namespace fmt {
 			case c0::CSCAN:
 				name = "cscan";
 				break;
+			case c0::ILOADL:
+				name = "iloadl";
+				break;
+			case c0::DLOADL:
+				name = "dloadl";
+				break;
+			case c0::ILOADG:
+				name = "iloadg";
+				break;
+			case c0::DLOADG:
+				name = "dloadg";
+				break;
+			case c0::ISTOREL:
+				name = "istorel";
+				break;
+			case c0::DSTOREL:
+				name = "dstorel";
+				break;
+			case c0::ISTOREG:
+				name = "istoreg";
+				break;
+			case c0::DSTOREG:
+				name = "dstoreg";
+				break;
+			case c0::IINC:
+				name = "iinc";
+				break;
+			case c0::ICMPJE:
+				name = "icmpje";
+				break;
+			case c0::ICMPJNE:
+				name = "icmpjne";
+				break;
+			case c0::ICMPJL:
+				name = "icmpjl";
+				break;
+			case c0::ICMPJGE:
+				name = "icmpjge";
+				break;
+			case c0::ICMPJG:
+				name = "icmpjg";
+				break;
+			case c0::ICMPJLE:
+				name = "icmpjle";
+				break;
 			case c0::ILL:
 				name = "ill";
 				break;
@@ -533,6 +580,14 @@ namespace fmt {
 			case c0::IPUSH:
 			case c0::POPN:
 			case c0::SNEW:
+			case c0::ILOADL:
+			case c0::DLOADL:
+			case c0::ILOADG:
+			case c0::DLOADG:
+			case c0::ISTOREL:
+			case c0::DSTOREL:
+			case c0::ISTOREG:
+			case c0::DSTOREG:
                 return format_to(ctx.out(), "{} {}", p.GetOperation(), p.GetX());
 			case c0::JMP:
             case c0::LOADC:
@@ -543,12 +598,139 @@ namespace fmt {
 			case c0::JG:
 			case c0::JLE:
             case c0::CALL:
+			case c0::ICMPJE:
+			case c0::ICMPJNE:
+			case c0::ICMPJL:
+			case c0::ICMPJGE:
+			case c0::ICMPJG:
+			case c0::ICMPJLE:
 				return format_to(ctx.out(), "{} {}", p.GetOperation(), (int16_t)p.GetX());
 			
 			case c0::LOADA:
 				return format_to(ctx.out(), "{} {}, {}", p.GetOperation(), p.GetX(), (int16_t)p.GetOpt());
+			case c0::IINC:
+				return format_to(ctx.out(), "{} {}, {}", p.GetOperation(), p.GetX(), p.GetOpt());
 			}
 			return format_to(ctx.out(), "ILL");
 		}
 	};
-}
\ No newline at end of file
+}
+
+namespace fmt {
+	template<>
+	struct formatter<c0::RuntimeErrorCode> {
+		template <typename ParseContext>
+		constexpr auto parse(ParseContext &ctx) { return ctx.begin(); }
+
+		template <typename FormatContext>
+		auto format(const c0::RuntimeErrorCode &p, FormatContext &ctx) {
+			std::string name;
+			switch (p) {
+			case c0::ErrStackOverflow:
+				name = "Stack overflow.";
+				break;
+			case c0::ErrStackUnderflow:
+				name = "Pop from an empty stack.";
+				break;
+			case c0::ErrInvalidAddress:
+				name = "Access to unused stack memory.";
+				break;
+			case c0::ErrDivideByZero:
+				name = "Divide by zero.";
+				break;
+			case c0::ErrInvalidConstant:
+				name = "Invalid constant index.";
+				break;
+			case c0::ErrInvalidFunction:
+				name = "Invalid function index.";
+				break;
+			case c0::ErrIllegalInstruction:
+				name = "Illegal instruction.";
+				break;
+			case c0::ErrNoMainFunction:
+				name = "The program has no main function.";
+				break;
+			case c0::ErrReadFailed:
+				name = "Failed to read the input.";
+				break;
+			case c0::ErrStepLimitExceeded:
+				name = "Step limit exceeded.";
+				break;
+			}
+			return format_to(ctx.out(), name);
+		}
+	};
+
+	template<>
+	struct formatter<c0::RuntimeError> {
+		template <typename ParseContext>
+		constexpr auto parse(ParseContext &ctx) { return ctx.begin(); }
+
+		template <typename FormatContext>
+		auto format(const c0::RuntimeError &p, FormatContext &ctx) {
+			if (p.function < 0)
+				return format_to(ctx.out(), "Start code Offset: {} Error: {}", p.ip, p.code);
+			return format_to(ctx.out(), "Function: {} Offset: {} Error: {}", p.function, p.ip, p.code);
+		}
+	};
+
+	template<>
+	struct formatter<c0::VerifyErrorCode> {
+		template <typename ParseContext>
+		constexpr auto parse(ParseContext &ctx) { return ctx.begin(); }
+
+		template <typename FormatContext>
+		auto format(const c0::VerifyErrorCode &p, FormatContext &ctx) {
+			std::string name;
+			switch (p) {
+			case c0::VerifyIllegalInstruction:
+				name = "Illegal instruction.";
+				break;
+			case c0::VerifyInvalidJump:
+				name = "Jump out of the function.";
+				break;
+			case c0::VerifyInvalidFunction:
+				name = "Invalid function index.";
+				break;
+			case c0::VerifyInvalidConstant:
+				name = "Invalid constant index.";
+				break;
+			case c0::VerifyStackUnderflow:
+				name = "Pop below the stack frame.";
+				break;
+			case c0::VerifyStackOverflow:
+				name = "The stack frame is larger than the stack.";
+				break;
+			case c0::VerifyStackMismatch:
+				name = "Different stack depths where control flow merges.";
+				break;
+			case c0::VerifyTypeMismatch:
+				name = "Int and double slots are mixed.";
+				break;
+			case c0::VerifyInvalidAddress:
+				name = "Access outside the stack frame and the globals.";
+				break;
+			case c0::VerifyInvalidReturn:
+				name = "Inconsistent return width.";
+				break;
+			case c0::VerifyInvalidEntry:
+				name = "The main function takes parameters.";
+				break;
+			}
+			return format_to(ctx.out(), name);
+		}
+	};
+
+	template<>
+	struct formatter<c0::VerifyError> {
+		template <typename ParseContext>
+		constexpr auto parse(ParseContext &ctx) { return ctx.begin(); }
+
+		template <typename FormatContext>
+		auto format(const c0::VerifyError &p, FormatContext &ctx) {
+			if (p.function < 0)
+				return format_to(ctx.out(), "Start code Offset: {} Error: {}", p.ip, p.code);
+			return format_to(ctx.out(), "Function: {} Offset: {} Error: {}", p.function, p.ip, p.code);
+		}
+	};
+}
@@ -27,8 +27,20 @@ namespace c0 {
 		RET, IRET, DRET, ARET,
 		IPRINT, DPRINT, CPRINT, SPRINT, PRINTL,
 		ISCAN, DSCAN, CSCAN,
+		// 超级指令，只有内置的虚拟机能执行
+		// 直接以slot为操作数读写局部（层次差 0）和全局变量
+		ILOADL, DLOADL, ILOADG, DLOADG,
+		ISTOREL, DSTOREL, ISTOREG, DSTOREG,
+		// 局部变量加常数
+		IINC,
+		// 比较两个 int 并跳转
+		ICMPJE, ICMPJNE, ICMPJL, ICMPJGE, ICMPJG, ICMPJLE,
 		ILL,
 	};
+
+	// 整数运算指令（IADD ISUB IMUL IDIV INEG）的 option 为 NoOverflow 时，值域分析证明了它不会溢出
+	// 对 IDIV 还说明除数不为 0，也不会出现 INT_MIN / -1，执行引擎可以省去对应的检查
+	const std::int32_t NoOverflow = 1;
 	
 	class Instruction final {
 	private:
@@ -44,7 +56,7 @@ namespace c0 {
 		Instruction(const Instruction& i) { _opr = i._opr; _x = i._x; _option = i._option; }
 		Instruction(Instruction&& i) :Instruction() { swap(*this, i); }
 		Instruction& operator=(Instruction i) { swap(*this, i); return *this; }
-		bool operator==(const Instruction& i) const { return _opr == i._opr && _x == i._x; }
+		bool operator==(const Instruction& i) const { return _opr == i._opr && _x == i._x && _option == i._option; }
 
 		Operation GetOperation() const { return _opr; }
 		int32_t GetX() const { return _x; }
@@ -166,6 +178,36 @@ namespace c0 {
                     return 0xb1;
                 case c0::CSCAN:
                     return 0xb2;
+                case c0::ILOADL:
+                    return 0xc0;
+                case c0::DLOADL:
+                    return 0xc1;
+                case c0::ILOADG:
+                    return 0xc2;
+                case c0::DLOADG:
+                    return 0xc3;
+                case c0::ISTOREL:
+                    return 0xc4;
+                case c0::DSTOREL:
+                    return 0xc5;
+                case c0::ISTOREG:
+                    return 0xc6;
+                case c0::DSTOREG:
+                    return 0xc7;
+                case c0::IINC:
+                    return 0xc8;
+                case c0::ICMPJE:
+                    return 0xd1;
+                case c0::ICMPJNE:
+                    return 0xd2;
+                case c0::ICMPJL:
+                    return 0xd3;
+                case c0::ICMPJGE:
+                    return 0xd4;
+                case c0::ICMPJG:
+                    return 0xd5;
+                case c0::ICMPJLE:
+                    return 0xd6;
                 default:
                     return 0x00;
             }
@@ -181,5 +223,6 @@ namespace c0 {
 		using std::swap;
 		swap(lhs._opr, rhs._opr);
 		swap(lhs._x, rhs._x);
+		swap(lhs._option, rhs._option);
 	}
 }
\ No newline at end of file
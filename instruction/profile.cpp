@@ -0,0 +1,58 @@
+#include "profile.h"
+
+#include <sstream>
+#include <string>
+
+namespace c0 {
+
+	std::optional<Profile> readProfile(std::istream& in) {
+		std::string line, tag;
+		int version;
+		if (!std::getline(in, line) || !(std::stringstream(line) >> tag >> version) || tag != "c0-profile" || version != 1)
+			return {};
+
+		Profile profile;
+		while (std::getline(in, line)) {
+			std::stringstream ss(line);
+			if (!(ss >> tag))
+				continue;
+			std::int32_t func, offset;
+			if (tag == "function") {
+				Profile::Function f;
+				if (!(ss >> func >> f.size >> f.calls))
+					return {};
+				auto& old = profile.functions[func];
+				old.size = f.size;
+				old.calls += f.calls;
+			}
+			else if (tag == "branch") {
+				std::uint64_t taken, fallthrough;
+				if (!(ss >> func >> offset >> taken >> fallthrough))
+					return {};
+				auto& b = profile.functions[func].branches[offset];
+				b.first += taken;
+				b.second += fallthrough;
+			}
+			else if (tag == "call") {
+				std::uint64_t count;
+				if (!(ss >> func >> offset >> count))
+					return {};
+				profile.functions[func].sites[offset] += count;
+			}
+			else
+				return {};
+		}
+		return profile;
+	}
+
+	void writeProfile(const Profile& profile, std::ostream& out) {
+		out << "c0-profile 1\n";
+		for (auto& [func, f] : profile.functions) {
+			out << "function " << func << ' ' << f.size << ' ' << f.calls << '\n';
+			for (auto& [offset, b] : f.branches)
+				out << "branch " << func << ' ' << offset << ' ' << b.first << ' ' << b.second << '\n';
+			for (auto& [offset, count] : f.sites)
+				out << "call " << func << ' ' << offset << ' ' << count << '\n';
+		}
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <utility>
+
+namespace c0 {
+
+	// 一次运行的执行剖面，偏移都是未经优化的指令序列中的下标
+	// 文本格式，每行一条记录：
+	//   c0-profile 1
+	//   function <函数下标> <指令数> <调用次数>
+	//   branch <函数下标> <偏移> <跳转次数> <不跳转次数>
+	//   call <函数下标> <偏移> <执行次数>
+	// 函数下标 -1 是全局变量的初始化代码
+	struct Profile {
+		using int32_t = std::int32_t;
+		using uint64_t = std::uint64_t;
+
+		struct Function {
+			// 用来检查剖面和程序是否对应
+			int32_t size = 0;
+			uint64_t calls = 0;
+			// 条件跳转的偏移 -> (跳转次数, 不跳转次数)
+			std::map<int32_t, std::pair<uint64_t, uint64_t> > branches;
+			// 调用指令的偏移 -> 执行次数
+			std::map<int32_t, uint64_t> sites;
+		};
+
+		std::map<int32_t, Function> functions;
+	};
+
+	std::optional<Profile> readProfile(std::istream&);
+	void writeProfile(const Profile&, std::ostream&);
+}
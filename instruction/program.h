@@ -0,0 +1,31 @@
+#pragma once
+
+#include "instruction/instruction.h"
+#include "tokenizer/token.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace c0 {
+
+	// 一次编译的全部产出，供优化器和各个后端共同使用
+	struct Program {
+		using int32_t = std::int32_t;
+
+		// 常量表：下标 -> (类型, 值)
+		std::map<int32_t, std::tuple<std::string, std::string> > consts;
+		// 全局变量的初始化代码
+		std::vector<Instruction> start;
+		// 函数表：函数下标 -> (函数下标, 函数名在常量表中的下标, 参数的slot数, 层级)
+		std::map<int32_t, std::tuple<int32_t, int32_t, int32_t, int32_t> > funcs;
+		// 各函数的指令
+		std::map<int32_t, std::vector<Instruction> > functions;
+		// 函数签名：返回类型、参数类型列表
+		// 从 .o0 文件中读入的程序没有这一项，依赖它的优化需要自行跳过
+		std::map<int32_t, std::pair<TokenType, std::vector<TokenType> > > signatures;
+	};
+}
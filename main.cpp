@@ -3,11 +3,16 @@
 
 #include "tokenizer/tokenizer.h"
 #include "analyser/analyser.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/passes.h"
+#include "instruction/profile.h"
+#include "vm/vm.h"
 #include "fmts.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
-#include <unordered_map>
+#include <sstream>
 #include <string>
 
 std::vector<c0::Token> _tokenize(std::istream& input) {
@@ -20,17 +25,22 @@ std::vector<c0::Token> _tokenize(std::istream& input) {
 	return p.first;
 }
 
-const std::unordered_map<c0::Operation, std::vector<int>> paramSizeOfOperation = {
-        { c0::Operation::BIPUSH, {1} },    { c0::Operation::IPUSH, {4} },
-        { c0::Operation::POPN, {4} },
-        { c0::Operation::LOADC, {2} },    { c0::Operation::LOADA, {2, 4} },
-        { c0::Operation::SNEW, {4} },
-
-        { c0::Operation::JMP, {2} },
-        { c0::Operation::JE, {2} }, { c0::Operation::JNE, {2} }, { c0::Operation::JL, {2} }, { c0::Operation::JGE, {2} }, { c0::Operation::JG, {2} }, { c0::Operation::JLE, {2} },
-
-        { c0::Operation::CALL, {2} },
-};
+c0::Program _analyse(std::istream& input) {
+	auto tks = _tokenize(input);
+	c0::Analyser analyser(tks);
+	auto p = analyser.Analyse();
+	if (p.second.has_value()) {
+		fmt::print(stderr, "Syntactic analysis error: {}\n", p.second.value());
+		exit(2);
+	}
+	c0::Program compiled;
+	compiled.consts = analyser.getConst();
+	compiled.start = analyser.getStartCode();
+	compiled.funcs = analyser.getFuncs();
+	compiled.functions = p.first;
+	compiled.signatures = analyser.getFuncTypes();
+	return compiled;
+}
 
 void Tokenize(std::istream& input, std::ostream& output) {
 	auto v = _tokenize(input);
@@ -39,7 +49,7 @@ void Tokenize(std::istream& input, std::ostream& output) {
 	return;
 }
 
-void Binaryse(std::istream& input, std::ostream& output) {
+void Binaryse(const c0::Program& compiled, std::ostream& output) {
     char bytes[8];
     const auto writeNBytes = [&](void* addr, int count) {
         //assert(0 < count && count <= 8);
@@ -56,16 +66,8 @@ void Binaryse(std::istream& input, std::ostream& output) {
     //// 输入version = 0x01
     output.write("\x00\x00\x00\x01", 4);
 
-    auto tks = _tokenize(input);
-    c0::Analyser analyser(tks);
-    auto p = analyser.Analyse();
-    if (p.second.has_value()) {
-        fmt::print(stderr, "Syntactic analysis error: {}\n", p.second.value());
-        exit(2);
-    }
-
     //// 输入constants_count
-    auto _consts = analyser.getConst();
+    auto& _consts = compiled.consts;
     uint16_t constats_count = _consts.size();
     writeNBytes(&constats_count, sizeof constats_count);
 
@@ -148,8 +150,7 @@ void Binaryse(std::istream& input, std::ostream& output) {
         for (auto& ins : v) {
             uint8_t op = ins.getBinaryInstruction();
             writeNBytes(&op, sizeof op);
-            if (auto it = paramSizeOfOperation.find(ins.GetOperation()); it != paramSizeOfOperation.end()) {
-                auto paramSizes = it->second;
+            if (auto& paramSizes = c0::operandSizesOf(ins.GetOperation()); !paramSizes.empty()) {
                 switch (paramSizes[0]) {
                     case 1: {
                         uint8_t x = ins.GetX();
@@ -195,15 +196,15 @@ void Binaryse(std::istream& input, std::ostream& output) {
     };
 
     //// 开始输出start代码
-    auto _start = analyser.getStartCode();
+    auto& _start = compiled.start;
     to_binary(_start);
 
     //// 输出函数表
-    auto _funcs = analyser.getFuncs();
+    auto& _funcs = compiled.funcs;
     uint16_t  functions_count = _funcs.size();
     writeNBytes(&functions_count, sizeof functions_count);
     //// 遍历函数表，输出函数指令序列
-    auto functions = p.first;
+    auto& functions = compiled.functions;
     for(auto & fun : _funcs) {
         auto tup = fun.second;
         uint16_t v;
@@ -216,23 +217,15 @@ void Binaryse(std::istream& input, std::ostream& output) {
 
         v = std::get<0>(tup);
         //std::cout<<v<<std::endl;
-        to_binary(functions[v]);
+        to_binary(functions.at(v));
     }
 }
 
-void Analyse(std::istream& input, std::ostream& output){
-	auto tks = _tokenize(input);
-	c0::Analyser analyser(tks);
-	auto p = analyser.Analyse();
-	if (p.second.has_value()) {
-		fmt::print(stderr, "Syntactic analysis error: {}\n", p.second.value());
-		exit(2);
-	}
-
+void Analyse(const c0::Program& compiled, std::ostream& output){
 	//// 输出汇编指令
 	//// 输出常量表
     output << fmt::format(".constants:\n");
-	auto _const = analyser.getConst();
+	auto& _const = compiled.consts;
 	for(auto & itr : _const) {
 	    std::string str = std::get<1>(itr.second);
         std::string type = std::get<0>(itr.second);
@@ -247,21 +240,21 @@ void Analyse(std::istream& input, std::ostream& output){
 
 	//// 输出开始指令
     output << fmt::format(".start:\n");
-    auto _start = analyser.getStartCode();
+    auto& _start = compiled.start;
     int32_t _i = 0;
     for(auto & itr : _start)
         output << fmt::format("{}\t{}\n", _i++, itr);
 
     //// 输出函数表
     output << fmt::format(".functions:\n");
-    auto _func = analyser.getFuncs();
+    auto& _func = compiled.funcs;
     for(auto & itr : _func) {
         auto& t = itr.second;
         output << fmt::format("{} {} {} {}\n", std::get<0>(t), std::get<1>(t), std::get<2>(t), std::get<3>(t));
     }
 
     //// 输出各函数代码
-	auto v = p.first;
+	auto& v = compiled.functions;
 	for (auto& it : v) {
         output << fmt::format(".F{}:\n", it.first);
         _i = 0;
@@ -271,6 +264,47 @@ void Analyse(std::istream& input, std::ostream& output){
 	return;
 }
 
+// 合并函数后下标会变，按函数名对应优化前后的栈帧
+std::map<std::string, int32_t> NamedFrameSizes(const c0::Program& compiled) {
+	std::map<std::string, int32_t> sizes;
+	for (auto& [func, size] : c0::Optimizer::FrameSizes(compiled)) {
+		// 没有函数时 functions 中可能只有一个占位的空函数，funcs 中没有它
+		auto itr = compiled.funcs.find(func);
+		if (itr == compiled.funcs.end())
+			continue;
+		auto name = compiled.consts.find(std::get<1>(itr->second));
+		if (name != compiled.consts.end())
+			sizes[std::get<1>(name->second)] = size;
+	}
+	return sizes;
+}
+
+void PrintFrameReductions(const std::map<std::string, int32_t>& before, const std::map<std::string, int32_t>& after) {
+	for (auto& [name, size] : after) {
+		auto itr = before.find(name);
+		if (itr == before.end() || itr->second <= size)
+			continue;
+		fmt::print(stderr, "{}: {} -> {} slots\n", name, itr->second, size);
+	}
+}
+
+// 下标即优化级别
+const char* const OptimizationLevels[c0::Optimizer::MaxLevel + 1] = {"-O0", "-O1", "-O2", "-O3"};
+
+void PrintStatistics(const std::vector<c0::PassStatistics>& statistics) {
+	double total = 0;
+	fmt::print(stderr, "{:<20}{:>12}{:>24}\n", "pass", "time (ms)", "instructions");
+	for (auto& s : statistics) {
+		fmt::print(stderr, "{:<20}{:>12.3f}{:>24}\n", s.name, s.milliseconds, fmt::format("{} -> {} ({:+})", s.before, s.after, s.after - s.before));
+		total += s.milliseconds;
+	}
+	if (!statistics.empty()) {
+		auto& first = statistics.front();
+		auto& last = statistics.back();
+		fmt::print(stderr, "{:<20}{:>12.3f}{:>24}\n", "total", total, fmt::format("{} -> {} ({:+})", first.before, last.after, last.after - first.before));
+	}
+}
+
 int main(int argc, char** argv) {
 	argparse::ArgumentParser program("cc0");
     program.add_argument("input")
@@ -284,6 +318,44 @@ int main(int argc, char** argv) {
             .default_value(false)
             .implicit_value(true)
             .help("assemble the text input file.");
+    program.add_argument("-r")
+            .default_value(false)
+            .implicit_value(true)
+            .help("run the compiled program on the built-in vm without writing a file.");
+    program.add_argument("--emit-c")
+            .default_value(false)
+            .implicit_value(true)
+            .help("translate the compiled program to a portable C file, which the system C compiler can build.");
+    program.add_argument("-O")
+            .default_value(false)
+            .implicit_value(true)
+            .help("optimize the generated instructions, same as -O2.");
+    for (auto flag : OptimizationLevels)
+        program.add_argument(flag)
+                .default_value(false)
+                .implicit_value(true)
+                .help("optimize at the given level, the highest given level is used.");
+    program.add_argument("--passes")
+            .default_value(std::string(""))
+            .help("run the given comma separated passes in order instead of an optimization level.");
+    program.add_argument("--report-frames")
+            .default_value(false)
+            .implicit_value(true)
+            .help("print the frame size of each function whose frame was shrunk by the passes.");
+    program.add_argument("--time-passes")
+            .default_value(false)
+            .implicit_value(true)
+            .help("print the time and instruction count change of each pass.");
+    program.add_argument("--fuse")
+            .default_value(false)
+            .implicit_value(true)
+            .help("emit superinstructions, which only the built-in vm can execute.");
+    program.add_argument("--profile-generate")
+            .default_value(std::string(""))
+            .help("run the unoptimized program on the built-in vm and write its execution profile to the given file.");
+    program.add_argument("--profile-use")
+            .default_value(std::string(""))
+            .help("optimize with an execution profile written by --profile-generate.");
     program.add_argument("-o", "--output")
             .required()
             .default_value(std::string("-"))
@@ -312,10 +384,75 @@ int main(int argc, char** argv) {
     }
     input = &inf;
 
-	if (program["-s"] == true && program["-c"] == true) {
-		fmt::print(stderr, "You can only perform compile or assemble at one time.");
+	if ((program["-s"] == true) + (program["-c"] == true) + (program["-r"] == true) + (program["--emit-c"] == true) > 1) {
+		fmt::print(stderr, "You can only perform compile, assemble, run or emit C at one time.");
 		exit(2);
 	}
+	auto compiled = _analyse(*input);
+
+	auto profile_file = program.get<std::string>("--profile-generate");
+	if (!profile_file.empty()) {
+		auto module = c0::moduleOf(compiled);
+		c0::VirtualMachine vm(module, std::cin, std::cout);
+		vm.EnableProfiling();
+		auto err = vm.Run();
+		outf.open(profile_file, std::ios::out | std::ios::trunc);
+		if (!outf) {
+			fmt::print(stderr, "Fail to open {} for writing.\n", profile_file);
+			exit(2);
+		}
+		c0::writeProfile(vm.GetProfile(), outf);
+		if (err.has_value()) {
+			fmt::print(stderr, "Runtime error: {}\n", err.value());
+			exit(1);
+		}
+		return 0;
+	}
+
+	std::optional<c0::Profile> profile;
+	profile_file = program.get<std::string>("--profile-use");
+	if (!profile_file.empty()) {
+		std::ifstream pf(profile_file);
+		if (pf)
+			profile = c0::readProfile(pf);
+		if (!profile.has_value()) {
+			fmt::print(stderr, "Fail to read the profile {}.\n", profile_file);
+			exit(2);
+		}
+	}
+	int level = program["-O"] == true ? 2 : 0;
+	for (int i = 0; i <= c0::Optimizer::MaxLevel; i++)
+		if (program[OptimizationLevels[i]] == true)
+			level = std::max(level, i);
+	auto passes = c0::Optimizer::PassesOf(level);
+	auto pass_list = program.get<std::string>("--passes");
+	if (!pass_list.empty()) {
+		passes.clear();
+		std::stringstream ss(pass_list);
+		for (std::string name; std::getline(ss, name, ',');)
+			if (!name.empty())
+				passes.push_back(name);
+	}
+	if (program["--fuse"] == true)
+		passes.push_back("fuse");
+	const bool reportFrames = program["--report-frames"] == true;
+	std::map<std::string, int32_t> frames;
+	if (reportFrames)
+		frames = NamedFrameSizes(compiled);
+	c0::Optimizer optimizer(compiled, profile.has_value() ? &profile.value() : nullptr);
+	auto unknown = optimizer.Run(passes);
+	if (unknown.has_value()) {
+		fmt::print(stderr, "Unknown pass {}, available passes are:", unknown.value());
+		for (auto& name : c0::Optimizer::AllPasses())
+			fmt::print(stderr, " {}", name);
+		fmt::print(stderr, "\n");
+		exit(2);
+	}
+	if (program["--time-passes"] == true)
+		PrintStatistics(optimizer.GetStatistics());
+	if (reportFrames)
+		PrintFrameReductions(frames, NamedFrameSizes(compiled));
+
 	if (program["-s"] == true) {
         if (output_file != "-") {
             outf.open(output_file, std::ios::out | std::ios::trunc);
@@ -327,7 +464,7 @@ int main(int argc, char** argv) {
         }
         else
             output = &std::cout;
-        Analyse(*input, *output);
+        Analyse(compiled, *output);
 	}
 	else if (program["-c"] == true) {
         if (output_file == "-" || input_file == output_file) {
@@ -339,7 +476,29 @@ int main(int argc, char** argv) {
             exit(2);
         }
         output = &outf;
-		Binaryse(*input, *output);
+		Binaryse(compiled, *output);
+	}
+	else if (program["--emit-c"] == true) {
+		if (output_file != "-") {
+			outf.open(output_file, std::ios::out | std::ios::trunc);
+			if (!outf) {
+				fmt::print(stderr, "Fail to open {} for writing.\n", output_file);
+				exit(2);
+			}
+			output = &outf;
+		}
+		else
+			output = &std::cout;
+		c0::writeCSource(c0::moduleOf(compiled), *output);
+	}
+	else if (program["-r"] == true) {
+		auto module = c0::moduleOf(compiled);
+		c0::VirtualMachine vm(module, std::cin, std::cout);
+		auto err = vm.Run();
+		if (err.has_value()) {
+			fmt::print(stderr, "Runtime error: {}\n", err.value());
+			exit(1);
+		}
 	}
 	else {
 		fmt::print(stderr, "You must choose tokenization or syntactic analysis.");
@@ -0,0 +1,689 @@
+#include "bytecode.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <queue>
+#include <sstream>
+
+namespace c0 {
+
+	bool isJump(Operation op) {
+		switch (op) {
+			case Operation::JMP:
+			case Operation::JE:
+			case Operation::JNE:
+			case Operation::JL:
+			case Operation::JGE:
+			case Operation::JG:
+			case Operation::JLE:
+			case Operation::ICMPJE:
+			case Operation::ICMPJNE:
+			case Operation::ICMPJL:
+			case Operation::ICMPJGE:
+			case Operation::ICMPJG:
+			case Operation::ICMPJLE:
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	bool isConditionalJump(Operation op) {
+		return isJump(op) && op != Operation::JMP;
+	}
+
+	bool isReturn(Operation op) {
+		return op == Operation::RET || op == Operation::IRET || op == Operation::DRET || op == Operation::ARET;
+	}
+
+	bool isTerminator(Operation op) {
+		return op == Operation::JMP || isReturn(op);
+	}
+
+	std::int32_t paramSlots(const Program& program, std::int32_t func) {
+		auto itr = program.funcs.find(func);
+		if (itr == program.funcs.end())
+			return 0;
+		return std::get<2>(itr->second);
+	}
+
+	std::int32_t returnSlots(const Program& program, std::int32_t func) {
+		auto sig = program.signatures.find(func);
+		if (sig != program.signatures.end()) {
+			if (sig->second.first == TokenType::DOUBLE)
+				return 2;
+			else if (sig->second.first == TokenType::VOID)
+				return 0;
+			return 1;
+		}
+		// 没有签名时从返回指令推断
+		auto code = program.functions.find(func);
+		if (code == program.functions.end())
+			return 0;
+		for (auto& ins : code->second) {
+			if (ins.GetOperation() == Operation::IRET || ins.GetOperation() == Operation::ARET)
+				return 1;
+			if (ins.GetOperation() == Operation::DRET)
+				return 2;
+		}
+		return 0;
+	}
+
+	StackEffect stackEffectOf(const Program& program, const Instruction& ins) {
+		switch (ins.GetOperation()) {
+			case Operation::BIPUSH:
+			case Operation::IPUSH:
+			case Operation::LOADA:
+			case Operation::ISCAN:
+			case Operation::CSCAN:
+			case Operation::ILOADL:
+			case Operation::ILOADG:
+				return {0, 1};
+			case Operation::DSCAN:
+			case Operation::DLOADL:
+			case Operation::DLOADG:
+				return {0, 2};
+			case Operation::ISTOREL:
+			case Operation::ISTOREG:
+				return {1, 0};
+			case Operation::DSTOREL:
+			case Operation::DSTOREG:
+				return {2, 0};
+			case Operation::ICMPJE:
+			case Operation::ICMPJNE:
+			case Operation::ICMPJL:
+			case Operation::ICMPJGE:
+			case Operation::ICMPJG:
+			case Operation::ICMPJLE:
+				return {2, 0};
+			case Operation::POP:
+				return {1, 0};
+			case Operation::POP2:
+				return {2, 0};
+			case Operation::POPN:
+				return {ins.GetX(), 0};
+			case Operation::SNEW:
+				return {0, ins.GetX()};
+			case Operation::DUP:
+				return {1, 2};
+			case Operation::DUP2:
+				return {2, 4};
+			case Operation::LOADC: {
+				auto itr = program.consts.find(ins.GetX());
+				if (itr != program.consts.end() && std::get<0>(itr->second) == "D")
+					return {0, 2};
+				return {0, 1};
+			}
+			case Operation::NEW:
+			case Operation::ILOAD:
+			case Operation::ALOAD:
+			case Operation::INEG:
+			case Operation::I2C:
+				return {1, 1};
+			case Operation::DLOAD:
+			case Operation::I2D:
+				return {1, 2};
+			case Operation::ISTORE:
+			case Operation::ASTORE:
+				return {2, 0};
+			case Operation::DSTORE:
+			case Operation::IASTORE:
+			case Operation::AASTORE:
+				return {3, 0};
+			case Operation::DASTORE:
+				return {4, 0};
+			case Operation::IADD:
+			case Operation::ISUB:
+			case Operation::IMUL:
+			case Operation::IDIV:
+			case Operation::ICMP:
+				return {2, 1};
+			case Operation::DADD:
+			case Operation::DSUB:
+			case Operation::DMUL:
+			case Operation::DDIV:
+				return {4, 2};
+			case Operation::DCMP:
+				return {4, 1};
+			case Operation::DNEG:
+				return {2, 2};
+			case Operation::D2I:
+				return {2, 1};
+			case Operation::JE:
+			case Operation::JNE:
+			case Operation::JL:
+			case Operation::JGE:
+			case Operation::JG:
+			case Operation::JLE:
+				return {1, 0};
+			case Operation::CALL:
+				return {paramSlots(program, ins.GetX()), returnSlots(program, ins.GetX())};
+			case Operation::IRET:
+			case Operation::ARET:
+				return {1, 0};
+			case Operation::DRET:
+				return {2, 0};
+			case Operation::IPRINT:
+			case Operation::CPRINT:
+			case Operation::SPRINT:
+				return {1, 0};
+			case Operation::DPRINT:
+				return {2, 0};
+			default:
+				return {0, 0};
+		}
+	}
+
+	std::vector<bool> findLeaders(const std::vector<Instruction>& code) {
+		std::vector<bool> leaders(code.size() + 1, false);
+		leaders[0] = true;
+		for (std::size_t i = 0; i < code.size(); i++) {
+			auto op = code[i].GetOperation();
+			if (isJump(op)) {
+				auto x = code[i].GetX();
+				if (x >= 0 && (std::size_t)x <= code.size())
+					leaders[x] = true;
+			}
+			if (isJump(op) || isReturn(op))
+				leaders[i + 1] = true;
+		}
+		leaders.pop_back();
+		return leaders;
+	}
+
+	std::optional<std::vector<std::int32_t> > stackDepths(const Program& program, const std::vector<Instruction>& code, std::int32_t entry) {
+		std::vector<std::int32_t> depths(code.size(), -1);
+		if (code.empty())
+			return depths;
+
+		std::queue<std::int32_t> q;
+		const auto visit = [&](std::int32_t pos, std::int32_t depth) {
+			if (pos < 0 || (std::size_t)pos >= code.size())
+				return true;
+			if (depths[pos] == -1) {
+				depths[pos] = depth;
+				q.push(pos);
+				return true;
+			}
+			return depths[pos] == depth;
+		};
+
+		depths[0] = entry;
+		q.push(0);
+		while (!q.empty()) {
+			auto pos = q.front();
+			q.pop();
+			auto& ins = code[pos];
+			auto effect = stackEffectOf(program, ins);
+			if (effect.pop > depths[pos])
+				return {};
+			auto depth = depths[pos] - effect.pop + effect.push;
+			auto op = ins.GetOperation();
+			if (isJump(op) && !visit(ins.GetX(), depth))
+				return {};
+			if (!isTerminator(op) && !visit(pos + 1, depth))
+				return {};
+		}
+		return depths;
+	}
+
+	std::optional<std::int32_t> producerOf(const Program& program, const std::vector<Instruction>& code, std::int32_t pos, std::int32_t k) {
+		auto leaders = findLeaders(code);
+		for (auto i = pos - 1; i >= 0; i--) {
+			auto op = code[i].GetOperation();
+			if (isJump(op) || isReturn(op))
+				return {};
+			auto effect = stackEffectOf(program, code[i]);
+			if (k < effect.push)
+				return i;
+			k += effect.pop - effect.push;
+			if (leaders[i])
+				return {};
+		}
+		return {};
+	}
+
+	std::vector<Loop> findLoops(const std::vector<Instruction>& code) {
+		std::map<std::int32_t, std::int32_t> latches;
+		for (std::int32_t i = 0; i < (std::int32_t)code.size(); i++) {
+			if (isJump(code[i].GetOperation()) && code[i].GetX() <= i) {
+				auto& latch = latches[code[i].GetX()];
+				latch = std::max(latch, i);
+			}
+		}
+		std::vector<Loop> loops;
+		for (auto [header, latch] : latches) {
+			Loop loop{header, latch};
+			if (header > 0 && isTerminator(code[header - 1].GetOperation()))
+				continue;
+			bool entered = false;
+			for (std::int32_t i = 0; i < (std::int32_t)code.size() && !entered; i++)
+				entered = !loop.contains(i) && isJump(code[i].GetOperation()) && loop.contains(code[i].GetX());
+			if (!entered)
+				loops.emplace_back(loop);
+		}
+		std::sort(loops.begin(), loops.end(), [](const Loop& x, const Loop& y) {
+			return x.latch - x.header > y.latch - y.header;
+		});
+		return loops;
+	}
+
+	std::map<std::int32_t, SideEffects> sideEffects(const Program& program) {
+		std::map<std::int32_t, SideEffects> effects;
+		std::map<std::int32_t, std::set<std::int32_t> > callees;
+		for (auto& [func, code] : program.functions) {
+			auto& e = effects[func];
+			for (std::int32_t i = 0; i < (std::int32_t)code.size(); i++) {
+				auto op = code[i].GetOperation();
+				switch (op) {
+					case Operation::ILOAD:
+					case Operation::DLOAD:
+					case Operation::ISTORE:
+					case Operation::DSTORE: {
+						const bool isStore = op == Operation::ISTORE || op == Operation::DSTORE;
+						const std::int32_t width = op == Operation::DLOAD || op == Operation::DSTORE ? 2 : 1;
+						auto address = producerOf(program, code, i, isStore ? width : 0);
+						if (address.has_value() && code[*address].GetOperation() == Operation::LOADA) {
+							// 函数中层次差为 0 的是局部变量
+							if (code[*address].GetX() == 0)
+								break;
+							auto& set = isStore ? e.writes : e.reads;
+							for (std::int32_t k = 0; k < width; k++)
+								set.insert(code[*address].GetOpt() + k);
+						}
+						else
+							(isStore ? e.unknownWrite : e.unknownRead) = true;
+						break;
+					}
+					case Operation::CALL:
+						callees[func].insert(code[i].GetX());
+						break;
+					case Operation::IPRINT:
+					case Operation::DPRINT:
+					case Operation::CPRINT:
+					case Operation::SPRINT:
+					case Operation::PRINTL:
+					case Operation::ISCAN:
+					case Operation::DSCAN:
+					case Operation::CSCAN:
+						e.io = true;
+						break;
+					default:
+						break;
+				}
+			}
+		}
+		// 沿调用关系传递到不动点
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (auto& [func, called] : callees) {
+				auto merged = effects[func];
+				for (auto callee : called) {
+					auto& c = effects[callee];
+					merged.reads.insert(c.reads.begin(), c.reads.end());
+					merged.writes.insert(c.writes.begin(), c.writes.end());
+					merged.unknownRead = merged.unknownRead || c.unknownRead;
+					merged.unknownWrite = merged.unknownWrite || c.unknownWrite;
+					merged.io = merged.io || c.io;
+				}
+				if (!(merged == effects[func])) {
+					effects[func] = merged;
+					changed = true;
+				}
+			}
+		}
+		return effects;
+	}
+
+	FrameAccesses frameAccesses(const Program& program, const std::vector<Instruction>& code) {
+		FrameAccesses result;
+		result.accesses.resize(code.size());
+		// 每条 LOADA 0,x 和复制它的 DUP 被多少次读写用作地址
+		std::map<std::int32_t, std::int32_t> consumers;
+		const auto grow = [&](std::int32_t end) { result.size = std::max(result.size, end); };
+		// 沿 DUP 找到地址最初的来源，经过的 DUP 记在 chain 中
+		const auto origin = [&](std::int32_t pos, std::int32_t k, std::vector<std::int32_t>& chain) -> std::optional<std::int32_t> {
+			auto p = producerOf(program, code, pos, k);
+			while (p.has_value() && code[*p].GetOperation() == Operation::DUP) {
+				chain.push_back(*p);
+				p = producerOf(program, code, *p, 0);
+			}
+			return p;
+		};
+
+		for (std::int32_t i = 0; i < (std::int32_t)code.size(); i++) {
+			auto& ins = code[i];
+			auto op = ins.GetOperation();
+			SlotAccess access;
+			switch (op) {
+				case Operation::ILOAD:
+				case Operation::DLOAD:
+				case Operation::ISTORE:
+				case Operation::DSTORE: {
+					access.width = op == Operation::DLOAD || op == Operation::DSTORE ? 2 : 1;
+					access.store = op == Operation::ISTORE || op == Operation::DSTORE;
+					access.load = !access.store;
+					std::vector<std::int32_t> chain;
+					auto address = origin(i, access.store ? access.width : 0, chain);
+					if (address.has_value() && code[*address].GetOperation() == Operation::LOADA) {
+						// 全局变量不属于栈帧
+						if (code[*address].GetX() != 0)
+							continue;
+						access.slot = code[*address].GetOpt();
+						access.address = chain.empty() ? *address : -1;
+						access.origin = *address;
+						consumers[*address]++;
+						for (auto d : chain)
+							consumers[d]++;
+					}
+					break;
+				}
+				// 超级指令直接以slot为操作数
+				case Operation::ILOADL:
+				case Operation::DLOADL:
+					access = {ins.GetX(), op == Operation::DLOADL ? 2 : 1, true, false, -1, -1};
+					break;
+				case Operation::ISTOREL:
+				case Operation::DSTOREL:
+					access = {ins.GetX(), op == Operation::DSTOREL ? 2 : 1, false, true, -1, -1};
+					break;
+				case Operation::IINC:
+					access = {ins.GetX(), 1, true, true, -1, -1};
+					break;
+				default:
+					continue;
+			}
+			if (access.slot >= 0)
+				grow(access.slot + access.width);
+			result.accesses[i] = access;
+		}
+
+		for (std::int32_t i = 0; i < (std::int32_t)code.size(); i++) {
+			auto op = code[i].GetOperation();
+			if (op != Operation::LOADA && op != Operation::DUP)
+				continue;
+			std::vector<std::int32_t> chain;
+			std::optional<std::int32_t> address = i;
+			if (op == Operation::DUP)
+				address = origin(i, 0, chain);
+			if (!address.has_value() || code[*address].GetOperation() != Operation::LOADA || code[*address].GetX() != 0)
+				continue;
+			if (consumers[i] == 0) {
+				// 不知道被当作多宽的值使用，按 double 处理
+				result.escaped.insert(code[*address].GetOpt());
+				result.escaped.insert(code[*address].GetOpt() + 1);
+				grow(code[*address].GetOpt() + 2);
+			}
+		}
+		// 共用的地址不能单独改写
+		for (auto& access : result.accesses)
+			if (access.has_value() && access->address >= 0 && consumers[access->address] > 1)
+				access->address = -1;
+		return result;
+	}
+
+	std::vector<std::int32_t> successorsOf(const std::vector<Instruction>& code, std::int32_t pos) {
+		std::vector<std::int32_t> result;
+		auto& ins = code[pos];
+		auto op = ins.GetOperation();
+		if (isJump(op) && ins.GetX() >= 0 && ins.GetX() < (std::int32_t)code.size())
+			result.push_back(ins.GetX());
+		if (!isTerminator(op) && pos + 1 < (std::int32_t)code.size())
+			result.push_back(pos + 1);
+		return result;
+	}
+
+	std::vector<std::vector<bool> > liveSlots(const std::vector<Instruction>& code, const FrameAccesses& frame) {
+		const std::int32_t n = code.size();
+		std::vector<bool> always(frame.size, false);
+		for (auto slot : frame.escaped)
+			always[slot] = true;
+		std::vector<std::vector<bool> > liveOut(n, always);
+		std::vector<std::vector<bool> > liveIn(n, always);
+		std::vector<std::vector<std::int32_t> > predecessors(n);
+		for (std::int32_t i = 0; i < n; i++)
+			for (auto succ : successorsOf(code, i))
+				predecessors[succ].push_back(i);
+
+		std::vector<bool> queued(n, true);
+		std::queue<std::int32_t> work;
+		for (std::int32_t i = n - 1; i >= 0; i--)
+			work.push(i);
+		while (!work.empty()) {
+			auto i = work.front();
+			work.pop();
+			queued[i] = false;
+			auto out = always;
+			for (auto succ : successorsOf(code, i))
+				for (std::int32_t k = 0; k < frame.size; k++)
+					out[k] = out[k] || liveIn[succ][k];
+			auto in = out;
+			if (auto& access = frame.accesses[i]; access.has_value()) {
+				if (access->slot < 0 && access->load)
+					in.assign(frame.size, true);
+				else if (access->slot >= 0) {
+					// 读写同一个slot时（IINC）先读
+					for (auto k = access->slot; k < access->slot + access->width; k++)
+						if (access->store && !access->load)
+							in[k] = always[k];
+					for (auto k = access->slot; k < access->slot + access->width && access->load; k++)
+						in[k] = true;
+				}
+			}
+			liveOut[i] = out;
+			if (in == liveIn[i])
+				continue;
+			liveIn[i] = in;
+			for (auto pred : predecessors[i])
+				if (!queued[pred]) {
+					queued[pred] = true;
+					work.push(pred);
+				}
+		}
+		return liveOut;
+	}
+
+	std::optional<Literal> literalOf(const Program& program, const Instruction& ins) {
+		switch (ins.GetOperation()) {
+			case Operation::BIPUSH:
+			case Operation::IPUSH:
+				return Literal(ins.GetX());
+			case Operation::LOADC: {
+				auto c = program.consts.find(ins.GetX());
+				if (c == program.consts.end())
+					return {};
+				auto& [type, value] = c->second;
+				if (type == "I")
+					return Literal((std::int32_t)std::stoll(value, nullptr, 16));
+				if (type != "D")
+					return {};
+				double d;
+				std::stringstream(value) >> d;
+				return Literal(d);
+			}
+			default:
+				return {};
+		}
+	}
+
+	bool sameLiteral(const Literal& x, const Literal& y) {
+		if (x.index() != y.index())
+			return false;
+		if (std::holds_alternative<std::int32_t>(x))
+			return std::get<std::int32_t>(x) == std::get<std::int32_t>(y);
+		return std::memcmp(&std::get<double>(x), &std::get<double>(y), sizeof(double)) == 0;
+	}
+
+	Instruction pushLiteral(Program& program, const Literal& value) {
+		if (std::holds_alternative<double>(value))
+			return Instruction(Operation::LOADC, doubleConstant(program, std::get<double>(value)));
+		auto x = std::get<std::int32_t>(value);
+		return Instruction(0 <= x && x <= 255 ? Operation::BIPUSH : Operation::IPUSH, x);
+	}
+
+	std::optional<std::int32_t> findDoubleConstant(const Program& program, double value) {
+		for (auto& [index, c] : program.consts) {
+			if (std::get<0>(c) != "D")
+				continue;
+			double d;
+			std::stringstream(std::get<1>(c)) >> d;
+			if (std::memcmp(&d, &value, sizeof d) == 0)
+				return index;
+		}
+		return {};
+	}
+
+	std::int32_t doubleConstant(Program& program, double value) {
+		auto found = findDoubleConstant(program, value);
+		if (found.has_value())
+			return found.value();
+		std::stringstream ss;
+		ss << std::scientific << std::setprecision(16) << value;
+		const std::int32_t index = program.consts.empty() ? 0 : program.consts.rbegin()->first + 1;
+		program.consts[index] = std::make_tuple(std::string("D"), ss.str());
+		return index;
+	}
+
+	void compactConstants(Program& program) {
+		std::set<std::int32_t> used;
+		const auto collect = [&](const std::vector<Instruction>& code) {
+			for (auto& ins : code)
+				if (ins.GetOperation() == Operation::LOADC)
+					used.insert(ins.GetX());
+		};
+		collect(program.start);
+		for (auto& [_, code] : program.functions)
+			collect(code);
+		for (auto& [_, f] : program.funcs)
+			used.insert(std::get<1>(f));
+
+		std::map<std::int32_t, std::int32_t> remap;
+		std::map<std::int32_t, std::tuple<std::string, std::string> > consts;
+		for (auto& [index, c] : program.consts) {
+			if (!used.count(index))
+				continue;
+			remap[index] = consts.size();
+			consts[remap[index]] = c;
+		}
+		if (consts.size() == program.consts.size())
+			return;
+		const auto rewrite = [&](std::vector<Instruction>& code) {
+			for (auto& ins : code)
+				if (ins.GetOperation() == Operation::LOADC && remap.count(ins.GetX()))
+					ins.set_X(remap[ins.GetX()]);
+		};
+		rewrite(program.start);
+		for (auto& [_, code] : program.functions)
+			rewrite(code);
+		for (auto& [_, f] : program.funcs)
+			std::get<1>(f) = remap[std::get<1>(f)];
+		program.consts = consts;
+	}
+
+	namespace {
+		// 入口处是唯一一条 SNEW，且没有跳转回到入口
+		bool isFrameReserved(const std::vector<Instruction>& code) {
+			if (code.empty() || code[0].GetOperation() != Operation::SNEW)
+				return false;
+			for (std::size_t i = 1; i < code.size(); i++) {
+				if (code[i].GetOperation() == Operation::SNEW)
+					return false;
+				if (isJump(code[i].GetOperation()) && code[i].GetX() == 0)
+					return false;
+			}
+			return true;
+		}
+	}
+
+	// 局部变量的偏移在编译期就确定了，和 SNEW 执行时的栈顶无关
+	// 所以提前一次性分配所有局部变量总是安全的，还顺带去掉了循环体里反复 SNEW 造成的栈增长
+	std::int32_t reserveFrame(const Program& program, std::int32_t func, std::vector<Instruction>& code) {
+		const auto params = paramSlots(program, func);
+		if (isFrameReserved(code))
+			return params + code[0].GetX();
+
+		std::int32_t locals = 0;
+		CodePatch patch(code);
+		for (std::size_t i = 0; i < code.size(); i++) {
+			if (code[i].GetOperation() == Operation::SNEW) {
+				locals += code[i].GetX();
+				patch.Remove(i);
+			}
+		}
+		if (locals > 0)
+			patch.InsertBefore(0, {Instruction(Operation::SNEW, locals)}, false);
+		patch.Apply();
+		return params + locals;
+	}
+
+	std::int32_t allocateFrameSlots(const Program& program, std::int32_t func, std::vector<Instruction>& code, std::int32_t n) {
+		auto frame = reserveFrame(program, func, code);
+		if (isFrameReserved(code))
+			code[0].set_X(code[0].GetX() + n);
+		else {
+			CodePatch patch(code);
+			patch.InsertBefore(0, {Instruction(Operation::SNEW, n)}, false);
+			patch.Apply();
+		}
+		return frame;
+	}
+
+	void CodePatch::InsertBefore(int32_t pos, const std::vector<Instruction>& ins, bool entry) {
+		auto& v = entry ? _entries[pos] : _inserts[pos];
+		v.insert(v.end(), ins.begin(), ins.end());
+	}
+
+	void CodePatch::Replace(int32_t pos, const std::vector<Instruction>& ins) {
+		_replaces[pos] = ins;
+	}
+
+	void CodePatch::Apply() {
+		if (Empty())
+			return;
+
+		const int32_t size = _code.size();
+		std::vector<Instruction> result;
+		// 原下标 -> 跳到该处时新的目标
+		std::vector<int32_t> target(size + 1, 0);
+		// 新指令中哪些是需要修正目标的跳转
+		std::vector<bool> relocate;
+
+		const auto emit = [&](const Instruction& ins) {
+			result.emplace_back(ins);
+			relocate.emplace_back(isJump(ins.GetOperation()));
+		};
+
+		// 同一位置上依次是：只能顺序执行到达的插入指令、跳转落点处的插入指令、原指令
+		for (int32_t i = 0; i <= size; i++) {
+			if (auto itr = _inserts.find(i); itr != _inserts.end())
+				for (auto& ins : itr->second)
+					emit(ins);
+			target[i] = result.size();
+			if (auto itr = _entries.find(i); itr != _entries.end())
+				for (auto& ins : itr->second)
+					emit(ins);
+			if (i == size)
+				break;
+			if (auto itr = _replaces.find(i); itr != _replaces.end()) {
+				for (auto& ins : itr->second)
+					emit(ins);
+			}
+			else
+				emit(_code[i]);
+		}
+
+		for (std::size_t i = 0; i < result.size(); i++) {
+			if (!relocate[i])
+				continue;
+			auto x = result[i].GetX();
+			if (x >= 0 && x <= size)
+				result[i].set_X(target[x]);
+		}
+
+		_code = std::move(result);
+		_entries.clear();
+		_inserts.clear();
+		_replaces.clear();
+	}
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "instruction/instruction.h"
+#include "instruction/program.h"
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <variant>
+#include <vector>
+
+namespace c0 {
+
+	// 一条指令对操作数栈的影响，单位是slot
+	struct StackEffect {
+		std::int32_t pop;
+		std::int32_t push;
+	};
+
+	bool isJump(Operation);
+	bool isConditionalJump(Operation);
+	bool isReturn(Operation);
+	// 执行完之后不会顺序执行下一条指令
+	bool isTerminator(Operation);
+
+	// 函数参数所占的slot数
+	std::int32_t paramSlots(const Program&, std::int32_t);
+	// 函数返回值所占的slot数
+	std::int32_t returnSlots(const Program&, std::int32_t);
+
+	StackEffect stackEffectOf(const Program&, const Instruction&);
+
+	// 基本块的首指令
+	std::vector<bool> findLeaders(const std::vector<Instruction>&);
+
+	// 每条指令执行前的栈深度，entry 为入口处的深度
+	// 不可达的指令深度为 -1，若有路径在汇合处深度不一致则返回空
+	std::optional<std::vector<std::int32_t> > stackDepths(const Program&, const std::vector<Instruction>&, std::int32_t entry);
+
+	// 执行 pos 之前，从栈顶数第 k 个slot（从 0 开始）是由哪条指令压入的
+	// 只在同一个基本块内向前查找，找不到则返回空
+	std::optional<std::int32_t> producerOf(const Program&, const std::vector<Instruction>&, std::int32_t pos, std::int32_t k);
+
+	// 循环 [header, latch]，latch 处的跳转回到 header
+	struct Loop {
+		std::int32_t header;
+		std::int32_t latch;
+
+		bool contains(std::int32_t pos) const { return header <= pos && pos <= latch; }
+	};
+
+	// 只返回除 header 外没有从外部跳入、且 header 之前能顺序执行进来的循环
+	// 插在 header 前的指令恰好在每次进入循环时执行一次，结果按从外到内排列
+	std::vector<Loop> findLoops(const std::vector<Instruction>&);
+
+	// 函数（包括它调用的函数）对全局变量和输入输出的影响
+	struct SideEffects {
+		std::set<std::int32_t> reads;
+		std::set<std::int32_t> writes;
+		// 访问了无法确定的地址
+		bool unknownRead = false;
+		bool unknownWrite = false;
+		bool io = false;
+
+		// 不写全局变量、不做输入输出
+		bool pure() const { return writes.empty() && !unknownWrite && !io; }
+		// 纯函数且不读全局变量，结果只取决于参数
+		bool constant() const { return pure() && reads.empty() && !unknownRead; }
+
+		bool operator==(const SideEffects& rhs) const {
+			return reads == rhs.reads && writes == rhs.writes && unknownRead == rhs.unknownRead
+				&& unknownWrite == rhs.unknownWrite && io == rhs.io;
+		}
+	};
+	std::map<std::int32_t, SideEffects> sideEffects(const Program&);
+
+	// 一条指令对栈帧slot（函数中层次差为 0 的地址）的读写
+	// slot 为 -1 表示地址无法确定，可能是任何slot
+	struct SlotAccess {
+		std::int32_t slot = -1;
+		std::int32_t width = 0;
+		bool load = false;
+		bool store = false;
+		// 唯一提供地址的 LOADA 0,x，地址经过 DUP 复制或被多条指令共用时为 -1
+		std::int32_t address = -1;
+		// 提供地址的 LOADA 0,x，可能被多条指令共用，超级指令为 -1
+		std::int32_t origin = -1;
+	};
+
+	// 函数中所有对栈帧slot的访问，下标为指令位置，不访问栈帧的指令为空
+	struct FrameAccesses {
+		std::vector<std::optional<SlotAccess> > accesses;
+		// 地址被读写以外的指令使用的slot，不能当作普通变量分析
+		std::set<std::int32_t> escaped;
+		// 访问到的slot都小于 size
+		std::int32_t size = 0;
+	};
+	FrameAccesses frameAccesses(const Program&, const std::vector<Instruction>&);
+
+	// 指令执行之后可能被顺序执行或跳转到的指令
+	std::vector<std::int32_t> successorsOf(const std::vector<Instruction>&, std::int32_t);
+	// 每条指令执行之后还可能被读取的栈帧slot，地址逃逸的slot始终活跃
+	std::vector<std::vector<bool> > liveSlots(const std::vector<Instruction>&, const FrameAccesses&);
+
+	// 字面量的值：int（包括 char）或 double
+	using Literal = std::variant<std::int32_t, double>;
+	// 压入一个字面量的指令的值，字符串常量的下标不是字面量
+	std::optional<Literal> literalOf(const Program&, const Instruction&);
+	// 值和类型都相同，double 按位比较，区分 0.0 和 -0.0
+	bool sameLiteral(const Literal&, const Literal&);
+	// 压入字面量的指令，int 用立即数，double 读常量表，可能添加常量
+	Instruction pushLiteral(Program&, const Literal&);
+
+	// 常量表中值相同的 double 常量的下标，doubleConstant 在没有时于末尾添加一个
+	std::optional<std::int32_t> findDoubleConstant(const Program&, double);
+	std::int32_t doubleConstant(Program&, double);
+	// 删除没有被 LOADC 和函数表引用的常量，其余常量按原来的顺序重新编号
+	void compactConstants(Program&);
+
+	// 把函数体中散落的 SNEW 合并为入口处的一次分配，返回栈帧大小（含参数）
+	std::int32_t reserveFrame(const Program&, std::int32_t, std::vector<Instruction>&);
+	// 在栈帧末尾追加 n 个slot，返回第一个slot的偏移，会先调用 reserveFrame
+	std::int32_t allocateFrameSlots(const Program&, std::int32_t, std::vector<Instruction>&, std::int32_t n);
+
+	// 对一段指令做插入、替换和删除，Apply 时统一修正跳转目标
+	// 所有跳转目标（包括新插入的跳转）都按修改前的下标给出
+	class CodePatch final {
+	private:
+		using int32_t = std::int32_t;
+	public:
+		explicit CodePatch(std::vector<Instruction>& code) : _code(code) {}
+		CodePatch(const CodePatch&) = delete;
+		CodePatch& operator=(const CodePatch&) = delete;
+
+		// 在 pos 之前插入指令
+		// entry 为 true 时，原先跳到 pos 的跳转改为跳到插入的指令
+		// 否则插入的指令只能顺序执行到达，跳转仍然落在其后
+		void InsertBefore(int32_t pos, const std::vector<Instruction>& ins, bool entry = true);
+		// 用 ins 替换 pos 处的指令，ins 为空即删除
+		void Replace(int32_t pos, const std::vector<Instruction>& ins);
+		void Remove(int32_t pos) { Replace(pos, {}); }
+		bool Empty() const { return _entries.empty() && _inserts.empty() && _replaces.empty(); }
+
+		void Apply();
+	private:
+		std::vector<Instruction>& _code;
+		std::map<int32_t, std::vector<Instruction> > _entries;
+		std::map<int32_t, std::vector<Instruction> > _inserts;
+		std::map<int32_t, std::vector<Instruction> > _replaces;
+	};
+}
@@ -0,0 +1,294 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <algorithm>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using uint64_t = std::uint64_t;
+
+		// 特化只复制不超过 MaxSpecialisedSize 条指令的函数，总共最多让程序增长 SpecialisationBudget 条指令
+		const int32_t MaxSpecialisedSize = 96;
+		const int32_t SpecialisationBudget = 256;
+		// 有剖面时，执行次数达到 HotCalls 的函数中的调用点都算热点
+		const uint64_t HotCalls = 100;
+
+		// 调用点处一个实参的情况
+		struct Argument {
+			enum class Kind { Unknown, Constant, PassThrough };
+			Kind kind = Kind::Unknown;
+			Literal value;
+		};
+
+		struct Site {
+			int32_t caller;
+			int32_t pos;
+			int32_t callee;
+			std::vector<Argument> arguments;
+			bool hot;
+		};
+
+		std::vector<int32_t> paramOffsets(const std::vector<TokenType>& types) {
+			std::vector<int32_t> offsets;
+			int32_t slot = 0;
+			for (auto type : types) {
+				offsets.push_back(slot);
+				slot += type == TokenType::DOUBLE ? 2 : 1;
+			}
+			return offsets;
+		}
+
+		int32_t widthOf(TokenType type) {
+			return type == TokenType::DOUBLE ? 2 : 1;
+		}
+
+		// 参数在函数中从未被写入、地址也未逃逸时，它在整个函数中都等于实参
+		std::vector<bool> readOnlyParams(const Program& program, int32_t func) {
+			auto& types = program.signatures.at(func).second;
+			auto& code = program.functions.at(func);
+			auto offsets = paramOffsets(types);
+			std::vector<bool> readOnly(types.size(), true);
+			auto frame = frameAccesses(program, code);
+			for (std::size_t k = 0; k < types.size(); k++) {
+				for (auto slot = offsets[k]; slot < offsets[k] + widthOf(types[k]); slot++)
+					if (frame.escaped.count(slot))
+						readOnly[k] = false;
+			}
+			for (auto& access : frame.accesses) {
+				if (!access.has_value() || !access->store)
+					continue;
+				for (std::size_t k = 0; k < types.size(); k++) {
+					if (access->slot < 0 || (access->slot < offsets[k] + widthOf(types[k]) && offsets[k] < access->slot + access->width))
+						readOnly[k] = false;
+				}
+			}
+			return readOnly;
+		}
+
+		// pos 处栈顶往下第 k 个slot上的值是否为字面量，double 可以由 int 字面量转换而来
+		std::optional<Literal> constantAt(const Program& program, const std::vector<Instruction>& code, int32_t pos, int32_t k, TokenType type) {
+			auto producer = producerOf(program, code, pos, k);
+			if (!producer.has_value())
+				return {};
+			auto& ins = code[producer.value()];
+			if (type == TokenType::DOUBLE && ins.GetOperation() == Operation::I2D) {
+				auto source = producerOf(program, code, producer.value(), 0);
+				if (!source.has_value())
+					return {};
+				auto value = literalOf(program, code[source.value()]);
+				if (!value.has_value() || !std::holds_alternative<int32_t>(value.value()))
+					return {};
+				return Literal((double)std::get<int32_t>(value.value()));
+			}
+			auto value = literalOf(program, ins);
+			if (!value.has_value() || std::holds_alternative<double>(value.value()) != (type == TokenType::DOUBLE))
+				return {};
+			return value;
+		}
+
+		// pos 处栈顶往下第 k 个slot上的值是否为读取本函数的参数 slot 得到的
+		bool loadsParam(const Program& program, const std::vector<Instruction>& code, int32_t pos, int32_t k, int32_t slot) {
+			auto load = producerOf(program, code, pos, k);
+			if (!load.has_value())
+				return false;
+			auto op = code[load.value()].GetOperation();
+			if (op != Operation::ILOAD && op != Operation::DLOAD)
+				return false;
+			auto address = producerOf(program, code, load.value(), 0);
+			return address.has_value() && code[address.value()] == Instruction(Operation::LOADA, 0, slot);
+		}
+
+		bool insideLoop(const std::vector<Instruction>& code, int32_t pos) {
+			for (int32_t i = pos; i < (int32_t)code.size(); i++)
+				if (isJump(code[i].GetOperation()) && code[i].GetX() <= pos)
+					return true;
+			return false;
+		}
+
+		std::vector<Site> callSites(const Program& program, const Profile* profile) {
+			std::vector<Site> sites;
+			const auto scan = [&](int32_t caller, const std::vector<Instruction>& code) {
+				bool hotCaller = false;
+				if (profile != nullptr) {
+					auto itr = profile->functions.find(caller);
+					hotCaller = itr != profile->functions.end() && itr->second.calls >= HotCalls;
+				}
+				std::vector<bool> readOnly;
+				if (caller >= 0 && program.signatures.count(caller))
+					readOnly = readOnlyParams(program, caller);
+				for (int32_t pos = 0; pos < (int32_t)code.size(); pos++) {
+					if (code[pos].GetOperation() != Operation::CALL)
+						continue;
+					const int32_t callee = code[pos].GetX();
+					auto sig = program.signatures.find(callee);
+					if (sig == program.signatures.end() || !program.functions.count(callee))
+						continue;
+					auto& types = sig->second.second;
+					auto offsets = paramOffsets(types);
+					const int32_t slots = paramSlots(program, callee);
+					Site site{caller, pos, callee, std::vector<Argument>(types.size()), hotCaller || insideLoop(code, pos)};
+					for (std::size_t k = 0; k < types.size(); k++) {
+						// 栈顶是最后一个参数的最后一个slot
+						const int32_t depth = slots - offsets[k] - widthOf(types[k]);
+						auto value = constantAt(program, code, pos, depth, types[k]);
+						if (value.has_value())
+							site.arguments[k] = {Argument::Kind::Constant, value.value()};
+						else if (callee == caller && readOnly[k] && loadsParam(program, code, pos, depth, offsets[k]))
+							site.arguments[k].kind = Argument::Kind::PassThrough;
+					}
+					sites.push_back(site);
+				}
+			};
+			scan(-1, program.start);
+			for (auto& [func, code] : program.functions)
+				scan(func, code);
+			return sites;
+		}
+
+		// 把函数中对只读参数的读取换成常量，返回是否有改动
+		bool substitute(Program& program, int32_t func, const std::map<int32_t, Literal>& constants) {
+			auto& types = program.signatures.at(func).second;
+			auto offsets = paramOffsets(types);
+			auto readOnly = readOnlyParams(program, func);
+			auto& code = program.functions[func];
+			auto frame = frameAccesses(program, code);
+			CodePatch patch(code);
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				auto& access = frame.accesses[i];
+				auto op = code[i].GetOperation();
+				if (!access.has_value() || access->store || access->address != i - 1 || (op != Operation::ILOAD && op != Operation::DLOAD))
+					continue;
+				for (auto& [k, value] : constants) {
+					if (!readOnly[k] || access->slot != offsets[k] || access->width != widthOf(types[k]))
+						continue;
+					patch.Remove(i - 1);
+					patch.Replace(i, {pushLiteral(program, value)});
+				}
+			}
+			if (patch.Empty())
+				return false;
+			patch.Apply();
+			return true;
+		}
+
+		// 所有调用点都传入同一个常量的参数换成常量，直到没有变化
+		void propagate(Program& program, const Profile* profile) {
+			for (std::size_t round = 0; round <= program.functions.size(); round++) {
+				std::map<int32_t, std::vector<std::optional<Argument> > > lattice;
+				for (auto& site : callSites(program, profile)) {
+					auto& params = lattice[site.callee];
+					if (params.empty())
+						params.resize(site.arguments.size());
+					for (std::size_t k = 0; k < site.arguments.size(); k++) {
+						auto& arg = site.arguments[k];
+						auto& param = params[k];
+						if (arg.kind == Argument::Kind::PassThrough || (param.has_value() && param->kind == Argument::Kind::Unknown))
+							continue;
+						if (!param.has_value())
+							param = arg;
+						else if (arg.kind != Argument::Kind::Constant || !sameLiteral(arg.value, param->value))
+							param->kind = Argument::Kind::Unknown;
+					}
+				}
+				bool changed = false;
+				for (auto& [callee, params] : lattice) {
+					std::map<int32_t, Literal> constants;
+					for (std::size_t k = 0; k < params.size(); k++)
+						if (params[k].has_value() && params[k]->kind == Argument::Kind::Constant)
+							constants.emplace(k, params[k]->value);
+					if (!constants.empty() && substitute(program, callee, constants))
+						changed = true;
+				}
+				if (!changed)
+					return;
+			}
+		}
+
+		int32_t cloneFunction(Program& program, int32_t func) {
+			const int32_t clone = program.funcs.rbegin()->first + 1;
+			auto [_, name, params, level] = program.funcs.at(func);
+			const int32_t index = program.consts.rbegin()->first + 1;
+			// 标识符中不能出现 '.'，不会与已有的函数重名
+			program.consts[index] = std::make_tuple(std::string("S"),
+				std::get<1>(program.consts.at(name)) + "." + std::to_string(clone));
+			program.funcs[clone] = std::make_tuple(clone, index, params, level);
+			program.functions[clone] = program.functions.at(func);
+			program.signatures[clone] = program.signatures.at(func);
+			return clone;
+		}
+
+		struct Specialisation {
+			int32_t callee;
+			std::map<int32_t, Literal> constants;
+			std::vector<std::pair<int32_t, int32_t> > sites;
+		};
+
+		// 热点调用点上部分参数是常量时，为这组常量复制一份函数，热点调用改为调用副本
+		void specialise(Program& program, const Profile* profile) {
+			std::vector<Specialisation> candidates;
+			std::map<int32_t, std::vector<bool> > readOnly;
+			for (auto& site : callSites(program, profile)) {
+				if (!site.hot || site.callee == site.caller)
+					continue;
+				if (!readOnly.count(site.callee))
+					readOnly[site.callee] = readOnlyParams(program, site.callee);
+				std::map<int32_t, Literal> constants;
+				for (std::size_t k = 0; k < site.arguments.size(); k++)
+					if (site.arguments[k].kind == Argument::Kind::Constant && readOnly[site.callee][k])
+						constants.emplace(k, site.arguments[k].value);
+				if (constants.empty())
+					continue;
+				auto same = std::find_if(candidates.begin(), candidates.end(), [&](const Specialisation& s) {
+					return s.callee == site.callee && s.constants.size() == constants.size()
+						&& std::equal(s.constants.begin(), s.constants.end(), constants.begin(), [](auto& x, auto& y) {
+							return x.first == y.first && sameLiteral(x.second, y.second);
+						});
+				});
+				if (same == candidates.end()) {
+					candidates.push_back({site.callee, constants, {}});
+					same = candidates.end() - 1;
+				}
+				same->sites.emplace_back(site.caller, site.pos);
+			}
+			// 热点调用点多的先特化
+			std::stable_sort(candidates.begin(), candidates.end(), [](const Specialisation& x, const Specialisation& y) {
+				return x.sites.size() > y.sites.size();
+			});
+
+			int32_t budget = SpecialisationBudget;
+			for (auto& candidate : candidates) {
+				const int32_t size = program.functions.at(candidate.callee).size();
+				if (size > MaxSpecialisedSize || size > budget)
+					continue;
+				const int32_t clone = cloneFunction(program, candidate.callee);
+				// 副本中原样传递这些参数的自递归也调用副本
+				auto& types = program.signatures.at(clone).second;
+				auto offsets = paramOffsets(types);
+				const int32_t slots = paramSlots(program, clone);
+				auto& body = program.functions[clone];
+				for (int32_t pos = 0; pos < (int32_t)body.size(); pos++) {
+					if (body[pos].GetOperation() != Operation::CALL || body[pos].GetX() != candidate.callee)
+						continue;
+					bool passes = true;
+					for (auto& [k, _] : candidate.constants)
+						passes = passes && loadsParam(program, body, pos, slots - offsets[k] - widthOf(types[k]), offsets[k]);
+					if (passes)
+						body[pos].set_X(clone);
+				}
+				substitute(program, clone, candidate.constants);
+				for (auto [caller, pos] : candidate.sites)
+					(caller < 0 ? program.start : program.functions[caller])[pos].set_X(clone);
+				budget -= size;
+			}
+		}
+	}
+
+	void propagateConstantArguments(Program& program, const Profile* profile) {
+		propagate(program, profile);
+		specialise(program, profile);
+		// 副本中的常量可能继续传给它调用的函数
+		propagate(program, profile);
+	}
+}
@@ -0,0 +1,125 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <queue>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		struct Copy {
+			int32_t source;
+			int32_t width;
+
+			bool operator==(const Copy& rhs) const { return source == rhs.source && width == rhs.width; }
+		};
+		// 目标slot -> 复制来源，目标中的值与来源中的值相同
+		using Copies = std::map<int32_t, Copy>;
+
+		bool overlaps(int32_t a, int32_t aw, int32_t b, int32_t bw) {
+			return a < b + bw && b < a + aw;
+		}
+
+		// pos 处的写入是否为 x = y：LOADA 0,x; LOADA 0,y; ILOAD; ISTORE
+		std::optional<Copy> copyAt(const Program& program, const std::vector<Instruction>& code, const FrameAccesses& frame, int32_t pos) {
+			auto& store = frame.accesses[pos];
+			if (pos < 3 || !store.has_value() || !store->store || store->load || store->slot < 0)
+				return {};
+			auto& load = frame.accesses[pos - 1];
+			if (!load.has_value() || !load->load || load->store || load->slot < 0 || load->width != store->width
+				|| overlaps(load->slot, load->width, store->slot, store->width))
+				return {};
+			if (code[pos - 2].GetOperation() != Operation::LOADA || producerOf(program, code, pos, store->width) != pos - 3)
+				return {};
+			return Copy{load->slot, load->width};
+		}
+
+		bool escapes(const FrameAccesses& frame, int32_t slot, int32_t width) {
+			for (auto k = slot; k < slot + width; k++)
+				if (frame.escaped.count(k))
+					return true;
+			return false;
+		}
+
+		void transfer(const Program& program, const std::vector<Instruction>& code, const FrameAccesses& frame, int32_t pos, Copies& copies) {
+			auto& access = frame.accesses[pos];
+			if (!access.has_value() || !access->store)
+				return;
+			if (access->slot < 0) {
+				copies.clear();
+				return;
+			}
+			for (auto itr = copies.begin(); itr != copies.end();) {
+				if (overlaps(itr->first, itr->second.width, access->slot, access->width)
+					|| overlaps(itr->second.source, itr->second.width, access->slot, access->width))
+					itr = copies.erase(itr);
+				else
+					itr++;
+			}
+			auto copy = copyAt(program, code, frame, pos);
+			if (copy.has_value() && !escapes(frame, access->slot, access->width) && !escapes(frame, copy->source, copy->width))
+				copies[access->slot] = copy.value();
+		}
+
+		// 每条指令之前一定成立的复制关系，不可达的指令为空
+		std::vector<std::optional<Copies> > availableCopies(const Program& program, const std::vector<Instruction>& code, const FrameAccesses& frame) {
+			std::vector<std::optional<Copies> > in(code.size());
+			if (code.empty())
+				return in;
+			in[0] = Copies();
+			std::queue<int32_t> work;
+			work.push(0);
+			while (!work.empty()) {
+				auto pos = work.front();
+				work.pop();
+				auto out = in[pos].value();
+				transfer(program, code, frame, pos, out);
+				for (auto succ : successorsOf(code, pos)) {
+					if (!in[succ].has_value()) {
+						in[succ] = out;
+						work.push(succ);
+						continue;
+					}
+					// 汇合处只保留所有路径上都成立的复制
+					Copies meet;
+					for (auto& [slot, copy] : in[succ].value()) {
+						auto itr = out.find(slot);
+						if (itr != out.end() && itr->second == copy)
+							meet[slot] = copy;
+					}
+					if (meet.size() != in[succ]->size()) {
+						in[succ] = meet;
+						work.push(succ);
+					}
+				}
+			}
+			return in;
+		}
+
+		bool propagateOnce(const Program& program, std::vector<Instruction>& code) {
+			auto frame = frameAccesses(program, code);
+			auto copies = availableCopies(program, code, frame);
+			bool changed = false;
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				auto& access = frame.accesses[i];
+				if (!copies[i].has_value() || !access.has_value() || !access->load || access->store || access->address < 0)
+					continue;
+				auto itr = copies[i]->find(access->slot);
+				if (itr == copies[i]->end() || itr->second.width != access->width)
+					continue;
+				code[access->address] = Instruction(Operation::LOADA, 0, itr->second.source);
+				changed = true;
+			}
+			return changed;
+		}
+	}
+
+	void propagateCopies(Program& program) {
+		for (auto& [_, code] : program.functions) {
+			// x = y; z = x; 在第一轮之后变成 z = y，可以继续传播
+			for (std::size_t round = 0; round < code.size() && propagateOnce(program, code); round++)
+				;
+		}
+	}
+}
@@ -0,0 +1,87 @@
+#include "passes.h"
+#include "bytecode.h"
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		// 可以连同结果一起删掉的计算：没有副作用，也不会出错
+		bool isRemovable(Operation op) {
+			switch (op) {
+				case Operation::BIPUSH:
+				case Operation::IPUSH:
+				case Operation::LOADC:
+				case Operation::LOADA:
+				case Operation::ILOAD:
+				case Operation::DLOAD:
+				case Operation::DUP:
+				case Operation::DUP2:
+				case Operation::IADD:
+				case Operation::DADD:
+				case Operation::ISUB:
+				case Operation::DSUB:
+				case Operation::IMUL:
+				case Operation::DMUL:
+				case Operation::INEG:
+				case Operation::DNEG:
+				case Operation::ICMP:
+				case Operation::DCMP:
+				case Operation::I2D:
+				case Operation::D2I:
+				case Operation::I2C:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		// 删除一轮死写入，返回是否有改动
+		bool eliminateOnce(const Program& program, std::vector<Instruction>& code) {
+			auto frame = frameAccesses(program, code);
+			auto live = liveSlots(code, frame);
+			CodePatch patch(code);
+			// 已删除的指令，一段值的计算中可能含有另一条死写入的地址
+			std::vector<bool> removed(code.size(), false);
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				auto& access = frame.accesses[i];
+				auto op = code[i].GetOperation();
+				if ((op != Operation::ISTORE && op != Operation::DSTORE) || !access.has_value() || access->slot < 0 || access->address < 0)
+					continue;
+				bool dead = true;
+				for (auto k = access->slot; k < access->slot + access->width; k++)
+					dead = dead && !live[i][k];
+				if (!dead || removed[access->address])
+					continue;
+
+				// LOADA 0,x; <值>; ISTORE，值在 (address, i) 中计算
+				bool pure = true;
+				for (auto k = access->address + 1; k < i; k++)
+					pure = pure && isRemovable(code[k].GetOperation()) && !removed[k];
+				if (pure) {
+					for (auto k = access->address; k <= i; k++) {
+						patch.Remove(k);
+						removed[k] = true;
+					}
+				}
+				else {
+					patch.Remove(access->address);
+					removed[access->address] = true;
+					patch.Replace(i, {Instruction(access->width == 2 ? Operation::POP2 : Operation::POP)});
+				}
+			}
+			if (patch.Empty())
+				return false;
+			patch.Apply();
+			return true;
+		}
+	}
+
+	void eliminateDeadStores(Program& program) {
+		for (auto& [_, code] : program.functions) {
+			// 删掉一条写入后，它读取的变量之前的写入也可能变成死写入
+			for (std::size_t round = 0; round < code.size() && eliminateOnce(program, code); round++)
+				;
+		}
+	}
+}
@@ -0,0 +1,130 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <functional>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		// 规范化后的指令：对自身的调用不看函数下标，这样相同的递归函数也能合并
+		std::vector<Instruction> canonical(int32_t func, const std::vector<Instruction>& code) {
+			std::vector<Instruction> result(code);
+			for (auto& ins : result)
+				if (ins.GetOperation() == Operation::CALL && ins.GetX() == func)
+					ins = Instruction(Operation::CALL, -1, ins.GetOpt());
+			return result;
+		}
+
+		std::size_t hashOf(const Program& program, int32_t func, const std::vector<Instruction>& code) {
+			std::size_t seed = std::hash<int32_t>()(paramSlots(program, func));
+			const auto combine = [&](std::int64_t x) {
+				seed ^= std::hash<std::int64_t>()(x) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+			};
+			combine(std::get<3>(program.funcs.at(func)));
+			for (auto& ins : code) {
+				combine(ins.GetOperation());
+				combine(ins.GetX());
+				combine(ins.GetOpt());
+			}
+			return seed;
+		}
+
+		// 两个函数可以互相替换：参数、层级和签名相同，规范化后的指令完全一样
+		bool interchangeable(const Program& program, int32_t x, const std::vector<Instruction>& cx, int32_t y, const std::vector<Instruction>& cy) {
+			auto& fx = program.funcs.at(x);
+			auto& fy = program.funcs.at(y);
+			if (std::get<2>(fx) != std::get<2>(fy) || std::get<3>(fx) != std::get<3>(fy) || cx != cy)
+				return false;
+			auto sx = program.signatures.find(x);
+			auto sy = program.signatures.find(y);
+			if ((sx == program.signatures.end()) != (sy == program.signatures.end()))
+				return false;
+			return sx == program.signatures.end() || sx->second == sy->second;
+		}
+
+		bool isMain(const Program& program, int32_t func) {
+			auto name = program.consts.find(std::get<1>(program.funcs.at(func)));
+			return name != program.consts.end() && std::get<1>(name->second) == "main";
+		}
+
+		void redirectCalls(Program& program, const std::map<int32_t, int32_t>& target) {
+			const auto redirect = [&](std::vector<Instruction>& code) {
+				for (auto& ins : code) {
+					if (ins.GetOperation() != Operation::CALL)
+						continue;
+					auto itr = target.find(ins.GetX());
+					if (itr != target.end())
+						ins = Instruction(Operation::CALL, itr->second, ins.GetOpt());
+				}
+			};
+			redirect(program.start);
+			for (auto& [_, code] : program.functions)
+				redirect(code);
+		}
+
+		// 合并一轮，返回被合并掉的函数个数
+		int32_t mergeOnce(Program& program) {
+			std::map<std::size_t, std::vector<int32_t> > buckets;
+			std::map<int32_t, std::vector<Instruction> > forms;
+			for (auto& [func, code] : program.functions) {
+				if (!program.funcs.count(func) || isMain(program, func))
+					continue;
+				forms[func] = canonical(func, code);
+				buckets[hashOf(program, func, forms[func])].push_back(func);
+			}
+			// 被合并的函数 -> 保留的函数，保留下标最小的一个
+			std::map<int32_t, int32_t> target;
+			for (auto& [_, funcs] : buckets) {
+				for (std::size_t i = 0; i < funcs.size(); i++) {
+					if (target.count(funcs[i]))
+						continue;
+					for (auto j = i + 1; j < funcs.size(); j++)
+						if (!target.count(funcs[j]) && interchangeable(program, funcs[i], forms[funcs[i]], funcs[j], forms[funcs[j]]))
+							target[funcs[j]] = funcs[i];
+				}
+			}
+			redirectCalls(program, target);
+			for (auto& [func, _] : target) {
+				program.functions.erase(func);
+				program.funcs.erase(func);
+				program.signatures.erase(func);
+			}
+			return target.size();
+		}
+
+		// 二进制格式中函数按顺序排列，下标必须连续
+		void renumberFunctions(Program& program) {
+			std::map<int32_t, int32_t> index;
+			for (auto& [func, _] : program.funcs)
+				index.emplace(func, index.size());
+			redirectCalls(program, index);
+			std::map<int32_t, std::tuple<int32_t, int32_t, int32_t, int32_t> > funcs;
+			std::map<int32_t, std::vector<Instruction> > functions;
+			std::map<int32_t, std::pair<TokenType, std::vector<TokenType> > > signatures;
+			for (auto& [func, f] : program.funcs) {
+				auto [_, name, params, level] = f;
+				funcs[index[func]] = std::make_tuple(index[func], name, params, level);
+				if (program.functions.count(func))
+					functions[index[func]] = program.functions[func];
+				if (program.signatures.count(func))
+					signatures[index[func]] = program.signatures[func];
+			}
+			program.funcs = funcs;
+			program.functions = functions;
+			program.signatures = signatures;
+		}
+	}
+
+	void mergeIdenticalFunctions(Program& program) {
+		// 合并被调函数后，调用它们的函数也可能变得相同
+		int32_t merged = 0;
+		for (int32_t round = mergeOnce(program); round > 0; round = mergeOnce(program))
+			merged += round;
+		if (merged == 0)
+			return;
+		renumberFunctions(program);
+		compactConstants(program);
+	}
+}
@@ -0,0 +1,240 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <algorithm>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		// 循环中可能被修改的变量
+		struct Clobbers {
+			std::set<int32_t> locals;
+			std::set<int32_t> globals;
+			bool allLocals = false;
+			bool allGlobals = false;
+
+			bool modifies(int32_t level, int32_t offset) const {
+				if (level == 0)
+					return allLocals || locals.count(offset);
+				return allGlobals || globals.count(offset);
+			}
+		};
+
+		Clobbers clobbersOf(const Program& program, const std::map<int32_t, SideEffects>& effects,
+			const std::vector<Instruction>& code, const Loop& loop) {
+			Clobbers c;
+			for (auto i = loop.header; i <= loop.latch; i++) {
+				auto op = code[i].GetOperation();
+				if (op == Operation::CALL) {
+					// 被调用的函数只可能修改全局变量
+					auto& e = effects.at(code[i].GetX());
+					c.globals.insert(e.writes.begin(), e.writes.end());
+					c.allGlobals = c.allGlobals || e.unknownWrite;
+					c.allLocals = c.allLocals || e.unknownWrite;
+				}
+				if (op != Operation::ISTORE && op != Operation::DSTORE)
+					continue;
+				const int32_t width = op == Operation::DSTORE ? 2 : 1;
+				auto address = producerOf(program, code, i, width);
+				if (!address.has_value() || code[*address].GetOperation() != Operation::LOADA) {
+					c.allLocals = c.allGlobals = true;
+					continue;
+				}
+				auto& set = code[*address].GetX() == 0 ? c.locals : c.globals;
+				for (int32_t k = 0; k < width; k++)
+					set.insert(code[*address].GetOpt() + k);
+			}
+			return c;
+		}
+
+		// 栈上一个slot的来历
+		struct Slot {
+			int32_t start;
+			bool invariant;
+		};
+
+		// [start, end] 计算出一个循环不变的值
+		struct Invariant {
+			int32_t start;
+			int32_t end;
+			int32_t width;
+		};
+
+		// 只有三条以上指令的计算值得换成 LOADA t; ILOAD
+		const int32_t MinimumLength = 3;
+
+		// 找出循环中极大的不变计算
+		// 除法可能除零，提到循环外会改变不进入循环时的行为，所以不算在内
+		std::vector<Invariant> invariantsOf(const Program& program, const std::vector<Instruction>& code,
+			const Loop& loop, const Clobbers& clobbers) {
+			std::vector<Invariant> found;
+			auto leaders = findLeaders(code);
+			std::vector<Slot> stack;
+			// 最近一条不是纯计算的指令，不变计算中间不能夹着有副作用的指令
+			int32_t impure = loop.header - 1;
+			const auto pop = [&](int32_t width) {
+				Slot s{-1, false};
+				for (int32_t k = 0; k < width; k++) {
+					if (stack.empty())
+						return Slot{-1, false};
+					s = stack.back();
+					stack.pop_back();
+				}
+				return s;
+			};
+			const auto push = [&](Slot s, int32_t width, int32_t end) {
+				if (s.invariant && s.start > impure && end - s.start + 1 >= MinimumLength)
+					found.push_back({s.start, end, width});
+				for (int32_t k = 0; k < width; k++)
+					stack.emplace_back(s);
+			};
+
+			for (auto i = loop.header; i <= loop.latch; i++) {
+				if (leaders[i])
+					stack.clear();
+				auto& ins = code[i];
+				auto op = ins.GetOperation();
+				auto effect = stackEffectOf(program, ins);
+				switch (op) {
+					case Operation::BIPUSH:
+					case Operation::IPUSH:
+					case Operation::LOADC:
+					case Operation::LOADA:
+						push({i, true}, effect.push, i);
+						break;
+					case Operation::ILOAD:
+					case Operation::DLOAD: {
+						auto address = pop(1);
+						bool invariant = address.invariant && address.start == i - 1
+							&& code[i - 1].GetOperation() == Operation::LOADA;
+						if (invariant) {
+							auto level = code[i - 1].GetX(), offset = code[i - 1].GetOpt();
+							for (int32_t k = 0; k < effect.push; k++)
+								invariant = invariant && !clobbers.modifies(level, offset + k);
+						}
+						push({address.start, invariant}, effect.push, i);
+						break;
+					}
+					case Operation::IADD:
+					case Operation::ISUB:
+					case Operation::IMUL:
+					case Operation::ICMP:
+					case Operation::DADD:
+					case Operation::DSUB:
+					case Operation::DMUL:
+					case Operation::DCMP: {
+						auto rhs = pop(effect.pop / 2);
+						auto lhs = pop(effect.pop / 2);
+						push({lhs.start, lhs.invariant && rhs.invariant}, effect.push, i);
+						break;
+					}
+					case Operation::INEG:
+					case Operation::DNEG:
+					case Operation::I2C:
+					case Operation::I2D:
+					case Operation::D2I: {
+						auto operand = pop(effect.pop);
+						push({operand.start, operand.invariant}, effect.push, i);
+						break;
+					}
+					default:
+						// CALL、ISCAN/DSCAN/CSCAN 等的结果都不是不变量
+						impure = i;
+						pop(effect.pop);
+						for (int32_t k = 0; k < effect.push; k++)
+							stack.push_back({i, false});
+						break;
+				}
+			}
+
+			// 只保留不被其他不变计算包含的
+			std::sort(found.begin(), found.end(), [](const Invariant& x, const Invariant& y) {
+				return x.start != y.start ? x.start < y.start : x.end > y.end;
+			});
+			std::vector<Invariant> maximal;
+			for (auto& inv : found)
+				if (maximal.empty() || inv.start > maximal.back().end)
+					maximal.emplace_back(inv);
+			return maximal;
+		}
+
+		// 同样的指令序列共用一个临时slot
+		using Expression = std::vector<std::tuple<Operation, int32_t, int32_t> >;
+
+		Expression expressionOf(const std::vector<Instruction>& code, const Invariant& inv) {
+			Expression e;
+			for (auto i = inv.start; i <= inv.end; i++)
+				e.emplace_back(code[i].GetOperation(), code[i].GetX(), code[i].GetOpt());
+			return e;
+		}
+
+		struct Hoist {
+			Loop loop;
+			std::vector<Invariant> invariants;
+			// 表达式 -> 第几个临时slot
+			std::map<Expression, int32_t> slots;
+			int32_t size;
+		};
+
+		// 从外到内找第一个有不变计算的循环
+		std::optional<Hoist> findHoist(const Program& program, const std::map<int32_t, SideEffects>& effects,
+			const std::vector<Instruction>& code) {
+			for (auto& loop : findLoops(code)) {
+				auto clobbers = clobbersOf(program, effects, code, loop);
+				auto invariants = invariantsOf(program, code, loop, clobbers);
+				if (invariants.empty())
+					continue;
+				Hoist h{loop, invariants, {}, 0};
+				for (auto& inv : invariants) {
+					auto e = expressionOf(code, inv);
+					if (!h.slots.count(e)) {
+						h.slots[e] = h.size;
+						h.size += inv.width;
+					}
+				}
+				return h;
+			}
+			return {};
+		}
+
+		// 循环不变的计算移到循环前，结果存入栈帧中的临时slot
+		void hoistInvariants(const Program& program, const std::map<int32_t, SideEffects>& effects,
+			int32_t func, std::vector<Instruction>& code) {
+			while (true) {
+				auto hoist = findHoist(program, effects, code);
+				if (!hoist.has_value())
+					return;
+				auto base = allocateFrameSlots(program, func, code, hoist->size);
+				// 分配栈帧可能移动了指令的位置
+				hoist = findHoist(program, effects, code);
+
+				CodePatch patch(code);
+				std::set<Expression> initialized;
+				for (auto& inv : hoist->invariants) {
+					auto e = expressionOf(code, inv);
+					const int32_t slot = base + hoist->slots.at(e);
+					const bool isDouble = inv.width == 2;
+					if (!initialized.count(e)) {
+						initialized.insert(e);
+						std::vector<Instruction> init = {Instruction(Operation::LOADA, 0, slot)};
+						init.insert(init.end(), code.begin() + inv.start, code.begin() + inv.end + 1);
+						init.emplace_back(isDouble ? Operation::DSTORE : Operation::ISTORE);
+						patch.InsertBefore(hoist->loop.header, init, false);
+					}
+					patch.Replace(inv.start, {Instruction(Operation::LOADA, 0, slot), Instruction(isDouble ? Operation::DLOAD : Operation::ILOAD)});
+					for (auto i = inv.start + 1; i <= inv.end; i++)
+						patch.Remove(i);
+				}
+				patch.Apply();
+			}
+		}
+	}
+
+	void hoistLoopInvariants(Program& program) {
+		auto effects = sideEffects(program);
+		for (auto& [func, code] : program.functions)
+			hoistInvariants(program, effects, func, code);
+	}
+}
@@ -0,0 +1,187 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <cmath>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		// 代价表：一条指令的代价为编码的字节数加上分派的代价，常量表中的操作数还要多一次查表
+		// 新加一个 double 常量会让常量表多 9 个字节（类型 1 字节，值 8 字节）
+		const int32_t DispatchCost = 4;
+		const int32_t PoolLoadCost = 2;
+		const int32_t NewDoubleCost = 9;
+
+		int32_t costOf(Operation op) {
+			switch (op) {
+				case Operation::BIPUSH:
+					return 2 + DispatchCost;
+				case Operation::IPUSH:
+					return 5 + DispatchCost;
+				case Operation::LOADC:
+					return 3 + DispatchCost + PoolLoadCost;
+				default:
+					return 1 + DispatchCost;
+			}
+		}
+
+		int32_t costOf(const std::vector<Instruction>& code) {
+			int32_t cost = 0;
+			for (auto& ins : code)
+				cost += costOf(ins.GetOperation());
+			return cost;
+		}
+
+		// 对字面量做一次转换，类型不符或结果未定义时返回空
+		std::optional<Literal> convert(Operation op, const Literal& value) {
+			if (std::holds_alternative<int32_t>(value)) {
+				auto x = std::get<int32_t>(value);
+				switch (op) {
+					case Operation::I2D:
+						return Literal((double)x);
+					case Operation::I2C:
+						return Literal((int32_t)(uint8_t)x);
+					case Operation::INEG:
+						return Literal((int32_t)(0u - (uint32_t)x));
+					default:
+						return {};
+				}
+			}
+			auto d = std::get<double>(value);
+			switch (op) {
+				case Operation::D2I:
+					if (!(d > -2147483649.0 && d < 2147483648.0))
+						return {};
+					return Literal((int32_t)d);
+				case Operation::DNEG:
+					return Literal(-d);
+				default:
+					return {};
+			}
+		}
+
+		std::vector<Instruction> pushInt(int32_t x) {
+			if (0 <= x && x <= 255)
+				return {Instruction(Operation::BIPUSH, x)};
+			return {Instruction(Operation::IPUSH, x)};
+		}
+
+		struct Encoding {
+			std::vector<Instruction> code;
+			int32_t cost;
+			// 需要在常量表中添加的 double 常量
+			std::optional<double> constant;
+		};
+
+		// 压入 value 的最便宜的编码，int 总有合适的立即数
+		Encoding cheapest(const Program& program, const Literal& value) {
+			if (std::holds_alternative<int32_t>(value)) {
+				auto code = pushInt(std::get<int32_t>(value));
+				return {code, costOf(code), {}};
+			}
+			auto d = std::get<double>(value);
+			auto index = findDoubleConstant(program, d);
+			Encoding best{{Instruction(Operation::LOADC, index.value_or(-1))}, costOf(Operation::LOADC), {}};
+			if (!index.has_value()) {
+				best.cost += NewDoubleCost;
+				best.constant = d;
+			}
+			// 整数值（-0.0 除外）可以由整数转换得到
+			if (d == std::floor(d) && d >= INT32_MIN && d <= INT32_MAX && !(d == 0 && std::signbit(d))) {
+				auto code = pushInt((int32_t)d);
+				code.emplace_back(Operation::I2D);
+				if (costOf(code) < best.cost)
+					best = {code, costOf(code), {}};
+			}
+			return best;
+		}
+
+		int32_t poolLoads(const std::vector<Instruction>& code) {
+			int32_t loads = 0;
+			for (auto& ins : code)
+				loads += ins.GetOperation() == Operation::LOADC;
+			return loads;
+		}
+
+		bool isConversion(Operation op) {
+			return op == Operation::I2D || op == Operation::D2I || op == Operation::I2C
+				|| op == Operation::INEG || op == Operation::DNEG;
+		}
+
+		// 把字面量连同紧随其后的转换换成代价最小的编码
+		void selectLiterals(Program& program, std::vector<Instruction>& code) {
+			auto leaders = findLeaders(code);
+			CodePatch patch(code);
+			const int32_t n = code.size();
+			for (int32_t i = 0; i < n; i++) {
+				auto value = literalOf(program, code[i]);
+				if (!value.has_value())
+					continue;
+				int32_t end = i + 1;
+				for (; end < n && !leaders[end] && isConversion(code[end].GetOperation()); end++) {
+					auto next = convert(code[end].GetOperation(), value.value());
+					if (!next.has_value())
+						break;
+					value = next;
+				}
+				std::vector<Instruction> original(code.begin() + i, code.begin() + end);
+				auto best = cheapest(program, value.value());
+				// 代价相同时选不读常量表的编码
+				const auto cost = costOf(original);
+				if (best.cost > cost || (best.cost == cost && poolLoads(best.code) >= poolLoads(original))) {
+					i = end - 1;
+					continue;
+				}
+				if (best.constant.has_value())
+					best.code[0].set_X(doubleConstant(program, best.constant.value()));
+				patch.Replace(i, best.code);
+				for (auto k = i + 1; k < end; k++)
+					patch.Remove(k);
+				i = end - 1;
+			}
+			patch.Apply();
+		}
+
+		// 结果一定在 0..255 之内，再做 I2C 不会改变它
+		bool isCharValue(const Instruction& ins) {
+			switch (ins.GetOperation()) {
+				case Operation::BIPUSH:
+				case Operation::I2C:
+				case Operation::CSCAN:
+					return true;
+				case Operation::IPUSH:
+					return 0 <= ins.GetX() && ins.GetX() <= 255;
+				default:
+					return false;
+			}
+		}
+
+		// 删除多余的 I2C：值已经在 0..255 之内，或者紧接着的 CPRINT 本来就只输出低 8 位
+		void removeRedundantConversions(const Program& program, std::vector<Instruction>& code) {
+			auto leaders = findLeaders(code);
+			CodePatch patch(code);
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				if (code[i].GetOperation() != Operation::I2C)
+					continue;
+				auto producer = producerOf(program, code, i, 0);
+				bool redundant = producer.has_value() && isCharValue(code[producer.value()]);
+				redundant = redundant || (i + 1 < (int32_t)code.size() && !leaders[i + 1] && code[i + 1].GetOperation() == Operation::CPRINT);
+				if (redundant)
+					patch.Remove(i);
+			}
+			patch.Apply();
+		}
+	}
+
+	void selectLiterals(Program& program) {
+		selectLiterals(program, program.start);
+		removeRedundantConversions(program, program.start);
+		for (auto& [_, code] : program.functions) {
+			selectLiterals(program, code);
+			removeRedundantConversions(program, code);
+		}
+		compactConstants(program);
+	}
+}
@@ -0,0 +1,93 @@
+#include "optimizer.h"
+#include "passes.h"
+#include "bytecode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <utility>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using int64_t = std::int64_t;
+
+		// profile 在没有剖面时什么也不做
+		// fuse 生成的代码只有内置的虚拟机能执行，不在任何优化级别中
+		const std::vector<std::pair<std::string, std::function<void(Program&, const Profile*)> > > passes = {
+			{"profile", [](Program& program, const Profile* profile) { if (profile != nullptr) applyProfile(program, *profile); }},
+			{"ipcp", [](Program& program, const Profile* profile) { propagateConstantArguments(program, profile); }},
+			{"pure-calls", [](Program& program, const Profile*) { evaluatePureCalls(program); }},
+			{"literals", [](Program& program, const Profile*) { selectLiterals(program); }},
+			{"print-coalescing", [](Program& program, const Profile*) { coalescePrints(program); }},
+			{"tail-calls", [](Program& program, const Profile*) { eliminateTailCalls(program); }},
+			{"licm", [](Program& program, const Profile*) { hoistLoopInvariants(program); }},
+			{"strength-reduction", [](Program& program, const Profile*) { reduceStrength(program); }},
+			{"copy-propagation", [](Program& program, const Profile*) { propagateCopies(program); }},
+			{"dse", [](Program& program, const Profile*) { eliminateDeadStores(program); }},
+			{"cse", [](Program& program, const Profile*) { eliminateCommonSubexpressions(program); }},
+			{"value-ranges", [](Program& program, const Profile*) { propagateValueRanges(program); }},
+			{"slot-allocation", [](Program& program, const Profile*) { allocateSlots(program); }},
+			{"merge-functions", [](Program& program, const Profile*) { mergeIdenticalFunctions(program); }},
+			{"fuse", [](Program& program, const Profile*) { fuseInstructions(program); }},
+		};
+
+		int64_t sizeOf(const Program& program) {
+			int64_t size = program.start.size();
+			for (auto& [_, code] : program.functions)
+				size += code.size();
+			return size;
+		}
+	}
+
+	std::vector<std::string> Optimizer::PassesOf(int32_t level) {
+		switch (level) {
+			case 0:
+				return {"profile"};
+			case 1:
+				// 开销小的改写，包括跨函数的常量参数、纯函数和函数合并，但不分配新的栈帧slot，也不外提代码
+				return {"profile", "ipcp", "pure-calls", "literals", "print-coalescing", "tail-calls", "cse", "value-ranges", "merge-functions"};
+			case 2:
+				return {"profile", "ipcp", "pure-calls", "literals", "print-coalescing", "tail-calls", "licm", "strength-reduction", "copy-propagation", "dse", "cse", "value-ranges", "slot-allocation", "merge-functions"};
+			default:
+				// 外提和强度削弱产生的新临时变量再做一轮，内层循环外提的计算可能继续移出外层循环
+				return {"profile", "ipcp", "pure-calls", "literals", "print-coalescing", "tail-calls", "licm", "strength-reduction", "copy-propagation", "dse", "cse", "licm", "strength-reduction", "copy-propagation", "dse", "cse", "value-ranges", "slot-allocation", "merge-functions"};
+		}
+	}
+
+	std::vector<std::string> Optimizer::AllPasses() {
+		std::vector<std::string> names;
+		for (auto& [name, _] : passes)
+			names.push_back(name);
+		return names;
+	}
+
+	std::map<int32_t, int32_t> Optimizer::FrameSizes(const Program& program) {
+		std::map<int32_t, int32_t> sizes;
+		for (auto [func, code] : program.functions)
+			sizes[func] = reserveFrame(program, func, code);
+		return sizes;
+	}
+
+	void Optimizer::Optimize() {
+		Run(PassesOf(2));
+	}
+
+	std::optional<std::string> Optimizer::Run(const std::vector<std::string>& names) {
+		const auto find = [](const std::string& name) {
+			return std::find_if(passes.begin(), passes.end(), [&](const auto& pass) { return pass.first == name; });
+		};
+		for (auto& name : names)
+			if (find(name) == passes.end())
+				return name;
+		for (auto& name : names) {
+			const auto before = sizeOf(_program);
+			const auto begin = std::chrono::steady_clock::now();
+			find(name)->second(_program, _profile);
+			const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+			_statistics.push_back({name, elapsed.count(), before, sizeOf(_program)});
+		}
+		return {};
+	}
+}
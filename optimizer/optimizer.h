@@ -0,0 +1,53 @@
+#pragma once
+
+#include "instruction/program.h"
+#include "instruction/profile.h"
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace c0 {
+
+	// 单个优化遍的耗时和指令数变化
+	struct PassStatistics final {
+		std::string name;
+		double milliseconds;
+		std::int64_t before;
+		std::int64_t after;
+	};
+
+	// 在分析器产出的指令上依次运行各个优化遍
+	class Optimizer final {
+	private:
+		using int32_t = std::int32_t;
+	public:
+		// 支持的最高优化级别
+		static const int32_t MaxLevel = 3;
+
+		explicit Optimizer(Program& program, const Profile* profile = nullptr) : _program(program), _profile(profile), _statistics() {}
+		Optimizer(const Optimizer&) = delete;
+		Optimizer& operator=(const Optimizer&) = delete;
+
+		// 接口
+		// 相当于 -O2
+		void Optimize();
+		// 按顺序运行给出的优化遍，有不认识的名字时什么也不做并返回这个名字
+		std::optional<std::string> Run(const std::vector<std::string>& passes);
+		// 每次运行过的优化遍，按运行顺序排列
+		const std::vector<PassStatistics>& GetStatistics() const { return _statistics; }
+
+		// 各优化级别对应的优化遍，级别越高编译越慢，生成的代码越快
+		static std::vector<std::string> PassesOf(int32_t level);
+		static std::vector<std::string> AllPasses();
+		// 各函数栈帧的大小（含参数），单位是slot
+		static std::map<int32_t, int32_t> FrameSizes(const Program&);
+	private:
+		Program& _program;
+		// 可以为空
+		const Profile* _profile;
+		std::vector<PassStatistics> _statistics;
+	};
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "instruction/program.h"
+#include "instruction/profile.h"
+
+namespace c0 {
+
+	// 各个优化遍，均直接修改传入的程序
+
+	// 按执行剖面重排基本块、翻转条件跳转，并按调用点的热度内联短小的函数
+	// 剖面中的偏移对应未经优化的代码，所以必须在其他优化之前进行
+	void applyProfile(Program&, const Profile&);
+
+	// 过程间常量传播：所有调用点都传入同一个常量、且函数中从不写入的参数，在函数体中换成常量
+	// 只在部分热点调用点（循环中或剖面中执行频繁的函数中）是常量时，在增长预算内复制出特化的函数
+	void propagateConstantArguments(Program&, const Profile*);
+
+	// 推断不写全局变量、不做输入输出的纯函数，实参都是常量时在编译期执行调用，换成结果常量
+	// 只读参数的函数才能求值，执行步数超过预算或出错时保留原来的调用
+	void evaluatePureCalls(Program&);
+
+	// 按代价表为字面量和对字面量的转换选择最短、分派次数最少的编码，能用立即数时不用常量表
+	// 删除多余的 I2C 和不再被引用的常量，常量按原来的顺序重新编号
+	void selectLiterals(Program&);
+
+	// 把同一基本块中相邻的常量输出（字符串、字符、整数和 double 字面量、分隔的空格和换行）
+	// 合并为一个字符串常量和一条 SPRINT，相同内容的字符串常量只保留一个
+	void coalescePrints(Program&);
+
+	// 自递归的尾调用改写为参数赋值加跳转，return n * f(n - 1) 一类的递归改写为累加器循环
+	void eliminateTailCalls(Program&);
+
+	// 循环中不变的纯计算移到循环前，结果存入栈帧中的临时slot
+	// 调用按被调函数写入的全局变量处理，输入指令的结果不是不变量
+	void hoistLoopInvariants(Program&);
+
+	// 循环中基本归纳变量的 i * c 改为随 i 增量更新的临时变量，乘除特殊常数改写为更便宜的指令
+	void reduceStrength(Program&);
+
+	// 复制传播：x = y 之后、x 和 y 被再次写入之前对 x 的读取改为读取 y
+	// 只处理函数栈帧中的slot，全局变量一律不动
+	void propagateCopies(Program&);
+
+	// 删除写入后在被读取前就被覆盖、或之后不再被读取的栈帧slot写入，有副作用的值计算会保留
+	void eliminateDeadStores(Program&);
+
+	// 基本块内的局部值编号：重复计算已在栈顶时换成 DUP/DUP2，否则存入栈帧中的临时slot复用
+	// 写入和调用会使相关的值失效
+	void eliminateCommonSubexpressions(Program&);
+
+	// 整数值域分析：从字面量、条件跳转（if、while 和 switch 的比较）推出栈帧slot和临时值的取值区间
+	// 删除值已在 0..255 之内的 I2C，证明不会溢出的整数运算的 option 标为 NoOverflow
+	void propagateValueRanges(Program&);
+
+	// 按活跃区间给栈帧中的局部变量重新分配slot，活跃区间不相交的变量共用slot，double 放在偶数偏移上
+	// 返回栈帧（含参数）变小了的函数以及分配前后的大小
+	std::map<std::int32_t, std::pair<std::int32_t, std::int32_t> > allocateSlots(Program&);
+
+	// 合并参数、签名和规范化后的指令都相同的函数，调用改为调用保留下来的一份
+	// 函数表重新连续编号，不再被引用的函数名常量一并删除，main 不参与合并
+	void mergeIdenticalFunctions(Program&);
+
+	// 把常见的指令序列合并为超级指令，减少解释器的分派次数
+	// 生成的代码只有内置的虚拟机能执行，需要在所有其他优化之后进行
+	void fuseInstructions(Program&);
+}
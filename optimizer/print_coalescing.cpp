@@ -0,0 +1,119 @@
+#include "passes.h"
+#include "bytecode.h"
+#include "vm/vm.h"
+
+#include <cstdio>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		// 二进制格式中字符串长度只有 2 个字节
+		const std::size_t MaxStringLength = 65535;
+
+		// 一次常量输出：从 pos 开始的 length 条指令输出 text
+		struct Piece {
+			int32_t length;
+			std::string text;
+		};
+
+		std::optional<Piece> pieceAt(const Program& program, const std::vector<Instruction>& code, const std::vector<bool>& leaders, int32_t pos) {
+			// 虚拟机的 SPRINT 遇到 '\0' 就停止输出，含有它的输出不能合并
+			const auto piece = [](int32_t length, std::string text) -> std::optional<Piece> {
+				if (text.find('\0') != std::string::npos)
+					return {};
+				return Piece{length, std::move(text)};
+			};
+			const auto op = [&](int32_t k) {
+				return pos + k < (int32_t)code.size() && (k == 0 || !leaders[pos + k]) ? code[pos + k].GetOperation() : Operation::NOP;
+			};
+			if (op(0) == Operation::PRINTL)
+				return Piece{1, "\n"};
+			if (op(0) == Operation::LOADC && op(1) == Operation::SPRINT) {
+				auto c = program.consts.find(code[pos].GetX());
+				if (c == program.consts.end() || std::get<0>(c->second) != "S")
+					return {};
+				return piece(2, unescape(std::get<1>(c->second)));
+			}
+			auto value = literalOf(program, code[pos]);
+			if (!value.has_value())
+				return {};
+			if (std::holds_alternative<int32_t>(value.value())) {
+				auto x = std::get<int32_t>(value.value());
+				if (op(1) == Operation::IPRINT)
+					return Piece{2, std::to_string(x)};
+				if (op(1) == Operation::CPRINT)
+					return piece(2, std::string(1, (char)x));
+				if (op(1) != Operation::I2D || op(2) != Operation::DPRINT)
+					return {};
+				value = Literal((double)x);
+			}
+			else if (op(1) != Operation::DPRINT)
+				return {};
+			// 和虚拟机的 DPRINT 使用同样的格式
+			char buffer[512];
+			std::snprintf(buffer, sizeof buffer, "%f", std::get<double>(value.value()));
+			return Piece{op(1) == Operation::DPRINT ? 2 : 3, buffer};
+		}
+
+		// 常量表中字符串的写法：可见字符原样保留，其余字符写成 \xHH
+		std::string escape(const std::string& text) {
+			static const char* digits = "0123456789abcdef";
+			std::string result;
+			for (unsigned char ch : text) {
+				if (ch >= 33 && ch <= 126 && ch != '\\' && ch != '\"' && ch != '\'')
+					result += (char)ch;
+				else {
+					result += "\\x";
+					result += digits[ch >> 4];
+					result += digits[ch & 15];
+				}
+			}
+			return result;
+		}
+
+		int32_t stringConstant(Program& program, const std::string& text) {
+			for (auto& [index, c] : program.consts)
+				if (std::get<0>(c) == "S" && unescape(std::get<1>(c)) == text)
+					return index;
+			const int32_t index = program.consts.empty() ? 0 : program.consts.rbegin()->first + 1;
+			program.consts[index] = std::make_tuple(std::string("S"), escape(text));
+			return index;
+		}
+
+		void coalesce(Program& program, std::vector<Instruction>& code) {
+			auto leaders = findLeaders(code);
+			CodePatch patch(code);
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				// 从 i 开始、中间没有跳转目标的一串常量输出
+				std::string text;
+				int32_t end = i, pieces = 0;
+				for (auto piece = pieceAt(program, code, leaders, end); piece.has_value() && (end == i || !leaders[end]);
+					piece = pieceAt(program, code, leaders, end)) {
+					if (text.size() + piece->text.size() > MaxStringLength)
+						break;
+					text += piece->text;
+					end += piece->length;
+					pieces++;
+				}
+				if (pieces < 2) {
+					i = std::max(i, end - 1);
+					continue;
+				}
+				patch.Replace(i, {Instruction(Operation::LOADC, stringConstant(program, text)), Instruction(Operation::SPRINT)});
+				for (auto k = i + 1; k < end; k++)
+					patch.Remove(k);
+				i = end - 1;
+			}
+			patch.Apply();
+		}
+	}
+
+	void coalescePrints(Program& program) {
+		coalesce(program, program.start);
+		for (auto& [_, code] : program.functions)
+			coalesce(program, code);
+		compactConstants(program);
+	}
+}
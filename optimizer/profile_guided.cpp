@@ -0,0 +1,360 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <algorithm>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using uint64_t = std::uint64_t;
+
+		Operation inverted(Operation op) {
+			switch (op) {
+				case Operation::JE:
+					return Operation::JNE;
+				case Operation::JNE:
+					return Operation::JE;
+				case Operation::JL:
+					return Operation::JGE;
+				case Operation::JGE:
+					return Operation::JL;
+				case Operation::JG:
+					return Operation::JLE;
+				case Operation::JLE:
+					return Operation::JG;
+				default:
+					return op;
+			}
+		}
+
+		struct Block {
+			int32_t begin;
+			int32_t end;
+			// 跳转目标和顺序执行的后继，-1 表示没有
+			int32_t target = -1;
+			int32_t next = -1;
+			uint64_t taken = 0;
+			uint64_t fallthrough = 0;
+			bool hot = false;
+		};
+
+		// 按剖面重排基本块：从入口开始，每次接上最可能执行的后继，没有执行过的块放到最后
+		// 条件跳转更可能跳转时把条件取反，让常走的路径顺序执行
+		void layoutBlocks(std::vector<Instruction>& code, const Profile::Function& profile) {
+			for (auto& ins : code)
+				if (isJump(ins.GetOperation()) && (ins.GetX() < 0 || ins.GetX() >= (int32_t)code.size()))
+					return;
+			if (code.empty())
+				return;
+			auto leaders = findLeaders(code);
+			std::vector<Block> blocks;
+			std::vector<int32_t> blockOf(code.size() + 1, -1);
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				if (leaders[i])
+					blocks.push_back({i, i});
+				blocks.back().end = i + 1;
+				blockOf[i] = blocks.size() - 1;
+			}
+			for (auto& b : blocks) {
+				auto& last = code[b.end - 1];
+				auto op = last.GetOperation();
+				if (isJump(op))
+					b.target = blockOf[last.GetX()];
+				if (!isTerminator(op))
+					b.next = blockOf[b.end];
+				if (isConditionalJump(op)) {
+					auto itr = profile.branches.find(b.end - 1);
+					if (itr != profile.branches.end())
+						std::tie(b.taken, b.fallthrough) = itr->second;
+				}
+			}
+
+			// 只沿着执行过的边标记热块
+			std::vector<int32_t> work = {0};
+			blocks[0].hot = true;
+			while (!work.empty()) {
+				auto& b = blocks[work.back()];
+				work.pop_back();
+				const bool conditional = isConditionalJump(code[b.end - 1].GetOperation());
+				for (auto [succ, count] : {std::make_pair(b.target, b.taken), std::make_pair(b.next, b.fallthrough)}) {
+					if (succ < 0 || blocks[succ].hot || (conditional && count == 0))
+						continue;
+					blocks[succ].hot = true;
+					work.push_back(succ);
+				}
+			}
+
+			std::vector<int32_t> order;
+			std::vector<bool> placed(blocks.size(), false);
+			const auto likely = [&](int32_t b) {
+				auto& block = blocks[b];
+				std::vector<int32_t> candidates;
+				if (block.taken > block.fallthrough)
+					candidates = {block.target, block.next};
+				else
+					candidates = {block.next, block.target};
+				for (auto c : candidates)
+					if (c >= 0 && !placed[c] && blocks[c].hot)
+						return c;
+				return -1;
+			};
+			for (int32_t cur = 0; cur >= 0;) {
+				placed[cur] = true;
+				order.push_back(cur);
+				cur = likely(cur);
+				for (int32_t i = 0; cur < 0 && i < (int32_t)blocks.size(); i++)
+					if (!placed[i] && blocks[i].hot)
+						cur = i;
+			}
+			for (int32_t i = 0; i < (int32_t)blocks.size(); i++)
+				if (!placed[i])
+					order.push_back(i);
+
+			// 先生成指令，跳转目标暂时记为块号
+			std::vector<Instruction> result;
+			std::vector<bool> isTarget;
+			std::vector<int32_t> start(blocks.size());
+			for (std::size_t k = 0; k < order.size(); k++) {
+				auto& b = blocks[order[k]];
+				const int32_t following = k + 1 < order.size() ? order[k + 1] : -1;
+				start[order[k]] = result.size();
+				for (auto i = b.begin; i + 1 < b.end; i++) {
+					result.push_back(code[i]);
+					isTarget.push_back(false);
+				}
+				auto last = code[b.end - 1];
+				auto op = last.GetOperation();
+				if (op == Operation::JMP) {
+					if (b.target != following) {
+						result.emplace_back(Operation::JMP, b.target);
+						isTarget.push_back(true);
+					}
+					continue;
+				}
+				if (isConditionalJump(op) && b.target == following && b.next != following) {
+					result.emplace_back(inverted(op), b.next);
+					isTarget.push_back(true);
+					continue;
+				}
+				if (isJump(op)) {
+					result.emplace_back(op, b.target);
+					isTarget.push_back(true);
+				}
+				else {
+					result.push_back(last);
+					isTarget.push_back(false);
+				}
+				if (b.next >= 0 && b.next != following) {
+					result.emplace_back(Operation::JMP, b.next);
+					isTarget.push_back(true);
+				}
+			}
+			for (std::size_t i = 0; i < result.size(); i++)
+				if (isTarget[i])
+					result[i].set_X(start[result[i].GetX()]);
+			code = result;
+		}
+
+		// 内联只考虑短小的函数，总共最多让程序增长 InlineBudget 条指令
+		const int32_t MaxInlineSize = 64;
+		const int32_t InlineBudget = 512;
+
+		// 调用点标记：在 CALL 的 option 中暂存它在原始代码中的偏移
+		void tagCallSites(std::vector<Instruction>& code) {
+			for (int32_t i = 0; i < (int32_t)code.size(); i++)
+				if (code[i].GetOperation() == Operation::CALL)
+					code[i] = Instruction(Operation::CALL, code[i].GetX(), i);
+		}
+
+		void untagCallSites(std::vector<Instruction>& code) {
+			for (auto& ins : code)
+				if (ins.GetOperation() == Operation::CALL)
+					ins = Instruction(Operation::CALL, ins.GetX());
+		}
+
+		// 把 caller 中对 callee 的调用展开
+		// 被调函数的参数和局部变量都映射到调用者栈帧中新分配的slot
+		// 实参求值前先压入对应slot的地址，调用处依次存入，不在操作数栈上按地址访问实参
+		bool inlineCall(Program& program, int32_t caller, int32_t tag) {
+			auto& code = program.functions[caller];
+			const auto find = [&]() {
+				return (int32_t)(std::find_if(code.begin(), code.end(), [&](const Instruction& ins) {
+					return ins.GetOperation() == Operation::CALL && ins.GetOpt() == tag;
+				}) - code.begin());
+			};
+			auto pos = find();
+			if (pos == (int32_t)code.size())
+				return false;
+			const int32_t callee = code[pos].GetX();
+			auto sig = program.signatures.find(callee);
+			if (sig == program.signatures.end())
+				return false;
+			const auto types = sig->second.second;
+			auto body = program.functions[callee];
+			reserveFrame(program, callee, body);
+			if (body.empty() || !isTerminator(body.back().GetOperation()))
+				return false;
+			const int32_t params = paramSlots(program, callee);
+			const int32_t locals = body[0].GetOperation() == Operation::SNEW ? body[0].GetX() : 0;
+			const int32_t width = returnSlots(program, callee);
+			auto calleeDepths = stackDepths(program, body, params);
+			if (!calleeDepths.has_value())
+				return false;
+			for (int32_t i = 0; i < (int32_t)body.size(); i++) {
+				auto op = body[i].GetOperation();
+				if (isReturn(op) && (*calleeDepths)[i] >= 0 && (*calleeDepths)[i] != params + locals + (op == Operation::RET ? 0 : width))
+					return false;
+			}
+			if (locals > 0)
+				body.erase(body.begin());
+
+			// 向前找每个实参开始求值的位置，求值期间不能有别的路径汇入
+			// 第一个实参之前的栈上只能有栈帧，否则调用者未用完的操作数会压在展开的语句下面，
+			// 其他优化会把这一段当作没有副作用的表达式外提或删除
+			const auto argumentStarts = [&](int32_t frame) -> std::optional<std::vector<int32_t> > {
+				auto depths = stackDepths(program, code, paramSlots(program, caller));
+				if (!depths.has_value() || (*depths)[pos] < params)
+					return {};
+				std::vector<int32_t> starts(types.size());
+				int32_t depth = (*depths)[pos], i = pos;
+				for (int32_t k = (int32_t)types.size() - 1; k >= 0; k--) {
+					depth -= types[k] == TokenType::DOUBLE ? 2 : 1;
+					do
+						i--;
+					while (i >= 0 && (*depths)[i] != depth);
+					if (i < 0)
+						return {};
+					starts[k] = i;
+				}
+				if ((*depths)[i] != frame)
+					return {};
+				auto leaders = findLeaders(code);
+				for (auto j = i + 1; j <= pos; j++)
+					if (leaders[j])
+						return {};
+				return starts;
+			};
+			// 提前分配栈帧总是安全的，之后语句之间的栈深度就是栈帧的大小
+			const int32_t frame = reserveFrame(program, caller, code);
+			pos = find();
+			if (!argumentStarts(frame).has_value())
+				return false;
+			const int32_t slots = allocateFrameSlots(program, caller, code, params + locals);
+			pos = find();
+			auto starts = argumentStarts(slots + params + locals);
+			if (!starts.has_value())
+				return false;
+
+			CodePatch patch(code);
+			int32_t slot = slots;
+			std::vector<Instruction> stores;
+			for (std::size_t k = 0; k < types.size(); k++) {
+				patch.InsertBefore((*starts)[k], {Instruction(Operation::LOADA, 0, slot)});
+				slot += types[k] == TokenType::DOUBLE ? 2 : 1;
+				stores.emplace(stores.begin(), types[k] == TokenType::DOUBLE ? Operation::DSTORE : Operation::ISTORE);
+			}
+			stores.push_back(code[pos]);
+			patch.Replace(pos, stores);
+			patch.Apply();
+			pos = find();
+
+			// 被调函数中每条指令展开后的位置，用来计算跳转目标
+			// 返回指令变成跳到展开代码之后，最后一条返回直接顺序执行
+			const int32_t last = body.size() - 1;
+			std::vector<int32_t> offset(body.size() + 1, 0);
+			for (int32_t i = 0; i < (int32_t)body.size(); i++)
+				offset[i + 1] = offset[i] + (isReturn(body[i].GetOperation()) && i == last ? 0 : 1);
+			const int32_t length = offset[body.size()];
+
+			std::vector<Instruction> result(code.begin(), code.begin() + pos);
+			for (int32_t i = 0; i < (int32_t)body.size(); i++) {
+				auto& ins = body[i];
+				auto op = ins.GetOperation();
+				if (isReturn(op)) {
+					if (i != last)
+						result.emplace_back(Operation::JMP, pos + length);
+				}
+				else if (isJump(op))
+					result.emplace_back(op, pos + offset[ins.GetX() - (locals > 0 ? 1 : 0)]);
+				else if (op == Operation::LOADA && ins.GetX() == 0)
+					result.emplace_back(Operation::LOADA, 0, slots + ins.GetOpt());
+				else if (op == Operation::CALL)
+					result.emplace_back(Operation::CALL, ins.GetX());
+				else
+					result.push_back(ins);
+			}
+			result.insert(result.end(), code.begin() + pos + 1, code.end());
+			for (auto i = 0; i < (int32_t)result.size(); i++) {
+				if (i >= pos && i < pos + length)
+					continue;
+				if (isJump(result[i].GetOperation()) && result[i].GetX() > pos)
+					result[i].set_X(result[i].GetX() + length - 1);
+			}
+			code = result;
+			return true;
+		}
+
+		bool isRecursive(const Program& program, int32_t func) {
+			auto& code = program.functions.at(func);
+			return std::any_of(code.begin(), code.end(), [&](const Instruction& ins) {
+				return ins.GetOperation() == Operation::CALL && ins.GetX() == func;
+			});
+		}
+
+		// 按调用点的执行次数从高到低内联
+		void inlineHotCalls(Program& program, const Profile& profile) {
+			struct Site {
+				uint64_t count;
+				int32_t caller;
+				int32_t tag;
+			};
+			std::vector<Site> sites;
+			for (auto& [func, code] : program.functions) {
+				auto itr = profile.functions.find(func);
+				if (itr == profile.functions.end())
+					continue;
+				for (auto& ins : code) {
+					if (ins.GetOperation() != Operation::CALL || ins.GetOpt() < 0)
+						continue;
+					auto count = itr->second.sites.find(ins.GetOpt());
+					if (count != itr->second.sites.end() && count->second > 0)
+						sites.push_back({count->second, func, ins.GetOpt()});
+				}
+			}
+			std::stable_sort(sites.begin(), sites.end(), [](const Site& x, const Site& y) { return x.count > y.count; });
+
+			int32_t budget = InlineBudget;
+			for (auto& site : sites) {
+				auto& code = program.functions[site.caller];
+				auto call = std::find_if(code.begin(), code.end(), [&](const Instruction& ins) {
+					return ins.GetOperation() == Operation::CALL && ins.GetOpt() == site.tag;
+				});
+				if (call == code.end())
+					continue;
+				auto callee = call->GetX();
+				auto size = (int32_t)program.functions[callee].size();
+				if (callee == site.caller || isRecursive(program, callee) || size > MaxInlineSize || size > budget)
+					continue;
+				reserveFrame(program, site.caller, code);
+				if (inlineCall(program, site.caller, site.tag))
+					budget -= size;
+			}
+		}
+	}
+
+	void applyProfile(Program& program, const Profile& profile) {
+		for (auto& [func, code] : program.functions) {
+			auto itr = profile.functions.find(func);
+			// 剖面和程序对不上时忽略这个函数
+			if (itr == profile.functions.end() || itr->second.size != (int32_t)code.size())
+				continue;
+			tagCallSites(code);
+			if (itr->second.calls > 0)
+				layoutBlocks(code, itr->second);
+		}
+		inlineHotCalls(program, profile);
+		for (auto& [_, code] : program.functions)
+			untagCallSites(code);
+	}
+}
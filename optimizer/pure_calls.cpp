@@ -0,0 +1,150 @@
+#include "passes.h"
+#include "bytecode.h"
+#include "vm/vm.h"
+
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using uint64_t = std::uint64_t;
+
+		// 单次求值最多执行的跳转和调用次数，超过就保留原来的调用
+		const uint64_t StepBudget = 100000;
+
+		// 实参只能由常量和不访问内存的计算得到
+		bool isConstantOperation(const Program& program, const Instruction& ins) {
+			switch (ins.GetOperation()) {
+				case Operation::BIPUSH:
+				case Operation::IPUSH:
+				case Operation::DUP:
+				case Operation::DUP2:
+				case Operation::IADD:
+				case Operation::DADD:
+				case Operation::ISUB:
+				case Operation::DSUB:
+				case Operation::IMUL:
+				case Operation::DMUL:
+				case Operation::IDIV:
+				case Operation::DDIV:
+				case Operation::INEG:
+				case Operation::DNEG:
+				case Operation::I2D:
+				case Operation::D2I:
+				case Operation::I2C:
+					return true;
+				case Operation::LOADC: {
+					auto c = program.consts.find(ins.GetX());
+					return c != program.consts.end() && std::get<0>(c->second) != "S";
+				}
+				default:
+					return false;
+			}
+		}
+
+		class Evaluator final {
+		public:
+			Evaluator(Program& program)
+				: _program(program), _module(moduleOf(program)), _in(), _out(), _vm(_module, _in, _out), _callees() {
+				_scratch = _module.functions.size();
+				_module.functions.push_back({-1, 0, 0, {}});
+				_vm.SetStepLimit(StepBudget);
+				for (auto& [func, effects] : sideEffects(program))
+					if (effects.constant() && program.functions.count(func) && program.signatures.count(func))
+						_callees.insert(func);
+			}
+			Evaluator(const Evaluator&) = delete;
+			Evaluator& operator=(const Evaluator&) = delete;
+
+			void evaluate(std::vector<Instruction>& code, int32_t entry);
+		private:
+			// [begin, call] 为实参求值和调用，求值成功时返回代替它们的指令
+			std::optional<std::vector<Instruction> > evaluate(const std::vector<Instruction>& code, int32_t begin, int32_t call);
+			// 找到或添加一个 double 常量，返回它在常量表中的下标
+			int32_t doubleConstant(double value);
+
+		private:
+			Program& _program;
+			Module _module;
+			std::stringstream _in;
+			std::stringstream _out;
+			VirtualMachine _vm;
+			// 放置待求值代码的临时函数
+			int32_t _scratch;
+			std::set<int32_t> _callees;
+		};
+
+		int32_t Evaluator::doubleConstant(double value) {
+			const int32_t index = c0::doubleConstant(_program, value);
+			// 之后的求值可能用到新加的常量
+			if (index >= (int32_t)_module.consts.size()) {
+				_module.consts.resize(index + 1);
+				_module.consts[index] = value;
+			}
+			return index;
+		}
+
+		std::optional<std::vector<Instruction> > Evaluator::evaluate(const std::vector<Instruction>& code, int32_t begin, int32_t call) {
+			const int32_t callee = code[call].GetX();
+			const int32_t width = returnSlots(_program, callee);
+			std::vector<Instruction> scratch(code.begin() + begin, code.begin() + call + 1);
+			scratch.emplace_back(width == 0 ? Operation::RET : width == 1 ? Operation::IRET : Operation::DRET);
+			_module.functions[_scratch].code = scratch;
+			auto [result, err] = _vm.Call(_scratch, {});
+			if (err.has_value() || (int32_t)result.size() != width)
+				return {};
+			if (width == 0)
+				return std::vector<Instruction>();
+			if (width == 1)
+				return std::vector<Instruction>{Instruction(Operation::IPUSH, result[0])};
+			double d;
+			std::memcpy(&d, result.data(), sizeof d);
+			if (!std::isfinite(d))
+				return {};
+			return std::vector<Instruction>{Instruction(Operation::LOADC, doubleConstant(d))};
+		}
+
+		void Evaluator::evaluate(std::vector<Instruction>& code, int32_t entry) {
+			// 替换后外层调用的实参可能也成了常量，重复直到没有变化
+			for (bool changed = true; changed;) {
+				changed = false;
+				auto depths = stackDepths(_program, code, entry);
+				if (!depths.has_value())
+					return;
+				auto leaders = findLeaders(code);
+				CodePatch patch(code);
+				// 同一轮中替换的范围不能重叠
+				int32_t last = -1;
+				for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+					if (code[i].GetOperation() != Operation::CALL || !_callees.count(code[i].GetX()) || (*depths)[i] < 0)
+						continue;
+					const int32_t base = (*depths)[i] - paramSlots(_program, code[i].GetX());
+					int32_t begin = i;
+					while (begin > last + 1 && (*depths)[begin] != base && !leaders[begin] && isConstantOperation(_program, code[begin - 1]))
+						begin--;
+					if ((*depths)[begin] != base)
+						continue;
+					auto replacement = evaluate(code, begin, i);
+					if (!replacement.has_value())
+						continue;
+					for (auto k = begin; k < i; k++)
+						patch.Remove(k);
+					patch.Replace(i, replacement.value());
+					last = i;
+					changed = true;
+				}
+				patch.Apply();
+			}
+		}
+	}
+
+	void evaluatePureCalls(Program& program) {
+		Evaluator evaluator(program);
+		evaluator.evaluate(program.start, 0);
+		for (auto& [func, code] : program.functions)
+			evaluator.evaluate(code, paramSlots(program, func));
+	}
+}
@@ -0,0 +1,235 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <algorithm>
+#include <numeric>
+#include <queue>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		// 分析器让兄弟块中的变量共用slot，同一个slot先后可能放着 int 和 double
+		// 所以分配的单位不是slot，而是由写入和读取它的指令连成的网：能到达同一次读取的写入属于同一个网
+		struct Web {
+			int32_t slot = -1;
+			int32_t width = 0;
+			// 入口处就有值（参数或未初始化就读取）的网留在原位
+			bool fixed = false;
+			// 最早的访问位置，决定着色的顺序
+			int32_t first = INT32_MAX;
+			int32_t color = -1;
+		};
+
+		class UnionFind final {
+		public:
+			explicit UnionFind(int32_t n) : _parent(n) { std::iota(_parent.begin(), _parent.end(), 0); }
+
+			int32_t find(int32_t x) { return _parent[x] == x ? x : _parent[x] = find(_parent[x]); }
+			void unite(int32_t x, int32_t y) { _parent[find(x)] = find(y); }
+		private:
+			std::vector<int32_t> _parent;
+		};
+
+		bool overlaps(int32_t a, int32_t aw, int32_t b, int32_t bw) {
+			return a < b + bw && b < a + aw;
+		}
+
+		// 每个slot当前可能来自哪些写入，写入用指令位置表示，入口处的值为 -1
+		using Reaching = std::vector<std::set<int32_t> >;
+
+		void transfer(const FrameAccesses& frame, int32_t pos, Reaching& reaching) {
+			auto& access = frame.accesses[pos];
+			if (!access.has_value() || !access->store)
+				return;
+			for (auto k = access->slot; k < access->slot + access->width; k++)
+				reaching[k] = {pos};
+		}
+
+		// 每条指令执行前能到达的写入，不可达的指令为空
+		std::vector<std::optional<Reaching> > reachingStores(const std::vector<Instruction>& code, const FrameAccesses& frame) {
+			std::vector<std::optional<Reaching> > in(code.size());
+			in[0] = Reaching(frame.size, {-1});
+			std::queue<int32_t> work;
+			work.push(0);
+			while (!work.empty()) {
+				auto pos = work.front();
+				work.pop();
+				auto out = in[pos].value();
+				transfer(frame, pos, out);
+				for (auto succ : successorsOf(code, pos)) {
+					if (!in[succ].has_value()) {
+						in[succ] = out;
+						work.push(succ);
+						continue;
+					}
+					bool changed = false;
+					for (int32_t k = 0; k < frame.size; k++) {
+						auto before = (*in[succ])[k].size();
+						(*in[succ])[k].insert(out[k].begin(), out[k].end());
+						changed = changed || (*in[succ])[k].size() != before;
+					}
+					if (changed)
+						work.push(succ);
+				}
+			}
+			return in;
+		}
+
+		// 重新分配一个函数的局部变量，返回原来和现在的栈帧大小（含参数），无法分配或没有改进时返回空
+		std::optional<std::pair<int32_t, int32_t> > allocate(const Program& program, int32_t func, std::vector<Instruction>& code) {
+			const int32_t params = paramSlots(program, func);
+			const int32_t frameSize = reserveFrame(program, func, code);
+			if (frameSize == params || code.empty())
+				return {};
+			auto frame = frameAccesses(program, code);
+			if (!frame.escaped.empty() || frame.size > frameSize)
+				return {};
+			const int32_t n = code.size();
+			for (auto& access : frame.accesses)
+				if (access.has_value() && access->slot < 0)
+					return {};
+
+			// 节点：每条访问指令，以及代表各slot入口处值的 n + k 号节点
+			auto in = reachingStores(code, frame);
+			UnionFind sets(n + frame.size);
+			for (int32_t i = 0; i < n; i++) {
+				auto& access = frame.accesses[i];
+				if (!access.has_value() || !access->load || !in[i].has_value())
+					continue;
+				for (auto k = access->slot; k < access->slot + access->width; k++) {
+					for (auto def : (*in[i])[k]) {
+						if (def < 0) {
+							sets.unite(i, n + k);
+							continue;
+						}
+						// 读取的必须正好是一次写入的值
+						auto& store = frame.accesses[def];
+						if (store->slot != access->slot || store->width != access->width)
+							return {};
+						sets.unite(i, def);
+					}
+				}
+			}
+			// 经 DUP 共用同一个地址的访问只能一起改写
+			std::map<int32_t, int32_t> origins;
+			for (int32_t i = 0; i < n; i++) {
+				auto& access = frame.accesses[i];
+				if (!access.has_value() || access->origin < 0)
+					continue;
+				auto [itr, inserted] = origins.emplace(access->origin, i);
+				if (!inserted)
+					sets.unite(i, itr->second);
+			}
+
+			std::map<int32_t, Web> webs;
+			for (int32_t i = 0; i < n; i++) {
+				auto& access = frame.accesses[i];
+				if (!access.has_value())
+					continue;
+				auto& web = webs[sets.find(i)];
+				if (web.width != 0 && (web.slot != access->slot || web.width != access->width))
+					return {};
+				web.slot = access->slot;
+				web.width = access->width;
+				web.first = std::min(web.first, i);
+			}
+			std::set<int32_t> entries;
+			for (int32_t k = 0; k < frame.size; k++)
+				entries.insert(sets.find(n + k));
+			for (auto& [root, web] : webs) {
+				web.fixed = entries.count(root) || web.slot < params;
+				if (web.fixed)
+					web.color = web.slot;
+			}
+
+			// 写入某个网时，它和此后仍然活跃的其他网互相冲突
+			// slot k 在写入之后活跃，且 k 中的值来自网 B 的写入，B 就是活跃的
+			auto live = liveSlots(code, frame);
+			std::map<int32_t, std::set<int32_t> > interferes;
+			for (int32_t i = 0; i < n; i++) {
+				auto& access = frame.accesses[i];
+				if (!access.has_value() || !access->store || !in[i].has_value())
+					continue;
+				auto out = in[i].value();
+				transfer(frame, i, out);
+				const auto self = sets.find(i);
+				for (int32_t k = 0; k < frame.size; k++) {
+					if (!live[i][k])
+						continue;
+					for (auto def : out[k]) {
+						auto other = sets.find(def < 0 ? n + k : def);
+						if (other != self && webs.count(other)) {
+							interferes[self].insert(other);
+							interferes[other].insert(self);
+						}
+					}
+				}
+			}
+
+			// double 先放，并放在偶数偏移上，int 再去填空隙
+			std::vector<int32_t> order;
+			int32_t size = params;
+			for (auto& [root, web] : webs) {
+				if (web.fixed)
+					size = std::max(size, web.slot + web.width);
+				else
+					order.push_back(root);
+			}
+			std::stable_sort(order.begin(), order.end(), [&](int32_t x, int32_t y) {
+				if (webs[x].width != webs[y].width)
+					return webs[x].width > webs[y].width;
+				return webs[x].first < webs[y].first;
+			});
+			for (auto root : order) {
+				auto& web = webs[root];
+				for (int32_t color = params; web.color < 0; color++) {
+					if (web.width == 2 && color % 2 != 0)
+						continue;
+					bool free = true;
+					for (auto other : interferes[root])
+						if (webs[other].color >= 0 && overlaps(color, web.width, webs[other].color, webs[other].width))
+							free = false;
+					if (free)
+						web.color = color;
+				}
+				size = std::max(size, web.color + web.width);
+			}
+			if (size >= frameSize)
+				return {};
+
+			for (int32_t i = 0; i < n; i++) {
+				auto& access = frame.accesses[i];
+				if (!access.has_value())
+					continue;
+				auto color = webs[sets.find(i)].color;
+				auto op = code[i].GetOperation();
+				if (access->origin >= 0)
+					code[access->origin] = Instruction(Operation::LOADA, 0, color);
+				else if (op == Operation::IINC)
+					code[i] = Instruction(op, color, code[i].GetOpt());
+				else
+					code[i] = Instruction(op, color);
+			}
+			if (size > params)
+				code[0].set_X(size - params);
+			else {
+				CodePatch patch(code);
+				patch.Remove(0);
+				patch.Apply();
+			}
+			return std::make_pair(frameSize, size);
+		}
+	}
+
+	std::map<std::int32_t, std::pair<std::int32_t, std::int32_t> > allocateSlots(Program& program) {
+		std::map<int32_t, std::pair<int32_t, int32_t> > reductions;
+		for (auto& [func, code] : program.functions) {
+			auto sizes = allocate(program, func, code);
+			if (sizes.has_value())
+				reductions[func] = sizes.value();
+		}
+		return reductions;
+	}
+}
@@ -0,0 +1,198 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <algorithm>
+#include <set>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using int64_t = std::int64_t;
+
+		bool isPush(const Instruction& ins) {
+			return ins.GetOperation() == Operation::IPUSH || ins.GetOperation() == Operation::BIPUSH;
+		}
+
+		bool isLocal(const Instruction& ins, int32_t offset) {
+			return ins.GetOperation() == Operation::LOADA && ins.GetX() == 0 && ins.GetOpt() == offset;
+		}
+
+		int32_t wrap(int64_t x) {
+			return (int32_t)(uint32_t)(uint64_t)x;
+		}
+
+		// i = i + k 形式的基本归纳变量上的 i * c
+		struct Induction {
+			Loop loop;
+			int32_t variable;
+			int32_t factor;
+			// 对 i 的唯一一次写入
+			int32_t store;
+			int32_t step;
+			std::vector<int32_t> uses;
+		};
+
+		// 更新临时变量要多执行 6 条指令，每处 i * c 换成读取少执行 2 条
+		// 内层循环中的使用估计执行更多次，按层数加权
+		const int32_t UpdateCost = 6;
+		const int32_t UseSaving = 2;
+		const int32_t InnerLoopWeight = 4;
+
+		std::vector<Induction> findInductions(const Program& program, const std::vector<Instruction>& code) {
+			std::vector<Induction> result;
+			auto leaders = findLeaders(code);
+			auto loops = findLoops(code);
+			std::set<int32_t> claimed;
+			for (auto& loop : loops) {
+				// 局部变量 -> 循环中对它的写入
+				std::map<int32_t, std::vector<int32_t> > stores;
+				bool unknown = false;
+				for (auto i = loop.header; i <= loop.latch && !unknown; i++) {
+					auto op = code[i].GetOperation();
+					if (op != Operation::ISTORE && op != Operation::DSTORE)
+						continue;
+					auto width = op == Operation::DSTORE ? 2 : 1;
+					auto address = producerOf(program, code, i, width);
+					if (!address.has_value() || code[*address].GetOperation() != Operation::LOADA) {
+						unknown = true;
+						break;
+					}
+					if (code[*address].GetX() != 0)
+						continue;
+					for (int32_t k = 0; k < width; k++)
+						stores[code[*address].GetOpt() + k].emplace_back(i);
+				}
+				if (unknown)
+					continue;
+
+				for (auto& [variable, positions] : stores) {
+					if (positions.size() != 1)
+						continue;
+					// LOADA v; LOADA v; ILOAD; IPUSH k; IADD/ISUB; ISTORE
+					auto s = positions[0];
+					if (s - 5 < loop.header || code[s].GetOperation() != Operation::ISTORE)
+						continue;
+					auto op = code[s - 1].GetOperation();
+					if (!isLocal(code[s - 5], variable) || !isLocal(code[s - 4], variable)
+						|| code[s - 3].GetOperation() != Operation::ILOAD || !isPush(code[s - 2])
+						|| (op != Operation::IADD && op != Operation::ISUB))
+						continue;
+					if (std::any_of(leaders.begin() + s - 4, leaders.begin() + s + 1, [](bool b) { return b; }))
+						continue;
+					auto step = op == Operation::IADD ? code[s - 2].GetX() : wrap(-(int64_t)code[s - 2].GetX());
+
+					// 因子 -> 使用处
+					std::map<int32_t, std::vector<int32_t> > uses;
+					for (auto u = loop.header; u + 3 <= loop.latch; u++) {
+						if (claimed.count(u) || code[u + 3].GetOperation() != Operation::IMUL
+							|| leaders[u + 1] || leaders[u + 2] || leaders[u + 3])
+							continue;
+						// LOADA v; ILOAD; IPUSH c; IMUL 或 IPUSH c; LOADA v; ILOAD; IMUL
+						if (isLocal(code[u], variable) && code[u + 1].GetOperation() == Operation::ILOAD && isPush(code[u + 2]))
+							uses[code[u + 2].GetX()].emplace_back(u);
+						else if (isPush(code[u]) && isLocal(code[u + 1], variable) && code[u + 2].GetOperation() == Operation::ILOAD)
+							uses[code[u].GetX()].emplace_back(u);
+					}
+
+					for (auto& [factor, positions] : uses) {
+						if (factor == 0 || factor == 1 || factor == -1)
+							continue;
+						int32_t benefit = -UpdateCost;
+						for (auto u : positions) {
+							int32_t depth = 0;
+							for (auto& inner : loops)
+								if (inner.header >= loop.header && inner.latch <= loop.latch
+									&& (inner.header != loop.header || inner.latch != loop.latch) && inner.contains(u))
+									depth++;
+							benefit += UseSaving * (1 + InnerLoopWeight * depth);
+						}
+						if (benefit <= 0)
+							continue;
+						claimed.insert(positions.begin(), positions.end());
+						result.push_back({loop, variable, factor, s, step, positions});
+					}
+				}
+			}
+			return result;
+		}
+
+		// 循环中的 i * c 换成和 i 同步更新的临时变量 t
+		// 进入循环前 t = i * c，每次 i = i + k 之后 t = t + c * k
+		void reduceInductions(const Program& program, int32_t func, std::vector<Instruction>& code) {
+			auto inductions = findInductions(program, code);
+			if (inductions.empty())
+				return;
+			auto base = allocateFrameSlots(program, func, code, inductions.size());
+			// 分配栈帧可能移动了指令的位置
+			inductions = findInductions(program, code);
+
+			CodePatch patch(code);
+			for (std::size_t i = 0; i < inductions.size(); i++) {
+				auto& ind = inductions[i];
+				const int32_t slot = base + i;
+				patch.InsertBefore(ind.loop.header, {
+					Instruction(Operation::LOADA, 0, slot),
+					Instruction(Operation::LOADA, 0, ind.variable),
+					Instruction(Operation::ILOAD),
+					Instruction(Operation::IPUSH, ind.factor),
+					Instruction(Operation::IMUL),
+					Instruction(Operation::ISTORE),
+				}, false);
+				patch.InsertBefore(ind.store + 1, {
+					Instruction(Operation::LOADA, 0, slot),
+					Instruction(Operation::LOADA, 0, slot),
+					Instruction(Operation::ILOAD),
+					Instruction(Operation::IPUSH, wrap((int64_t)ind.factor * ind.step)),
+					Instruction(Operation::IADD),
+					Instruction(Operation::ISTORE),
+				}, false);
+				for (auto u : ind.uses) {
+					patch.Replace(u, {Instruction(Operation::LOADA, 0, slot), Instruction(Operation::ILOAD)});
+					for (int32_t k = 1; k <= 3; k++)
+						patch.Remove(u + k);
+				}
+			}
+			patch.Apply();
+		}
+
+		// 乘除常数的窥孔改写，VM 没有移位指令，只处理能换成更便宜指令的几种
+		// x * 1, x / 1 -> x
+		// x * -1, x / -1 -> -x
+		// x * 2 -> x + x
+		void simplifyConstantFactors(std::vector<Instruction>& code) {
+			auto leaders = findLeaders(code);
+			CodePatch patch(code);
+			for (int32_t i = 0; i + 1 < (int32_t)code.size(); i++) {
+				auto op = code[i + 1].GetOperation();
+				if (!isPush(code[i]) || leaders[i + 1] || (op != Operation::IMUL && op != Operation::IDIV))
+					continue;
+				auto c = code[i].GetX();
+				if (c == 1) {
+					patch.Remove(i);
+					patch.Remove(i + 1);
+				}
+				else if (c == -1) {
+					patch.Replace(i, {Instruction(Operation::INEG)});
+					patch.Remove(i + 1);
+				}
+				else if (c == 2 && op == Operation::IMUL) {
+					patch.Replace(i, {Instruction(Operation::DUP)});
+					patch.Replace(i + 1, {Instruction(Operation::IADD)});
+				}
+				else
+					continue;
+				i++;
+			}
+			patch.Apply();
+		}
+	}
+
+	void reduceStrength(Program& program) {
+		for (auto& [func, code] : program.functions) {
+			reduceInductions(program, func, code);
+			simplifyConstantFactors(code);
+		}
+		simplifyConstantFactors(program.start);
+	}
+}
@@ -0,0 +1,123 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <set>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		bool isVariable(const Instruction& ins) {
+			return ins.GetOperation() == Operation::LOADA && (ins.GetX() == 0 || ins.GetX() == 1);
+		}
+
+		Operation loadOf(const Instruction& address, Operation op) {
+			const bool local = address.GetX() == 0;
+			if (op == Operation::ILOAD)
+				return local ? Operation::ILOADL : Operation::ILOADG;
+			return local ? Operation::DLOADL : Operation::DLOADG;
+		}
+
+		Operation storeOf(const Instruction& address, Operation op) {
+			const bool local = address.GetX() == 0;
+			if (op == Operation::ISTORE)
+				return local ? Operation::ISTOREL : Operation::ISTOREG;
+			return local ? Operation::DSTOREL : Operation::DSTOREG;
+		}
+
+		std::optional<Operation> fusedCompare(Operation op) {
+			switch (op) {
+				case Operation::JE:
+					return Operation::ICMPJE;
+				case Operation::JNE:
+					return Operation::ICMPJNE;
+				case Operation::JL:
+					return Operation::ICMPJL;
+				case Operation::JGE:
+					return Operation::ICMPJGE;
+				case Operation::JG:
+					return Operation::ICMPJG;
+				case Operation::JLE:
+					return Operation::ICMPJLE;
+				default:
+					return {};
+			}
+		}
+
+		void fuse(const Program& program, std::vector<Instruction>& code) {
+			auto leaders = findLeaders(code);
+			const auto straight = [&](int32_t from, int32_t to) {
+				for (auto i = from; i <= to; i++)
+					if (i >= (int32_t)code.size() || leaders[i])
+						return false;
+				return true;
+			};
+			CodePatch patch(code);
+			std::set<int32_t> used;
+
+			// LOADA 0,x; LOADA 0,x; ILOAD; IPUSH c; IADD/ISUB; ISTORE -> IINC x, c
+			for (int32_t i = 0; i + 5 < (int32_t)code.size(); i++) {
+				auto& a = code[i];
+				auto op = code[i + 4].GetOperation();
+				if (a.GetOperation() != Operation::LOADA || a.GetX() != 0 || !(code[i + 1] == a)
+					|| code[i + 2].GetOperation() != Operation::ILOAD
+					|| (code[i + 3].GetOperation() != Operation::IPUSH && code[i + 3].GetOperation() != Operation::BIPUSH)
+					|| (op != Operation::IADD && op != Operation::ISUB)
+					|| code[i + 5].GetOperation() != Operation::ISTORE || !straight(i + 1, i + 5))
+					continue;
+				auto c = code[i + 3].GetX();
+				if (op == Operation::ISUB) {
+					if (c == INT32_MIN)
+						continue;
+					c = -c;
+				}
+				patch.Replace(i, {Instruction(Operation::IINC, a.GetOpt(), c)});
+				for (int32_t k = 1; k <= 5; k++)
+					patch.Remove(i + k);
+				for (int32_t k = 0; k <= 5; k++)
+					used.insert(i + k);
+				i += 5;
+			}
+
+			// LOADA l,x; <值>; ISTORE -> <值>; ISTOREL/ISTOREG x
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				auto op = code[i].GetOperation();
+				if ((op != Operation::ISTORE && op != Operation::DSTORE) || used.count(i))
+					continue;
+				auto address = producerOf(program, code, i, op == Operation::DSTORE ? 2 : 1);
+				if (!address.has_value() || used.count(*address) || !isVariable(code[*address]))
+					continue;
+				patch.Remove(*address);
+				patch.Replace(i, {Instruction(storeOf(code[*address], op), code[*address].GetOpt())});
+				used.insert(*address);
+				used.insert(i);
+			}
+
+			for (int32_t i = 0; i + 1 < (int32_t)code.size(); i++) {
+				if (used.count(i) || used.count(i + 1) || !straight(i + 1, i + 1))
+					continue;
+				auto op = code[i + 1].GetOperation();
+				// LOADA l,x; ILOAD -> ILOADL/ILOADG x
+				if (isVariable(code[i]) && (op == Operation::ILOAD || op == Operation::DLOAD)) {
+					patch.Replace(i, {Instruction(loadOf(code[i], op), code[i].GetOpt())});
+					patch.Remove(i + 1);
+					i++;
+				}
+				// ICMP; Jcc -> ICMPJcc
+				else if (code[i].GetOperation() == Operation::ICMP && fusedCompare(op).has_value()) {
+					patch.Replace(i, {Instruction(fusedCompare(op).value(), code[i + 1].GetX())});
+					patch.Remove(i + 1);
+					i++;
+				}
+			}
+			patch.Apply();
+		}
+	}
+
+	void fuseInstructions(Program& program) {
+		fuse(program, program.start);
+		for (auto& [_, code] : program.functions)
+			fuse(program, code);
+	}
+}
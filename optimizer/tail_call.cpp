@@ -0,0 +1,290 @@
+#include "passes.h"
+#include "bytecode.h"
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		// 自递归调用点
+		// acc 为 NOP 时是纯尾调用：CALL f 之后直接返回
+		// 否则是 return E op f(...) 或 return f(...) op E，其中 op 只能是 IADD 或 IMUL
+		struct TailSite {
+			int32_t call;
+			Operation acc;
+			// E 在参数之前求值（E op f(...)）
+			bool before;
+			// E 在调用之后求值时，E 占据 [call + 1, op)
+			int32_t op;
+		};
+
+		// 跳过 NOP 和无条件跳转，找到接下来真正执行的指令
+		int32_t follow(const std::vector<Instruction>& code, int32_t pos) {
+			for (std::size_t steps = 0; steps <= code.size(); steps++) {
+				if (pos < 0 || pos >= (int32_t)code.size())
+					return -1;
+				auto op = code[pos].GetOperation();
+				if (op == Operation::NOP)
+					pos++;
+				else if (op == Operation::JMP)
+					pos = code[pos].GetX();
+				else
+					return pos;
+			}
+			return -1;
+		}
+
+		// 调用之后求值的 E 只能是只读局部变量、没有副作用的整数运算
+		// 这样才能把它挪到参数之前求值
+		bool isOperandOperation(Operation op) {
+			switch (op) {
+				case Operation::LOADA:
+				case Operation::BIPUSH:
+				case Operation::IPUSH:
+				case Operation::ILOAD:
+				case Operation::INEG:
+				case Operation::IADD:
+				case Operation::ISUB:
+				case Operation::IMUL:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		bool isMovableOperand(const std::vector<Instruction>& code, int32_t begin, int32_t end) {
+			int32_t depth = 0;
+			for (int32_t i = begin; i < end; i++) {
+				auto& ins = code[i];
+				switch (ins.GetOperation()) {
+					case Operation::LOADA:
+						if (ins.GetX() != 0)
+							return false;
+						depth++;
+						break;
+					case Operation::BIPUSH:
+					case Operation::IPUSH:
+						depth++;
+						break;
+					case Operation::ILOAD:
+					case Operation::INEG:
+						if (depth < 1)
+							return false;
+						break;
+					case Operation::IADD:
+					case Operation::ISUB:
+					case Operation::IMUL:
+						if (depth < 2)
+							return false;
+						depth--;
+						break;
+					default:
+						return false;
+				}
+			}
+			return depth == 1;
+		}
+
+		void eliminateInFunction(Program& program, int32_t func, std::vector<Instruction>& code) {
+			auto sig = program.signatures.find(func);
+			if (sig == program.signatures.end() || code.empty())
+				return;
+			const auto retType = sig->second.first;
+			const auto& params = sig->second.second;
+			const int32_t paramCount = params.size();
+			const int32_t P = paramSlots(program, func);
+
+			std::vector<TailSite> sites;
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				if (code[i].GetOperation() != Operation::CALL || code[i].GetX() != func)
+					continue;
+				auto next = follow(code, i + 1);
+				if (next < 0)
+					continue;
+				auto op = code[next].GetOperation();
+				if (isReturn(op)) {
+					sites.push_back({i, Operation::NOP, false, -1});
+					continue;
+				}
+				if (retType != TokenType::INT)
+					continue;
+				if ((op == Operation::IADD || op == Operation::IMUL) && next == i + 1) {
+					auto ret = follow(code, i + 2);
+					if (ret >= 0 && code[ret].GetOperation() == Operation::IRET)
+						sites.push_back({i, op, true, i + 1});
+					continue;
+				}
+				// 找 f(...) op E 中 op 的位置，E 本身也可能含有加法和乘法
+				for (int32_t m = i + 2; m < (int32_t)code.size() && isOperandOperation(code[m].GetOperation()); m++) {
+					auto mop = code[m].GetOperation();
+					if ((mop != Operation::IADD && mop != Operation::IMUL) || !isMovableOperand(code, i + 1, m))
+						continue;
+					auto ret = follow(code, m + 1);
+					if (ret >= 0 && code[ret].GetOperation() == Operation::IRET)
+						sites.push_back({i, mop, false, m});
+					break;
+				}
+			}
+			if (sites.empty())
+				return;
+
+			// 一个函数只用一个累加器，所有累加调用点必须是同一种运算
+			Operation accOp = Operation::NOP;
+			for (auto& site : sites) {
+				if (site.acc == Operation::NOP)
+					continue;
+				if (accOp == Operation::NOP)
+					accOp = site.acc;
+				else if (accOp != site.acc) {
+					accOp = Operation::ILL;
+					break;
+				}
+			}
+			if (accOp == Operation::ILL) {
+				std::vector<TailSite> pure;
+				for (auto& site : sites)
+					if (site.acc == Operation::NOP)
+						pure.emplace_back(site);
+				sites = pure;
+				accOp = Operation::NOP;
+			}
+			if (sites.empty())
+				return;
+			const bool useAcc = accOp != Operation::NOP;
+
+			// 改写后的函数在入口一次性分配整个栈帧，原先散落在函数体中的 SNEW 全部去掉
+			// 否则每次跳回入口都会重新分配局部变量，栈仍然线性增长
+			int32_t locals = 0;
+			for (auto& ins : code)
+				if (ins.GetOperation() == Operation::SNEW)
+					locals += ins.GetX();
+			// 累加器放在所有局部变量之后
+			const int32_t accSlot = P + locals;
+			const int32_t frame = accSlot + (useAcc ? 1 : 0);
+
+			auto withoutSnew = code;
+			for (auto& ins : withoutSnew)
+				if (ins.GetOperation() == Operation::SNEW)
+					ins = Instruction(Operation::NOP);
+			auto depths = stackDepths(program, withoutSnew, frame);
+			if (!depths.has_value())
+				return;
+			auto leaders = findLeaders(code);
+
+			// 各参数在栈帧中的偏移
+			std::vector<int32_t> offsets;
+			int32_t offset = 0;
+			for (auto type : params) {
+				offsets.emplace_back(offset);
+				offset += type == TokenType::DOUBLE ? 2 : 1;
+			}
+
+			CodePatch patch(code);
+			bool changed = false;
+			for (auto& site : sites) {
+				auto callDepth = (*depths)[site.call];
+				if (callDepth < 0)
+					continue;
+				const int32_t base = callDepth - P;
+
+				// 向前找每个实参（以及参数之前的 E）开始求值的位置
+				std::vector<int32_t> starts(paramCount, -1);
+				int32_t pos = site.call;
+				bool ok = true;
+				for (int32_t k = paramCount - 1; k >= 0 && ok; k--) {
+					do
+						pos--;
+					while (pos >= 0 && (*depths)[pos] != base + offsets[k]);
+					ok = pos >= 0;
+					starts[k] = pos;
+				}
+				int32_t operandStart = -1;
+				if (ok && site.acc != Operation::NOP && site.before) {
+					do
+						pos--;
+					while (pos >= 0 && (*depths)[pos] != base - 1);
+					ok = pos >= 0;
+					operandStart = pos;
+				}
+				if (!ok)
+					continue;
+				// 参数求值期间不能有别的路径汇入
+				for (int32_t i = pos + 1; i <= site.call && ok; i++)
+					ok = !leaders[i];
+				for (int32_t i = site.call + 1; !site.before && site.acc != Operation::NOP && i <= site.op && ok; i++)
+					ok = !leaders[i];
+				if (!ok)
+					continue;
+
+				const int32_t argsStart = paramCount > 0 ? starts[0] : site.call;
+				const int32_t pending = base - frame - (site.before && site.acc != Operation::NOP ? 1 : 0);
+				if (pending < 0)
+					continue;
+
+				const std::vector<Instruction> update = {
+					Instruction(Operation::LOADA, 0, accSlot),
+					Instruction(Operation::ILOAD),
+					Instruction(site.acc),
+					Instruction(Operation::ISTORE),
+				};
+				if (site.acc != Operation::NOP && site.before) {
+					// acc = E op acc，E 在原来的位置求值
+					patch.InsertBefore(operandStart, {Instruction(Operation::LOADA, 0, accSlot)});
+					patch.InsertBefore(argsStart, update);
+				}
+				else if (site.acc != Operation::NOP) {
+					// 把 E 挪到参数之前：acc = E op acc
+					std::vector<Instruction> moved = {Instruction(Operation::LOADA, 0, accSlot)};
+					for (int32_t i = site.call + 1; i < site.op; i++)
+						moved.emplace_back(code[i]);
+					moved.insert(moved.end(), update.begin(), update.end());
+					patch.InsertBefore(argsStart, moved);
+					for (int32_t i = site.call + 1; i <= site.op; i++)
+						patch.Remove(i);
+				}
+
+				for (int32_t k = 0; k < paramCount; k++)
+					patch.InsertBefore(starts[k], {Instruction(Operation::LOADA, 0, offsets[k])});
+
+				std::vector<Instruction> jump;
+				for (int32_t k = paramCount - 1; k >= 0; k--)
+					jump.emplace_back(params[k] == TokenType::DOUBLE ? Operation::DSTORE : Operation::ISTORE);
+				if (pending > 0)
+					jump.emplace_back(Operation::POPN, pending);
+				jump.emplace_back(Operation::JMP, 0);
+				patch.Replace(site.call, jump);
+				changed = true;
+			}
+			if (!changed)
+				return;
+
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				auto op = code[i].GetOperation();
+				if (op == Operation::SNEW)
+					patch.Remove(i);
+				else if (useAcc && op == Operation::IRET)
+					patch.InsertBefore(i, {
+						Instruction(Operation::LOADA, 0, accSlot),
+						Instruction(Operation::ILOAD),
+						Instruction(accOp),
+					});
+			}
+
+			std::vector<Instruction> prologue;
+			if (frame > P)
+				prologue.emplace_back(Operation::SNEW, frame - P);
+			if (useAcc) {
+				prologue.emplace_back(Operation::LOADA, 0, accSlot);
+				prologue.emplace_back(Operation::BIPUSH, accOp == Operation::IMUL ? 1 : 0);
+				prologue.emplace_back(Operation::ISTORE);
+			}
+			patch.InsertBefore(0, prologue, false);
+			patch.Apply();
+		}
+	}
+
+	void eliminateTailCalls(Program& program) {
+		for (auto& it : program.functions)
+			eliminateInFunction(program, it.first, it.second);
+	}
+}
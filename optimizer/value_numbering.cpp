@@ -0,0 +1,365 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <algorithm>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using int64_t = std::int64_t;
+
+		enum ValueKind {
+			CONSTANT,
+			CONSTANT_POOL,
+			ADDRESS,
+			LOAD,
+			COMPUTE,
+		};
+
+		// 栈上一个slot的符号值
+		// start 是算出这个值的指令序列的起点，pure 表示这段指令没有副作用
+		struct Value {
+			int32_t vn;
+			int32_t start;
+			bool pure;
+		};
+
+		// 基本块中一次纯计算：[start, end] 算出编号为 vn 的值
+		// onTop 表示开始计算之前，同一个值已经在栈顶
+		struct Occurrence {
+			int32_t vn;
+			int32_t start;
+			int32_t end;
+			int32_t width;
+			bool onTop;
+		};
+
+		class ValueNumbering final {
+		public:
+			explicit ValueNumbering(const Program& program) : _program(program) {}
+
+			std::vector<Occurrence> Run(const std::vector<Instruction>&, int32_t begin, int32_t end);
+		private:
+			int32_t number(const std::vector<int64_t>& key) {
+				auto itr = _table.find(key);
+				if (itr != _table.end())
+					return itr->second;
+				return _table[key] = _next++;
+			}
+			int32_t fresh() { return _next++; }
+
+			Value pop() {
+				if (_stack.empty())
+					return {fresh(), -1, false};
+				auto v = _stack.back();
+				_stack.pop_back();
+				return v;
+			}
+			Value pop(int32_t width) {
+				auto v = pop();
+				for (int32_t i = 1; i < width; i++)
+					pop();
+				return v;
+			}
+			void push(const Value& v, int32_t width) {
+				for (int32_t i = 0; i < width; i++)
+					_stack.emplace_back(v);
+			}
+			void produce(int32_t vn, int32_t width, int32_t start, bool pure, int32_t end);
+			void clobber(const Value& address);
+
+		private:
+			const Program& _program;
+			std::map<std::vector<int64_t>, int32_t> _table;
+			int32_t _next = 0;
+			// 地址值编号 -> (层次差, 偏移)
+			std::map<int32_t, std::pair<int32_t, int32_t> > _addresses;
+			// 每个变量被写入的次数
+			std::map<std::pair<int32_t, int32_t>, int32_t> _versions;
+			// 调用会修改全局变量，写入未知地址会修改所有变量
+			int32_t _calls = 0;
+			int32_t _stores = 0;
+			// 最近一条有副作用的指令，跨过它的指令序列不能当作一个纯的值
+			int32_t _impure = -1;
+
+			std::vector<Value> _stack;
+			std::vector<Occurrence> _occurrences;
+		};
+
+		void ValueNumbering::produce(int32_t vn, int32_t width, int32_t start, bool pure, int32_t end) {
+			pure = pure && start > _impure;
+			if (pure && start >= 0) {
+				bool onTop = (int32_t)_stack.size() >= width;
+				for (int32_t i = 1; i <= width && onTop; i++)
+					onTop = _stack[_stack.size() - i].vn == vn;
+				_occurrences.push_back({vn, start, end, width, onTop});
+			}
+			push({vn, start, pure && start >= 0}, width);
+		}
+
+		void ValueNumbering::clobber(const Value& address) {
+			auto itr = _addresses.find(address.vn);
+			if (itr == _addresses.end()) {
+				_stores++;
+				return;
+			}
+			// double 占两个slot，和它重叠的变量都要失效
+			auto [level, offset] = itr->second;
+			for (int32_t i = offset - 1; i <= offset + 1; i++)
+				_versions[{level, i}]++;
+		}
+
+		std::vector<Occurrence> ValueNumbering::Run(const std::vector<Instruction>& code, int32_t begin, int32_t end) {
+			_stack.clear();
+			_occurrences.clear();
+			_impure = begin - 1;
+			for (int32_t i = begin; i < end; i++) {
+				auto& ins = code[i];
+				auto op = ins.GetOperation();
+				switch (op) {
+					case Operation::BIPUSH:
+					case Operation::IPUSH:
+						produce(number({CONSTANT, ins.GetX()}), 1, i, true, i);
+						break;
+					case Operation::LOADC: {
+						auto width = stackEffectOf(_program, ins).push;
+						produce(number({CONSTANT_POOL, ins.GetX()}), width, i, true, i);
+						break;
+					}
+					case Operation::LOADA: {
+						auto vn = number({ADDRESS, ins.GetX(), ins.GetOpt()});
+						_addresses[vn] = {ins.GetX(), ins.GetOpt()};
+						produce(vn, 1, i, true, i);
+						break;
+					}
+					case Operation::ILOAD:
+					case Operation::DLOAD: {
+						auto address = pop();
+						auto width = op == Operation::DLOAD ? 2 : 1;
+						auto itr = _addresses.find(address.vn);
+						if (itr == _addresses.end()) {
+							produce(fresh(), width, address.start, false, i);
+							break;
+						}
+						auto [level, offset] = itr->second;
+						auto vn = number({LOAD, op, level, offset, _versions[{level, offset}], level > 0 ? _calls : 0, _stores});
+						produce(vn, width, address.start, address.pure, i);
+						break;
+					}
+					case Operation::ISTORE:
+					case Operation::DSTORE: {
+						pop(op == Operation::DSTORE ? 2 : 1);
+						clobber(pop());
+						_impure = i;
+						break;
+					}
+					case Operation::IADD:
+					case Operation::ISUB:
+					case Operation::IMUL:
+					case Operation::IDIV:
+					case Operation::ICMP:
+					case Operation::DADD:
+					case Operation::DSUB:
+					case Operation::DMUL:
+					case Operation::DDIV:
+					case Operation::DCMP: {
+						const bool isDouble = op == Operation::DADD || op == Operation::DSUB || op == Operation::DMUL
+							|| op == Operation::DDIV || op == Operation::DCMP;
+						auto rhs = pop(isDouble ? 2 : 1);
+						auto lhs = pop(isDouble ? 2 : 1);
+						int64_t a = lhs.vn, b = rhs.vn;
+						if ((op == Operation::IADD || op == Operation::IMUL || op == Operation::DADD || op == Operation::DMUL) && a > b)
+							std::swap(a, b);
+						auto width = isDouble && op != Operation::DCMP ? 2 : 1;
+						produce(number({COMPUTE, op, a, b}), width, lhs.start, lhs.pure && rhs.pure, i);
+						break;
+					}
+					case Operation::INEG:
+					case Operation::I2C:
+					case Operation::I2D:
+					case Operation::DNEG:
+					case Operation::D2I: {
+						auto effect = stackEffectOf(_program, ins);
+						auto operand = pop(effect.pop);
+						produce(number({COMPUTE, op, operand.vn}), effect.push, operand.start, operand.pure, i);
+						break;
+					}
+					case Operation::DUP:
+					case Operation::DUP2: {
+						auto width = op == Operation::DUP2 ? 2 : 1;
+						auto top = pop(width);
+						push(top, width);
+						produce(top.vn, width, i, top.pure, i);
+						break;
+					}
+					case Operation::CALL: {
+						auto effect = stackEffectOf(_program, ins);
+						pop(effect.pop);
+						_calls++;
+						_impure = i;
+						push({fresh(), i, false}, effect.push);
+						break;
+					}
+					default: {
+						// 其余指令（输入、输出、跳转、SNEW 等）的结果一律视为未知
+						auto effect = stackEffectOf(_program, ins);
+						pop(effect.pop);
+						_impure = i;
+						for (int32_t k = 0; k < effect.push; k++)
+							push({fresh(), i, false}, 1);
+						break;
+					}
+				}
+			}
+			return _occurrences;
+		}
+
+		std::vector<std::pair<int32_t, int32_t> > basicBlocks(const std::vector<Instruction>& code) {
+			std::vector<std::pair<int32_t, int32_t> > blocks;
+			auto leaders = findLeaders(code);
+			int32_t begin = 0;
+			for (int32_t i = 1; i <= (int32_t)code.size(); i++) {
+				if (i == (int32_t)code.size() || leaders[i]) {
+					blocks.emplace_back(begin, i);
+					begin = i;
+				}
+			}
+			return blocks;
+		}
+
+		// 值已经在栈顶时，重新计算它的指令序列换成 DUP/DUP2
+		bool duplicateOnTop(const Program& program, std::vector<Instruction>& code) {
+			CodePatch patch(code);
+			for (auto [begin, end] : basicBlocks(code)) {
+				ValueNumbering vn(program);
+				for (auto& occ : vn.Run(code, begin, end)) {
+					if (!occ.onTop || occ.end == occ.start)
+						continue;
+					patch.Replace(occ.start, {Instruction(occ.width == 2 ? Operation::DUP2 : Operation::DUP)});
+					for (int32_t i = occ.start + 1; i <= occ.end; i++)
+						patch.Remove(i);
+				}
+			}
+			if (patch.Empty())
+				return false;
+			patch.Apply();
+			return true;
+		}
+
+		// 一组可以通过临时slot复用的计算
+		struct Spill {
+			Occurrence first;
+			std::vector<Occurrence> reuses;
+			int32_t block;
+		};
+
+		bool overlaps(const Occurrence& a, const Occurrence& b) {
+			return a.start <= b.end && b.start <= a.end;
+		}
+
+		// 第一次计算后存入临时slot：LOADA t; <计算>; ISTORE; LOADA t; ILOAD，多出 4 条指令
+		// 之后每次复用只要 LOADA t; ILOAD 两条
+		const int32_t SpillCost = 4;
+
+		std::vector<Spill> chooseSpills(const Program& program, const std::vector<Instruction>& code) {
+			std::vector<Spill> candidates;
+			auto blocks = basicBlocks(code);
+			for (int32_t b = 0; b < (int32_t)blocks.size(); b++) {
+				ValueNumbering vn(program);
+				std::map<int32_t, std::vector<Occurrence> > groups;
+				for (auto& occ : vn.Run(code, blocks[b].first, blocks[b].second))
+					if (occ.end - occ.start + 1 > 2)
+						groups[occ.vn].emplace_back(occ);
+				for (auto& [_, occs] : groups) {
+					std::sort(occs.begin(), occs.end(), [](const Occurrence& x, const Occurrence& y) { return x.start < y.start; });
+					Spill spill{occs[0], {}, b};
+					for (std::size_t i = 1; i < occs.size(); i++) {
+						auto last = spill.reuses.empty() ? spill.first : spill.reuses.back();
+						if (occs[i].start > last.end)
+							spill.reuses.emplace_back(occs[i]);
+					}
+					int32_t benefit = -SpillCost;
+					for (auto& r : spill.reuses)
+						benefit += r.end - r.start + 1 - 2;
+					if (benefit > 0)
+						candidates.emplace_back(spill);
+				}
+			}
+
+			// 被替换掉的复用位置不能和其他选中的计算重叠，第一次计算之间只会互相嵌套
+			std::vector<Spill> chosen;
+			for (auto& c : candidates) {
+				bool ok = true;
+				for (auto& other : chosen) {
+					for (auto& r : c.reuses) {
+						ok = ok && !overlaps(r, other.first);
+						for (auto& o : other.reuses)
+							ok = ok && !overlaps(r, o);
+					}
+					for (auto& o : other.reuses)
+						ok = ok && !overlaps(c.first, o);
+				}
+				if (ok)
+					chosen.emplace_back(c);
+			}
+			// 嵌套的第一次计算共用起点时，外层的 LOADA 要先插入
+			std::sort(chosen.begin(), chosen.end(), [](const Spill& x, const Spill& y) {
+				if (x.first.start != y.first.start)
+					return x.first.start < y.first.start;
+				return x.first.end > y.first.end;
+			});
+			return chosen;
+		}
+
+		// 不在栈顶的重复计算存进栈帧中的临时slot
+		void spillToFrame(const Program& program, int32_t func, std::vector<Instruction>& code) {
+			auto spills = chooseSpills(program, code);
+			if (spills.empty())
+				return;
+
+			// 各基本块之间的临时slot可以共用
+			const auto slotsNeeded = [](const std::vector<Spill>& v) {
+				std::map<int32_t, int32_t> perBlock;
+				int32_t most = 0;
+				for (auto& s : v)
+					most = std::max(most, perBlock[s.block] += s.first.width);
+				return most;
+			};
+			auto base = allocateFrameSlots(program, func, code, slotsNeeded(spills));
+			// 分配栈帧可能移动了指令的位置
+			spills = chooseSpills(program, code);
+
+			CodePatch patch(code);
+			std::map<int32_t, int32_t> used;
+			for (auto& s : spills) {
+				auto slot = base + used[s.block];
+				used[s.block] += s.first.width;
+				const bool isDouble = s.first.width == 2;
+				const std::vector<Instruction> reload = {
+					Instruction(Operation::LOADA, 0, slot),
+					Instruction(isDouble ? Operation::DLOAD : Operation::ILOAD),
+				};
+
+				patch.InsertBefore(s.first.start, {Instruction(Operation::LOADA, 0, slot)});
+				std::vector<Instruction> save = {Instruction(isDouble ? Operation::DSTORE : Operation::ISTORE)};
+				save.insert(save.end(), reload.begin(), reload.end());
+				patch.InsertBefore(s.first.end + 1, save, false);
+				for (auto& r : s.reuses) {
+					patch.Replace(r.start, reload);
+					for (int32_t i = r.start + 1; i <= r.end; i++)
+						patch.Remove(i);
+				}
+			}
+			patch.Apply();
+		}
+	}
+
+	void eliminateCommonSubexpressions(Program& program) {
+		for (auto& [func, code] : program.functions) {
+			while (duplicateOnTop(program, code))
+				;
+			spillToFrame(program, func, code);
+		}
+	}
+}
@@ -0,0 +1,439 @@
+#include "passes.h"
+#include "bytecode.h"
+
+#include <algorithm>
+#include <queue>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using int64_t = std::int64_t;
+
+		// 循环头处的区间扩大超过 WidenAfter 次后直接放宽到 int 的边界，保证分析终止
+		const int32_t WidenAfter = 3;
+
+		struct Interval {
+			int64_t lo = INT32_MIN;
+			int64_t hi = INT32_MAX;
+
+			bool empty() const { return lo > hi; }
+			bool within(int64_t l, int64_t h) const { return l <= lo && hi <= h; }
+			bool contains(int64_t x) const { return lo <= x && x <= hi; }
+			bool operator==(const Interval& rhs) const { return lo == rhs.lo && hi == rhs.hi; }
+			bool operator!=(const Interval& rhs) const { return !(*this == rhs); }
+		};
+
+		const Interval Top{};
+		const Interval CharRange{0, 255};
+
+		Interval join(const Interval& x, const Interval& y) {
+			return {std::min(x.lo, y.lo), std::max(x.hi, y.hi)};
+		}
+
+		// 结果超出 int 范围时会回绕，只能是任意值
+		std::optional<Interval> exact(int64_t lo, int64_t hi) {
+			if (lo < INT32_MIN || hi > INT32_MAX)
+				return {};
+			return Interval{lo, hi};
+		}
+
+		std::optional<Interval> arithmetic(Operation op, const Interval& a, const Interval& b) {
+			switch (op) {
+				case Operation::IADD:
+					return exact(a.lo + b.lo, a.hi + b.hi);
+				case Operation::ISUB:
+					return exact(a.lo - b.hi, a.hi - b.lo);
+				case Operation::IMUL: {
+					int64_t c[] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+					return exact(*std::min_element(c, c + 4), *std::max_element(c, c + 4));
+				}
+				case Operation::IDIV: {
+					if (b.contains(0) || (b.contains(-1) && a.contains(INT32_MIN)))
+						return {};
+					// 除数不跨过 0 时，商在四个角上取到最值
+					int64_t c[] = {a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi};
+					return exact(*std::min_element(c, c + 4), *std::max_element(c, c + 4));
+				}
+				default:
+					return {};
+			}
+		}
+
+		// 值从 a 比较 b 后跳转条件成立时 a 的取值范围
+		Interval refine(Operation jump, Interval a, const Interval& b) {
+			switch (jump) {
+				case Operation::JE:
+					return {std::max(a.lo, b.lo), std::min(a.hi, b.hi)};
+				case Operation::JNE:
+					if (b.lo == b.hi && a.lo == b.lo)
+						a.lo++;
+					else if (b.lo == b.hi && a.hi == b.hi)
+						a.hi--;
+					return a;
+				case Operation::JL:
+					return {a.lo, std::min(a.hi, b.hi - 1)};
+				case Operation::JLE:
+					return {a.lo, std::min(a.hi, b.hi)};
+				case Operation::JG:
+					return {std::max(a.lo, b.lo + 1), a.hi};
+				case Operation::JGE:
+					return {std::max(a.lo, b.lo), a.hi};
+				default:
+					return a;
+			}
+		}
+
+		// 按栈顶的值跳转的条件跳转，超级指令不在其中
+		bool isBranch(Operation op) {
+			switch (op) {
+				case Operation::JE:
+				case Operation::JNE:
+				case Operation::JL:
+				case Operation::JGE:
+				case Operation::JG:
+				case Operation::JLE:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		Operation negate(Operation jump) {
+			switch (jump) {
+				case Operation::JE: return Operation::JNE;
+				case Operation::JNE: return Operation::JE;
+				case Operation::JL: return Operation::JGE;
+				case Operation::JGE: return Operation::JL;
+				case Operation::JG: return Operation::JLE;
+				case Operation::JLE: return Operation::JG;
+				default: return jump;
+			}
+		}
+
+		// a 和 b 交换位置后的比较
+		Operation mirror(Operation jump) {
+			switch (jump) {
+				case Operation::JL: return Operation::JG;
+				case Operation::JG: return Operation::JL;
+				case Operation::JLE: return Operation::JGE;
+				case Operation::JGE: return Operation::JLE;
+				default: return jump;
+			}
+		}
+
+		// 局部变量和临时值都在操作数栈上，状态就是栈上每个slot的取值范围
+		// 下标为相对栈帧的偏移，LOADA 0,x 指向 x 处的slot
+		using State = std::vector<Interval>;
+
+		class RangeAnalysis final {
+		public:
+			RangeAnalysis(const Program& program, const std::vector<Instruction>& code, int32_t func)
+				: _program(program), _code(code), _frame(frameAccesses(program, code)), _leaders(findLeaders(code)), _in(code.size()) {
+				State entry(paramSlots(program, func), Top);
+				auto sig = program.signatures.find(func);
+				// 分析器在传参时对 char 参数做了 I2C
+				if (sig != program.signatures.end()) {
+					int32_t slot = 0;
+					for (auto type : sig->second.second) {
+						if (type == TokenType::CHAR)
+							entry[slot] = CharRange;
+						slot += type == TokenType::DOUBLE ? 2 : 1;
+					}
+				}
+				_entry = entry;
+				_headers.resize(code.size(), false);
+				for (int32_t i = 0; i < (int32_t)code.size(); i++)
+					if (isJump(code[i].GetOperation()) && code[i].GetX() <= i)
+						_headers[code[i].GetX()] = true;
+			}
+			RangeAnalysis(const RangeAnalysis&) = delete;
+			RangeAnalysis& operator=(const RangeAnalysis&) = delete;
+
+			// 深度不一致等无法分析的情况返回 false
+			bool Run();
+			// 指令执行前栈上的取值范围，不可达的指令为空
+			const std::optional<State>& In(int32_t pos) const { return _in[pos]; }
+		private:
+			bool transfer(int32_t pos, State& state) const;
+			// pos 之前（同一基本块中）由 producer 压入的值在栈上的位置，可能有多处保存着同一个值
+			std::vector<int32_t> locationsOf(int32_t producer, int32_t pos) const;
+			// 条件跳转在成立（taken）或不成立时对状态的约束，不可能发生时返回空
+			std::optional<State> constrain(int32_t pos, const State& out, bool taken) const;
+			bool merge(int32_t pos, const State& state, std::vector<int32_t>& visits);
+		private:
+			const Program& _program;
+			const std::vector<Instruction>& _code;
+			FrameAccesses _frame;
+			std::vector<bool> _leaders;
+			// 向后跳转的目标
+			std::vector<bool> _headers;
+			State _entry;
+			std::vector<std::optional<State> > _in;
+		};
+
+		bool RangeAnalysis::transfer(int32_t pos, State& state) const {
+			auto& ins = _code[pos];
+			auto& access = _frame.accesses[pos];
+			auto effect = stackEffectOf(_program, ins);
+			if ((int32_t)state.size() < effect.pop)
+				return false;
+			const auto pop = [&](int32_t n) {
+				State values(state.end() - n, state.end());
+				state.resize(state.size() - n);
+				return values;
+			};
+			const auto slotValue = [&](int32_t slot) {
+				if (slot < 0 || slot >= (int32_t)state.size() || _frame.escaped.count(slot))
+					return Top;
+				return state[slot];
+			};
+			switch (ins.GetOperation()) {
+				case Operation::BIPUSH:
+				case Operation::IPUSH:
+					state.push_back({ins.GetX(), ins.GetX()});
+					return true;
+				case Operation::LOADC: {
+					auto value = literalOf(_program, ins);
+					if (value.has_value() && std::holds_alternative<int32_t>(value.value()))
+						state.push_back({std::get<int32_t>(value.value()), std::get<int32_t>(value.value())});
+					else
+						state.resize(state.size() + effect.push, Top);
+					return true;
+				}
+				case Operation::ILOAD: {
+					pop(1);
+					state.push_back(access.has_value() ? slotValue(access->slot) : Top);
+					return true;
+				}
+				case Operation::DUP:
+					state.push_back(state.back());
+					return true;
+				case Operation::DUP2:
+					state.push_back(state[state.size() - 2]);
+					state.push_back(state[state.size() - 2]);
+					return true;
+				case Operation::IADD:
+				case Operation::ISUB:
+				case Operation::IMUL:
+				case Operation::IDIV: {
+					auto values = pop(2);
+					state.push_back(arithmetic(ins.GetOperation(), values[0], values[1]).value_or(Top));
+					return true;
+				}
+				case Operation::INEG: {
+					auto a = pop(1)[0];
+					state.push_back(a.lo > INT32_MIN ? Interval{-a.hi, -a.lo} : Top);
+					return true;
+				}
+				case Operation::ICMP:
+				case Operation::DCMP:
+					pop(effect.pop);
+					state.push_back({-1, 1});
+					return true;
+				case Operation::I2C: {
+					auto a = pop(1)[0];
+					state.push_back(a.within(0, 255) ? a : CharRange);
+					return true;
+				}
+				case Operation::CSCAN:
+					state.push_back(CharRange);
+					return true;
+				case Operation::CALL: {
+					pop(effect.pop);
+					auto sig = _program.signatures.find(ins.GetX());
+					const bool isChar = sig != _program.signatures.end() && sig->second.first == TokenType::CHAR;
+					state.resize(state.size() + effect.push, isChar ? CharRange : Top);
+					return true;
+				}
+				default:
+					break;
+			}
+			// ISTORE 先弹出值再写入，其余写入栈帧的指令一律使结果未知
+			Interval stored = Top;
+			if (ins.GetOperation() == Operation::ISTORE)
+				stored = state.back();
+			pop(effect.pop);
+			if (access.has_value() && access->store) {
+				if (access->slot < 0)
+					std::fill(state.begin(), state.end(), Top);
+				else {
+					for (auto k = access->slot; k < access->slot + access->width && k < (int32_t)state.size(); k++)
+						state[k] = access->width == 1 ? stored : Top;
+				}
+			}
+			state.resize(state.size() + effect.push, Top);
+			return true;
+		}
+
+		std::vector<int32_t> RangeAnalysis::locationsOf(int32_t producer, int32_t pos) const {
+			auto& ins = _code[producer];
+			if (ins.GetOperation() == Operation::DUP && _in[producer].has_value()) {
+				// 被复制的值，以及它来自的变量
+				std::vector<int32_t> locations{(int32_t)_in[producer]->size() - 1};
+				auto source = producerOf(_program, _code, producer, 0);
+				if (source.has_value() && _code[source.value()].GetOperation() == Operation::ILOAD) {
+					auto more = locationsOf(source.value(), pos);
+					locations.insert(locations.end(), more.begin(), more.end());
+				}
+				return locations;
+			}
+			auto& access = _frame.accesses[producer];
+			if (ins.GetOperation() != Operation::ILOAD || !access.has_value() || access->slot < 0 || _frame.escaped.count(access->slot))
+				return {};
+			// 读取之后到跳转之前该slot没有被写入
+			for (auto k = producer + 1; k < pos; k++) {
+				auto& other = _frame.accesses[k];
+				if (other.has_value() && other->store && (other->slot < 0 || other->slot == access->slot))
+					return {};
+			}
+			return {access->slot};
+		}
+
+		std::optional<State> RangeAnalysis::constrain(int32_t pos, const State& out, bool taken) const {
+			const auto jump = taken ? _code[pos].GetOperation() : negate(_code[pos].GetOperation());
+			State state = out;
+			// ICMP 之后的跳转比较两个操作数，否则比较栈顶的值和 0
+			std::vector<int32_t> lhs, rhs;
+			Interval a, b;
+			if (pos > 0 && !_leaders[pos] && _code[pos - 1].GetOperation() == Operation::ICMP && _in[pos - 1].has_value()) {
+				auto& before = _in[pos - 1].value();
+				a = before[before.size() - 2];
+				b = before[before.size() - 1];
+				auto left = producerOf(_program, _code, pos - 1, 1);
+				auto right = producerOf(_program, _code, pos - 1, 0);
+				if (left.has_value())
+					lhs = locationsOf(left.value(), pos);
+				if (right.has_value())
+					rhs = locationsOf(right.value(), pos);
+			}
+			else {
+				a = _in[pos]->back();
+				b = {0, 0};
+				auto producer = producerOf(_program, _code, pos, 0);
+				if (producer.has_value())
+					lhs = locationsOf(producer.value(), pos);
+			}
+			auto na = refine(jump, a, b);
+			auto nb = refine(mirror(jump), b, a);
+			if (na.empty() || nb.empty())
+				return {};
+			const auto narrow = [&](const std::vector<int32_t>& locations, const Interval& value) {
+				for (auto location : locations) {
+					if (location >= (int32_t)state.size())
+						continue;
+					auto& current = state[location];
+					current = {std::max(current.lo, value.lo), std::min(current.hi, value.hi)};
+					if (current.empty())
+						return false;
+				}
+				return true;
+			};
+			if (!narrow(lhs, na) || !narrow(rhs, nb))
+				return {};
+			return state;
+		}
+
+		bool RangeAnalysis::merge(int32_t pos, const State& state, std::vector<int32_t>& visits) {
+			if (!_in[pos].has_value()) {
+				_in[pos] = state;
+				return true;
+			}
+			auto& in = _in[pos].value();
+			if (in.size() != state.size())
+				return false;
+			bool changed = false;
+			const bool widen = _headers[pos] && ++visits[pos] > WidenAfter;
+			for (std::size_t k = 0; k < in.size(); k++) {
+				auto merged = join(in[k], state[k]);
+				if (merged == in[k])
+					continue;
+				if (widen) {
+					if (merged.lo < in[k].lo)
+						merged.lo = INT32_MIN;
+					if (merged.hi > in[k].hi)
+						merged.hi = INT32_MAX;
+				}
+				in[k] = merged;
+				changed = true;
+			}
+			return changed;
+		}
+
+		bool RangeAnalysis::Run() {
+			if (_code.empty())
+				return true;
+			_in[0] = _entry;
+			std::vector<int32_t> visits(_code.size(), 0);
+			std::vector<bool> queued(_code.size(), false);
+			std::queue<int32_t> work;
+			work.push(0);
+			queued[0] = true;
+			while (!work.empty()) {
+				auto pos = work.front();
+				work.pop();
+				queued[pos] = false;
+				auto out = _in[pos].value();
+				if (!transfer(pos, out))
+					return false;
+				// 两条出边去往同一处时不做约束
+				const bool branch = isBranch(_code[pos].GetOperation()) && _code[pos].GetX() != pos + 1;
+				for (auto succ : successorsOf(_code, pos)) {
+					std::optional<State> state = out;
+					if (branch)
+						state = constrain(pos, out, succ == _code[pos].GetX());
+					if (!state.has_value())
+						continue;
+					if (_in[succ].has_value() && _in[succ]->size() != state->size())
+						return false;
+					if (merge(succ, state.value(), visits) && !queued[succ]) {
+						work.push(succ);
+						queued[succ] = true;
+					}
+				}
+			}
+			return true;
+		}
+
+		// 根据分析结果删除多余的 I2C，并标出不会溢出的整数运算
+		void apply(const Program& program, std::vector<Instruction>& code, int32_t func) {
+			RangeAnalysis analysis(program, code, func);
+			if (!analysis.Run())
+				return;
+			CodePatch patch(code);
+			for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+				auto& in = analysis.In(i);
+				if (!in.has_value() || in->empty())
+					continue;
+				auto op = code[i].GetOperation();
+				bool safe = false;
+				switch (op) {
+					case Operation::I2C:
+						if (in->back().within(0, 255))
+							patch.Remove(i);
+						break;
+					case Operation::INEG:
+						safe = in->back().lo > INT32_MIN;
+						break;
+					case Operation::IADD:
+					case Operation::ISUB:
+					case Operation::IMUL:
+					case Operation::IDIV:
+						safe = in->size() >= 2 && arithmetic(op, (*in)[in->size() - 2], in->back()).has_value();
+						break;
+					default:
+						break;
+				}
+				if (safe)
+					code[i] = Instruction(op, code[i].GetX(), NoOverflow);
+			}
+			patch.Apply();
+		}
+	}
+
+	void propagateValueRanges(Program& program) {
+		apply(program, program.start, -1);
+		for (auto& [func, code] : program.functions)
+			apply(program, code, func);
+	}
+}
@@ -0,0 +1,16 @@
+#!/bin/bash
+# 比较不同执行方式的运行时间：./bench.sh [cc0 的优化选项]
+TIMEFORMAT=%3R
+for f in bench/*.c0; do
+	./cc0 -c "$@" $f -o ${f%.c0}.o0 || exit 1
+	for mode in "--dispatch switch" "--dispatch threaded" "--slots 64" "--engine register" "--engine jit" "--engine tiered"; do
+		t=$( { time ./c0vm $mode ${f%.c0}.o0 > /dev/null; } 2>&1 )
+		printf "%-20s%-22s%8ss\n" $f "$mode" $t
+	done
+	# 生成 C 后用系统的编译器编译
+	if command -v cc > /dev/null && ./cc0 --emit-c "$@" $f -o ${f%.c0}.c && cc -O2 ${f%.c0}.c -o ${f%.c0}.bin; then
+		t=$( { time ./${f%.c0}.bin > /dev/null; } 2>&1 )
+		printf "%-20s%-22s%8ss\n" $f "--emit-c" $t
+		rm -f ${f%.c0}.c ${f%.c0}.bin
+	fi
+done
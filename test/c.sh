@@ -1,3 +1,3 @@
 #! bin/bash
 ./cc0 -c in.c0 -o in
-./c0-vm-cpp -r in
\ No newline at end of file
+./c0vm in
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "catch2/catch.hpp"
+
+#include "tokenizer/tokenizer.h"
+#include "analyser/analyser.h"
+#include "instruction/program.h"
+
+#include <sstream>
+#include <string>
+
+// 测试共用：把源代码编译成 Program，词法或语法错误时测试失败
+inline c0::Program compile(const std::string& input) {
+	std::stringstream ss;
+	ss.str(input);
+	c0::Tokenizer tkz(ss);
+	auto tokens = tkz.AllTokens();
+	REQUIRE_FALSE(tokens.second.has_value());
+	c0::Analyser analyser(tokens.first);
+	auto p = analyser.Analyse();
+	REQUIRE_FALSE(p.second.has_value());
+	c0::Program program;
+	program.consts = analyser.getConst();
+	program.start = analyser.getStartCode();
+	program.funcs = analyser.getFuncs();
+	program.functions = p.first;
+	program.signatures = analyser.getFuncTypes();
+	return program;
+}
@@ -0,0 +1,411 @@
+#include "catch2/catch.hpp"
+#include "tests/compile.h"
+
+#include "optimizer/optimizer.h"
+#include "optimizer/passes.h"
+#include "optimizer/bytecode.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+	// 在每条 IPUSH 8 之后插入一次输出，模拟展开后夹在表达式中间的语句
+	void printAfterEights(std::vector<c0::Instruction>& code) {
+		c0::CodePatch patch(code);
+		for (int32_t i = 0; i < (int32_t)code.size(); i++)
+			if (code[i] == c0::Instruction(c0::Operation::IPUSH, 8))
+				patch.InsertBefore(i + 1, {c0::Instruction(c0::Operation::IPUSH, 7), c0::Instruction(c0::Operation::IPRINT)}, false);
+		patch.Apply();
+	}
+
+	std::size_t countOf(const std::vector<c0::Instruction>& code, c0::Operation op) {
+		return std::count_if(code.begin(), code.end(), [&](const c0::Instruction& ins) { return ins.GetOperation() == op; });
+	}
+
+	bool calls(const std::vector<c0::Instruction>& code, int32_t func) {
+		return std::any_of(code.begin(), code.end(), [&](const c0::Instruction& ins) {
+			return ins.GetOperation() == c0::Operation::CALL && ins.GetX() == func;
+		});
+	}
+}
+
+TEST_CASE("Self tail calls become jumps.") {
+	auto program = compile(
+		"int gcd(int a, int b) {\n"
+		"	if (b == 0) return a;\n"
+		"	return gcd(b, a - a / b * b);\n"
+		"}\n");
+	REQUIRE(calls(program.functions[0], 0));
+	c0::eliminateTailCalls(program);
+	REQUIRE_FALSE(calls(program.functions[0], 0));
+}
+
+TEST_CASE("Accumulator recursion becomes a loop.") {
+	auto program = compile(
+		"int fact(int n) {\n"
+		"	if (n <= 1) return 1;\n"
+		"	return n * fact(n - 1);\n"
+		"}\n"
+		"int fib(int n) {\n"
+		"	if (n < 2) return n;\n"
+		"	return fib(n - 1) + fib(n - 2);\n"
+		"}\n");
+	c0::eliminateTailCalls(program);
+	REQUIRE_FALSE(calls(program.functions[0], 0));
+	// fib 只有第二个调用能变成循环
+	REQUIRE(calls(program.functions[1], 1));
+	REQUIRE(program.functions[1].front().GetOperation() == c0::Operation::SNEW);
+}
+
+TEST_CASE("Repeated expressions are computed once.") {
+	auto program = compile(
+		"int f(int a, int b) {\n"
+		"	return (a * b + a) * (a * b + a) + (a * b + a);\n"
+		"}\n");
+	auto count = [](const std::vector<c0::Instruction>& code) {
+		return std::count_if(code.begin(), code.end(), [](const c0::Instruction& ins) {
+			return ins.GetOperation() == c0::Operation::IMUL;
+		});
+	};
+	REQUIRE(count(program.functions[0]) == 4);
+	c0::eliminateCommonSubexpressions(program);
+	REQUIRE(count(program.functions[0]) == 2);
+
+	// 中间有输出的两段相同指令不是同一个值
+	program = compile(
+		"int f(int a) {\n"
+		"	return 8 * a + 8 * a + 8 * a;\n"
+		"}\n");
+	printAfterEights(program.functions[0]);
+	c0::eliminateCommonSubexpressions(program);
+	REQUIRE(countOf(program.functions[0], c0::Operation::IPRINT) == 3);
+	REQUIRE(count(program.functions[0]) == 3);
+}
+
+TEST_CASE("Induction variable multiplications become additions.") {
+	auto program = compile(
+		"int f(int n, int w) {\n"
+		"	int i = 0;\n"
+		"	int j;\n"
+		"	int s = 0;\n"
+		"	while (i < n) {\n"
+		"		j = 0;\n"
+		"		while (j < w) {\n"
+		"			s = s + i * 7 + j * 2;\n"
+		"			j = j + 1;\n"
+		"		}\n"
+		"		i = i + 1;\n"
+		"	}\n"
+		"	return s;\n"
+		"}\n");
+	c0::reduceStrength(program);
+	auto& code = program.functions[0];
+	// i * 7 只在进入外层循环前计算一次，j * 2 换成了加法
+	REQUIRE(std::count_if(code.begin(), code.end(), [](const c0::Instruction& ins) {
+		return ins.GetOperation() == c0::Operation::IMUL;
+	}) == 1);
+}
+
+TEST_CASE("Loop invariant computations are hoisted.") {
+	auto program = compile(
+		"int g = 3;\n"
+		"void touch() { g = g + 1; }\n"
+		"int f(int n) {\n"
+		"	int i = 0;\n"
+		"	int s = 0;\n"
+		"	while (i < n) {\n"
+		"		s = s + g * n;\n"
+		"		i = i + 1;\n"
+		"	}\n"
+		"	while (i > 0) {\n"
+		"		s = s + g * n;\n"
+		"		touch();\n"
+		"		i = i - 1;\n"
+		"	}\n"
+		"	return s;\n"
+		"}\n");
+	c0::hoistLoopInvariants(program);
+	auto& code = program.functions[1];
+	std::vector<std::size_t> muls;
+	for (std::size_t i = 0; i < code.size(); i++)
+		if (code[i].GetOperation() == c0::Operation::IMUL)
+			muls.push_back(i);
+	REQUIRE(muls.size() == 2);
+	// 第一个循环中的 g * n 提到了循环之前，第二个循环调用了修改 g 的函数，不能提出
+	auto loops = c0::findLoops(code);
+	REQUIRE(loops.size() == 2);
+	REQUIRE_FALSE(std::any_of(loops.begin(), loops.end(), [&](const c0::Loop& l) { return l.contains(muls[0]); }));
+	REQUIRE(std::any_of(loops.begin(), loops.end(), [&](const c0::Loop& l) { return l.contains(muls[1]); }));
+
+	// 操作数都是常量，但中间夹着输出，整段都不能提出循环
+	program = compile(
+		"int f(int n) {\n"
+		"	int i = 0;\n"
+		"	int s = 0;\n"
+		"	while (i < n) {\n"
+		"		s = 8 * 2;\n"
+		"		i = i + 1;\n"
+		"	}\n"
+		"	return s;\n"
+		"}\n");
+	printAfterEights(program.functions[0]);
+	c0::hoistLoopInvariants(program);
+	auto& printed = program.functions[0];
+	auto print = std::find(printed.begin(), printed.end(), c0::Instruction(c0::Operation::IPRINT)) - printed.begin();
+	REQUIRE(print < (std::ptrdiff_t)printed.size());
+	loops = c0::findLoops(printed);
+	REQUIRE(std::any_of(loops.begin(), loops.end(), [&](const c0::Loop& l) { return l.contains(print); }));
+}
+
+TEST_CASE("Pass lists are checked before running.") {
+	auto program = compile(
+		"int main() {\n"
+		"	int a = 1;\n"
+		"	print(a + 2, a + 2);\n"
+		"	return 0;\n"
+		"}\n");
+	auto before = program.functions[0];
+	c0::Optimizer optimizer(program);
+	auto unknown = optimizer.Run({"cse", "no-such-pass"});
+	REQUIRE(unknown == std::optional<std::string>("no-such-pass"));
+	REQUIRE(optimizer.GetStatistics().empty());
+	REQUIRE(program.functions[0] == before);
+
+	REQUIRE_FALSE(optimizer.Run({"cse"}).has_value());
+	auto& statistics = optimizer.GetStatistics();
+	REQUIRE(statistics.size() == 1);
+	REQUIRE(statistics[0].name == "cse");
+	REQUIRE(statistics[0].after == (int64_t)program.functions[0].size() + (int64_t)program.start.size());
+}
+
+TEST_CASE("Constant arguments are propagated and hot calls specialised.") {
+	auto program = compile(
+		"int scale(int x, int factor) { return x * factor; }\n"
+		"int poly(int x, int mode) { if (mode == 0) return x; return x * x; }\n"
+		"int main() {\n"
+		"	int i = 0, s = 0;\n"
+		"	while (i < 10) { s = s + poly(i, 1); i = i + 1; }\n"
+		"	print(scale(s, 7), scale(3, 7), poly(i, 0), poly(i, 2));\n"
+		"	return 0;\n"
+		"}\n");
+	const auto functions = program.functions.size();
+	c0::propagateConstantArguments(program, nullptr);
+	using c0::Instruction;
+	using c0::Operation;
+	auto& scale = program.functions[0];
+	REQUIRE(std::find(scale.begin(), scale.end(), Instruction(Operation::BIPUSH, 7)) != scale.end());
+	REQUIRE(std::find(scale.begin(), scale.end(), Instruction(Operation::LOADA, 0, 1)) == scale.end());
+	// 循环中的 poly(i, 1) 调用特化的副本，其余调用的 mode 不同，原函数保持不变
+	REQUIRE(program.functions.size() == functions + 1);
+	const auto clone = program.functions.rbegin()->first;
+	auto& main = program.functions[2];
+	REQUIRE(calls(main, clone));
+	REQUIRE(calls(main, 1));
+	auto& poly = program.functions[clone];
+	REQUIRE(std::find(poly.begin(), poly.end(), Instruction(Operation::LOADA, 0, 1)) == poly.end());
+	REQUIRE(program.signatures.count(clone));
+	REQUIRE(program.funcs.count(clone));
+}
+
+TEST_CASE("Pure calls with constant arguments are evaluated.") {
+	auto program = compile(
+		"int g = 1;\n"
+		"int square(int x) { return x * x; }\n"
+		"int addg(int x) { return x + g; }\n"
+		"int count(int n) { while (1) n = n + 1; return n; }\n"
+		"int main() {\n"
+		"	print(square(square(3)), addg(1), count(0));\n"
+		"	return 0;\n"
+		"}\n");
+	c0::evaluatePureCalls(program);
+	auto& code = program.functions[3];
+	REQUIRE_FALSE(calls(code, 0));
+	REQUIRE(std::find(code.begin(), code.end(), c0::Instruction(c0::Operation::IPUSH, 81)) != code.end());
+	// 读全局变量的函数和超出步数预算的函数保留调用
+	REQUIRE(calls(code, 1));
+	REQUIRE(calls(code, 2));
+}
+
+TEST_CASE("Literals use the cheapest encoding.") {
+	auto program = compile(
+		"double zero() { print(1); }\n"
+		"int main() {\n"
+		"	char c = 'a', d;\n"
+		"	d = c;\n"
+		"	print(0x10, -0x10, 300, (char)(0x141), -2.5, (int)(2.75));\n"
+		"	return 0;\n"
+		"}\n");
+	const auto constants = program.consts.size();
+	c0::selectLiterals(program);
+	auto has = [](const std::vector<c0::Instruction>& code, const std::vector<c0::Instruction>& seq) {
+		return std::search(code.begin(), code.end(), seq.begin(), seq.end()) != code.end();
+	};
+	using c0::Instruction;
+	using c0::Operation;
+	REQUIRE(has(program.functions[0], {Instruction(Operation::BIPUSH, 0), Instruction(Operation::I2D), Instruction(Operation::DRET)}));
+	auto& code = program.functions[1];
+	REQUIRE(has(code, {Instruction(Operation::BIPUSH, 16), Instruction(Operation::IPRINT)}));
+	REQUIRE(has(code, {Instruction(Operation::IPUSH, -16), Instruction(Operation::IPRINT)}));
+	REQUIRE(has(code, {Instruction(Operation::IPUSH, 300), Instruction(Operation::IPRINT)}));
+	REQUIRE(has(code, {Instruction(Operation::BIPUSH, 65), Instruction(Operation::CPRINT)}));
+	REQUIRE(has(code, {Instruction(Operation::BIPUSH, 2), Instruction(Operation::IPRINT)}));
+	REQUIRE(std::count(code.begin(), code.end(), Instruction(Operation::I2C)) == 0);
+	// 十六进制和 2.75 的常量不再被引用，剩下的常量连续编号
+	REQUIRE(program.consts.size() < constants);
+	REQUIRE(program.consts.rbegin()->first + 1 == (int32_t)program.consts.size());
+}
+
+TEST_CASE("Adjacent constant output is printed at once.") {
+	auto program = compile(
+		"int main() {\n"
+		"	int i = 0;\n"
+		"	print(\"sum\", 1, 'c', 2.5);\n"
+		"	print(\"x\", i, \"y\");\n"
+		"	return 0;\n"
+		"}\n");
+	c0::coalescePrints(program);
+	auto& code = program.functions[0];
+	auto count = [&](c0::Operation op) {
+		return std::count_if(code.begin(), code.end(), [&](const c0::Instruction& ins) { return ins.GetOperation() == op; });
+	};
+	// i 之前的输出合为一次，跨越了两条语句
+	REQUIRE(count(c0::Operation::SPRINT) == 2);
+	REQUIRE(count(c0::Operation::IPRINT) == 1);
+	REQUIRE(count(c0::Operation::CPRINT) == 0);
+	REQUIRE(count(c0::Operation::DPRINT) == 0);
+	REQUIRE(count(c0::Operation::PRINTL) == 0);
+	std::vector<std::string> strings;
+	for (auto& [_, c] : program.consts)
+		if (std::get<0>(c) == "S")
+			strings.push_back(std::get<1>(c));
+	REQUIRE(std::find(strings.begin(), strings.end(), "sum\\x201\\x20c\\x202.500000\\x20\\x0ax\\x20") != strings.end());
+	REQUIRE(std::find(strings.begin(), strings.end(), "\\x20y\\x20\\x0a") != strings.end());
+
+	// 虚拟机的 SPRINT 在 '\0' 处停止，输出 '\0' 的 CPRINT 要保留下来
+	program = compile(
+		"int main() {\n"
+		"	print(1, (char)0, 2);\n"
+		"	return 0;\n"
+		"}\n");
+	c0::Optimizer(program).Optimize();
+	REQUIRE(std::count(program.functions[0].begin(), program.functions[0].end(), c0::Instruction(c0::Operation::CPRINT)) == 1);
+	for (auto& [_, c] : program.consts)
+		REQUIRE(std::get<1>(c).find("\\x00") == std::string::npos);
+}
+
+TEST_CASE("Copies are propagated and dead stores removed.") {
+	auto program = compile(
+		"int g = 0;\n"
+		"int main() {\n"
+		"	int a = 1;\n"
+		"	int b = 2;\n"
+		"	a = 3;\n"
+		"	b = a;\n"
+		"	g = 1;\n"
+		"	g = 2;\n"
+		"	print(b);\n"
+		"	return 0;\n"
+		"}\n");
+	const auto stores = [&](int32_t level, int32_t slot) {
+		auto& code = program.functions[0];
+		int32_t n = 0;
+		for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+			if (code[i].GetOperation() != c0::Operation::ISTORE)
+				continue;
+			auto address = c0::producerOf(program, code, i, 1);
+			if (address.has_value() && code[*address] == c0::Instruction(c0::Operation::LOADA, level, slot))
+				n++;
+		}
+		return n;
+	};
+	REQUIRE(stores(0, 0) == 2);
+	REQUIRE(stores(0, 1) == 2);
+	c0::propagateCopies(program);
+	c0::eliminateDeadStores(program);
+	// b = a 之后读 b 改为读 a，b 的写入全部失效，a 只剩最后一次写入
+	REQUIRE(stores(0, 0) == 1);
+	REQUIRE(stores(0, 1) == 0);
+	// 全局变量保守处理
+	REQUIRE(stores(1, 0) == 2);
+}
+
+TEST_CASE("Value ranges remove conversions and prove arithmetic safe.") {
+	auto program = compile(
+		"int share(int x) { switch (x) { case 4: return 100 / x; } return 100 / x; }\n"
+		"int main() {\n"
+		"	int i = 0, n;\n"
+		"	char c;\n"
+		"	scan(n);\n"
+		"	while (i < 26) { c = i; i = i + 1; }\n"
+		"	print(c, n * n, share(n));\n"
+		"	return 0;\n"
+		"}\n");
+	c0::propagateValueRanges(program);
+	using c0::Instruction;
+	using c0::Operation;
+	auto count = [](const std::vector<Instruction>& code, const Instruction& ins) {
+		return std::count(code.begin(), code.end(), ins);
+	};
+	auto& main = program.functions[1];
+	REQUIRE(count(main, Instruction(Operation::I2C)) == 0);
+	REQUIRE(count(main, Instruction(Operation::IADD, -1, c0::NoOverflow)) == 1);
+	// n 是任意输入，n * n 可能溢出
+	REQUIRE(count(main, Instruction(Operation::IMUL)) == 1);
+	// 只有 case 4 中的除法知道除数不为 0
+	auto& share = program.functions[0];
+	REQUIRE(count(share, Instruction(Operation::IDIV, -1, c0::NoOverflow)) == 1);
+	REQUIRE(count(share, Instruction(Operation::IDIV)) == 1);
+}
+
+TEST_CASE("Identical functions are merged.") {
+	auto program = compile(
+		"int sumA(int n) { if (n == 0) return 0; return n + sumA(n - 1); }\n"
+		"int sumB(int n) { if (n == 0) return 0; return n + sumB(n - 1); }\n"
+		"int useA(int x) { return sumA(x) * 2; }\n"
+		"int useB(int x) { return sumB(x) * 2; }\n"
+		"double twice(double x) { return x * 2; }\n"
+		"int main() {\n"
+		"	print(useA(3), useB(4), twice(1));\n"
+		"	return 0;\n"
+		"}\n");
+	c0::mergeIdenticalFunctions(program);
+	// sumB 合并后 useB 也和 useA 相同
+	REQUIRE(program.functions.size() == 4);
+	REQUIRE(program.funcs.size() == 4);
+	REQUIRE(program.funcs.rbegin()->first == 3);
+	auto& sum = program.functions[0];
+	REQUIRE(calls(sum, 0));
+	auto& main = program.functions[3];
+	REQUIRE(std::count(main.begin(), main.end(), c0::Instruction(c0::Operation::CALL, 1)) == 2);
+	REQUIRE(calls(main, 2));
+	// 函数名常量重新编号后仍然对应
+	REQUIRE(std::get<1>(program.consts.at(std::get<1>(program.funcs.at(3)))) == "main");
+}
+
+TEST_CASE("Frame slots are shared by disjoint live ranges.") {
+	auto program = compile(
+		"int f(int n) {\n"
+		"	int a = n + 1;\n"
+		"	int b = a * 2;\n"
+		"	double x = 1.5;\n"
+		"	int c = b - 1;\n"
+		"	double y = x + c;\n"
+		"	return y;\n"
+		"}\n");
+	auto reductions = c0::allocateSlots(program);
+	REQUIRE(reductions.count(0));
+	REQUIRE(reductions[0].first == 8);
+	REQUIRE(reductions[0].second < reductions[0].first);
+	auto sizes = c0::Optimizer::FrameSizes(program);
+	REQUIRE(sizes[0] == reductions[0].second);
+	// double 只放在偶数偏移上
+	auto& code = program.functions[0];
+	for (int32_t i = 0; i < (int32_t)code.size(); i++) {
+		auto op = code[i].GetOperation();
+		if (op != c0::Operation::DLOAD && op != c0::Operation::DSTORE)
+			continue;
+		auto address = c0::producerOf(program, code, i, op == c0::Operation::DSTORE ? 2 : 0);
+		REQUIRE(address.has_value());
+		REQUIRE(code[*address].GetOpt() % 2 == 0);
+	}
+}
@@ -0,0 +1,581 @@
+#include "catch2/catch.hpp"
+#include "tests/compile.h"
+
+#include "optimizer/optimizer.h"
+#include "optimizer/passes.h"
+#include "vm/vm.h"
+#include "vm/register_vm.h"
+#include "vm/verifier.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace {
+	std::string run(const c0::Program& program, const std::string& input = "") {
+		auto module = c0::moduleOf(program);
+		std::stringstream in(input), out;
+		c0::VirtualMachine vm(module, in, out);
+		auto err = vm.Run();
+		REQUIRE_FALSE(err.has_value());
+		return out.str();
+	}
+
+	const std::string sample =
+		"int g = 10;\n"
+		"double h = 0.5;\n"
+		"int fact(int n) {\n"
+		"	if (n <= 1) return 1;\n"
+		"	return n * fact(n - 1);\n"
+		"}\n"
+		"double half(double x) { return x * h; }\n"
+		"int main() {\n"
+		"	int i = 0;\n"
+		"	int s = 0;\n"
+		"	char c = 'a';\n"
+		"	while (i < g) {\n"
+		"		s = s + i * 3;\n"
+		"		i = i + 1;\n"
+		"	}\n"
+		"	scan(i);\n"
+		"	print(\"s=\", s, fact(5), half(3.0), c, 7 / -2);\n"
+		"	print(i, 2147483647 + 1);\n"
+		"	return 0;\n"
+		"}\n";
+	const std::string expected = "s= 135 120 1.500000 a -3 \n42 -2147483648 \n";
+
+	// 测试用的临时目录，离开作用域时连同其中的文件一起删除
+	struct TemporaryDirectory {
+		std::filesystem::path path;
+
+		TemporaryDirectory() {
+			std::random_device random;
+			do
+				path = std::filesystem::temp_directory_path() / ("c0_test_" + std::to_string(random()));
+			while (!std::filesystem::create_directory(path));
+		}
+		TemporaryDirectory(const TemporaryDirectory&) = delete;
+		TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+		~TemporaryDirectory() {
+			std::error_code ignored;
+			std::filesystem::remove_all(path, ignored);
+		}
+	};
+}
+
+TEST_CASE("The vm runs compiled programs.") {
+	REQUIRE(run(compile(sample), "42") == expected);
+}
+
+TEST_CASE("Optimized programs behave the same.") {
+	auto program = compile(sample);
+	c0::Optimizer(program).Optimize();
+	REQUIRE(run(program, "42") == expected);
+}
+
+TEST_CASE("Every optimization level behaves the same.") {
+	for (int32_t level = 0; level <= c0::Optimizer::MaxLevel; level++) {
+		auto program = compile(sample);
+		c0::Optimizer optimizer(program);
+		REQUIRE_FALSE(optimizer.Run(c0::Optimizer::PassesOf(level)).has_value());
+		REQUIRE(optimizer.GetStatistics().size() == c0::Optimizer::PassesOf(level).size());
+		REQUIRE(run(program, "42") == expected);
+	}
+}
+
+TEST_CASE("Superinstructions behave the same.") {
+	auto program = compile(sample);
+	c0::Optimizer(program).Optimize();
+	auto before = program.functions[2].size();
+	c0::fuseInstructions(program);
+	REQUIRE(program.functions[2].size() < before);
+	REQUIRE(run(program, "42") == expected);
+}
+
+TEST_CASE("Runtime errors are reported.") {
+	auto program = compile(
+		"int main() {\n"
+		"	int z = 0;\n"
+		"	print(1 / z);\n"
+		"	return 0;\n"
+		"}\n");
+	auto module = c0::moduleOf(program);
+	std::stringstream in, out;
+	c0::VirtualMachine vm(module, in, out);
+	auto err = vm.Run();
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::ErrDivideByZero);
+}
+
+TEST_CASE("Profiles drive layout and inlining.") {
+	auto program = compile(sample);
+	auto module = c0::moduleOf(program);
+	std::stringstream in("42"), out;
+	c0::VirtualMachine vm(module, in, out);
+	vm.EnableProfiling();
+	REQUIRE_FALSE(vm.Run().has_value());
+
+	std::stringstream file;
+	c0::writeProfile(vm.GetProfile(), file);
+	auto profile = c0::readProfile(file);
+	REQUIRE(profile.has_value());
+	REQUIRE(profile->functions.at(0).calls == 5);
+
+	c0::applyProfile(program, *profile);
+	auto& code = program.functions[2];
+	REQUIRE(std::none_of(code.begin(), code.end(), [](const c0::Instruction& ins) {
+		return ins.GetOperation() == c0::Operation::CALL && ins.GetX() == 1;
+	}));
+	REQUIRE(run(program, "42") == expected);
+}
+
+TEST_CASE("Inlined calls keep their side effects.") {
+	// 8 还在操作数栈上时不能展开 f，否则外提和公共子表达式会把 f 的输出和写全局变量当作纯计算
+	const std::string source =
+		"int g = 0;\n"
+		"int f(int x) {\n"
+		"	print(x);\n"
+		"	g = g + 1;\n"
+		"	return 2;\n"
+		"}\n"
+		"int main() {\n"
+		"	int k = 0;\n"
+		"	int s = 0;\n"
+		"	while (k < 3) {\n"
+		"		s = 8 * f(5);\n"
+		"		f(k);\n"
+		"		k = k + 1;\n"
+		"	}\n"
+		"	print(g, s);\n"
+		"	return 0;\n"
+		"}\n";
+	auto program = compile(source);
+	const auto reference = run(program);
+	auto module = c0::moduleOf(program);
+	std::stringstream in, out;
+	c0::VirtualMachine vm(module, in, out);
+	vm.EnableProfiling();
+	REQUIRE_FALSE(vm.Run().has_value());
+	for (int32_t level = 0; level <= c0::Optimizer::MaxLevel; level++) {
+		program = compile(source);
+		c0::applyProfile(program, vm.GetProfile());
+		c0::Optimizer(program).Run(c0::Optimizer::PassesOf(level));
+		REQUIRE(run(program) == reference);
+	}
+	// 只展开语句开头的调用
+	program = compile(source);
+	c0::applyProfile(program, vm.GetProfile());
+	auto& code = program.functions[1];
+	REQUIRE(std::count(code.begin(), code.end(), c0::Instruction(c0::Operation::CALL, 0)) == 1);
+}
+
+TEST_CASE(".o0 files are loaded.") {
+	const auto op = [](c0::Operation opr) {
+		return std::string(1, (char)c0::Instruction(opr).getBinaryInstruction());
+	};
+	std::string file("\x43\x30\x3a\x29\x00\x00\x00\x01", 8);
+	// 常量：S "main"，I -5，D 1.5
+	file += std::string("\x00\x03", 2);
+	file += std::string("\x00\x00\x04", 3) + "main";
+	file += std::string("\x01\xff\xff\xff\xfb", 5);
+	file += std::string("\x02\x3f\xf8\x00\x00\x00\x00\x00\x00", 9);
+	// 没有初始化代码，main 依次输出 -5、200 和 1.5
+	file += std::string("\x00\x00\x00\x01", 4);
+	file += std::string("\x00\x00\x00\x00\x00\x01\x00\x07", 8);
+	file += op(c0::Operation::LOADC) + std::string("\x00\x01", 2) + op(c0::Operation::IPRINT);
+	file += op(c0::Operation::BIPUSH) + "\xc8" + op(c0::Operation::IPRINT);
+	file += op(c0::Operation::LOADC) + std::string("\x00\x02", 2) + op(c0::Operation::DPRINT);
+	file += op(c0::Operation::RET);
+
+	std::stringstream ss(file);
+	auto module = c0::readModule(ss);
+	REQUIRE(module.has_value());
+	REQUIRE(module->functions.size() == 1);
+	REQUIRE(module->functions[0].code.size() == 7);
+	std::stringstream in, out;
+	c0::VirtualMachine vm(module.value(), in, out);
+	REQUIRE_FALSE(vm.Run().has_value());
+	REQUIRE(out.str() == "-52001.500000");
+
+	// 截断的文件不能被读取
+	std::stringstream truncated(file.substr(0, file.size() - 3));
+	REQUIRE_FALSE(c0::readModule(truncated).has_value());
+}
+
+TEST_CASE("Both dispatch modes behave the same.") {
+	auto program = compile(sample);
+	c0::Optimizer(program).Optimize();
+	c0::fuseInstructions(program);
+	auto module = c0::moduleOf(program);
+	for (auto mode : {c0::SwitchDispatch, c0::ThreadedDispatch}) {
+		std::stringstream in("42"), out;
+		c0::VirtualMachine vm(module, in, out);
+		vm.SetDispatch(mode);
+		REQUIRE_FALSE(vm.Run().has_value());
+		REQUIRE(out.str() == expected);
+	}
+}
+
+TEST_CASE("Invalid operands are reported when executed.") {
+	c0::Module module;
+	module.consts = {std::string("main"), 1.5};
+	module.functions.push_back({0, 0, 1, {
+		c0::Instruction(c0::Operation::LOADC, 1),
+		c0::Instruction(c0::Operation::DPRINT),
+		c0::Instruction(c0::Operation::JMP, 4),
+		c0::Instruction(c0::Operation::CALL, 7),
+		c0::Instruction(c0::Operation::LOADC, 5),
+	}});
+	std::stringstream in, out;
+	c0::VirtualMachine vm(module, in, out);
+	auto err = vm.Run();
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::ErrInvalidConstant);
+	REQUIRE(err->ip == 4);
+	REQUIRE(out.str() == "1.500000");
+
+	module.functions[0].code[2] = c0::Instruction(c0::Operation::NOP);
+	err = vm.Run();
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::ErrInvalidFunction);
+	REQUIRE(err->ip == 3);
+}
+
+TEST_CASE("The register machine behaves the same.") {
+	for (int32_t level = 0; level <= c0::Optimizer::MaxLevel; level++) {
+		auto program = compile(sample);
+		c0::Optimizer(program).Run(c0::Optimizer::PassesOf(level));
+		if (level == c0::Optimizer::MaxLevel)
+			c0::fuseInstructions(program);
+		auto module = c0::moduleOf(program);
+		std::stringstream in("42"), out;
+		c0::RegisterMachine vm(module, in, out);
+		REQUIRE(vm.IsTranslated());
+		REQUIRE_FALSE(vm.Run().has_value());
+		REQUIRE(out.str() == expected);
+
+		std::size_t size = module.start.size();
+		for (auto& f : module.functions)
+			size += f.code.size();
+		REQUIRE(vm.CodeSize() < size);
+	}
+}
+
+TEST_CASE("Untranslatable programs run on the stack machine.") {
+	// 循环体中声明的变量每次都会多占一个slot，栈深度不一致
+	auto program = compile(
+		"int main() {\n"
+		"	int i = 0;\n"
+		"	while (i < 3) {\n"
+		"		int t = i * 2;\n"
+		"		print(t);\n"
+		"		i = i + 1;\n"
+		"	}\n"
+		"	return 0;\n"
+		"}\n");
+	auto module = c0::moduleOf(program);
+	std::stringstream in, out;
+	c0::RegisterMachine vm(module, in, out);
+	REQUIRE_FALSE(vm.IsTranslated());
+	REQUIRE_FALSE(vm.Run().has_value());
+	REQUIRE(out.str() == "0 \n2 \n4 \n");
+}
+
+TEST_CASE("The jit behaves the same as the interpreter.") {
+	for (int32_t level = 0; level <= c0::Optimizer::MaxLevel; level++) {
+		auto program = compile(sample);
+		c0::Optimizer(program).Run(c0::Optimizer::PassesOf(level));
+		auto module = c0::moduleOf(program);
+		std::stringstream in("42"), out;
+		c0::RegisterMachine vm(module, in, out);
+		REQUIRE(vm.IsTranslated());
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+		REQUIRE(vm.EnableJit());
+#else
+		REQUIRE_FALSE(vm.EnableJit());
+#endif
+		REQUIRE_FALSE(vm.Run().has_value());
+		REQUIRE(out.str() == expected);
+	}
+
+	// 出错的位置与解释器一致
+	auto program = compile(
+		"int f(int n) { return 100 / n + f(n - 1); }\n"
+		"int main() {\n"
+		"	print(f(3));\n"
+		"	return 0;\n"
+		"}\n");
+	c0::Optimizer(program).Optimize();
+	auto module = c0::moduleOf(program);
+	std::stringstream in, out, jitOut;
+	c0::RegisterMachine interpreter(module, in, out), jit(module, in, jitOut);
+	jit.EnableJit();
+	auto expectedErr = interpreter.Run(), err = jit.Run();
+	REQUIRE(expectedErr.has_value());
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::ErrDivideByZero);
+	REQUIRE(err->function == expectedErr->function);
+	REQUIRE(err->ip == expectedErr->ip);
+}
+
+TEST_CASE("Tiered execution promotes hot code.") {
+	auto program = compile(
+		"int square(int x) { return x * x; }\n"
+		"int main() {\n"
+		"	int i = 0;\n"
+		"	int s = 0;\n"
+		"	while (i < 2000) {\n"
+		"		s = s + square(i) / 7;\n"
+		"		i = i + 1;\n"
+		"	}\n"
+		"	print(s);\n"
+		"	return 0;\n"
+		"}\n");
+	c0::Optimizer(program).Optimize();
+	auto module = c0::moduleOf(program);
+	std::stringstream in, out;
+	c0::VirtualMachine reference(module, in, out);
+	REQUIRE_FALSE(reference.Run().has_value());
+
+	std::stringstream tieredOut;
+	c0::RegisterMachine vm(module, in, tieredOut);
+	REQUIRE(vm.IsTranslated());
+	// 只有不支持 JIT 的平台才跳过
+	if (!c0::RegisterMachine::IsJitSupported()) {
+		REQUIRE_FALSE(vm.EnableTiering());
+		return;
+	}
+	REQUIRE(vm.EnableTiering());
+	vm.SetTierThresholds(10, 10);
+	REQUIRE_FALSE(vm.Run().has_value());
+	REQUIRE(tieredOut.str() == out.str());
+	// 第一次 Run 结束时编译已经完成，计数也保留了下来，循环从一开始就换成机器码
+	REQUIRE(vm.IsJitEnabled());
+	tieredOut.str("");
+	REQUIRE_FALSE(vm.Run().has_value());
+	REQUIRE(tieredOut.str() == out.str());
+	REQUIRE(vm.GetNativeEntries() > 0);
+	REQUIRE(vm.GetDispatches() < 2000);
+}
+
+TEST_CASE("Verified code runs without per-instruction checks.") {
+	auto program = compile(sample);
+	c0::Optimizer(program).Optimize();
+	auto module = c0::moduleOf(program);
+	c0::Verifier verifier(module);
+	REQUIRE_FALSE(verifier.Verify().has_value());
+	// fact(n - 1) 执行时栈上有 n、n 和 n - 1
+	REQUIRE(verifier.MaxDepthOf(0) >= 3);
+	std::stringstream in("42"), out;
+	c0::VirtualMachine vm(module, in, out);
+	REQUIRE_FALSE(vm.Run().has_value());
+	REQUIRE(vm.IsVerified());
+	REQUIRE(out.str() == expected);
+
+	// 栈帧在调用时一次预留，无限递归仍然报告栈溢出
+	program = compile(
+		"int f(int n) { return f(n + 1) + 1; }\n"
+		"int main() {\n"
+		"	print(f(0));\n"
+		"	return 0;\n"
+		"}\n");
+	auto deep = c0::moduleOf(program);
+	c0::VirtualMachine overflow(deep, in, out);
+	auto err = overflow.Run();
+	REQUIRE(overflow.IsVerified());
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::ErrStackOverflow);
+}
+
+TEST_CASE("The verifier rejects malformed code.") {
+	const auto verify = [](std::vector<c0::Instruction> code, int32_t params = 0) {
+		c0::Module module;
+		module.consts = {std::string("main"), std::string("f")};
+		module.functions.push_back({0, 0, 1, {c0::Instruction(c0::Operation::RET)}});
+		module.functions.push_back({1, params, 1, code});
+		return c0::Verifier(module).Verify();
+	};
+	using c0::Instruction;
+	using c0::Operation;
+	REQUIRE_FALSE(verify({Instruction(Operation::LOADA, 0, 0), Instruction(Operation::ILOAD), Instruction(Operation::IRET)}, 1).has_value());
+
+	auto err = verify({Instruction(Operation::IPUSH, 1), Instruction(Operation::IPUSH, 2), Instruction(Operation::DPRINT)});
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::VerifyTypeMismatch);
+	REQUIRE(err->function == 1);
+	REQUIRE(err->ip == 2);
+
+	// 循环每次多压一个值
+	err = verify({Instruction(Operation::IPUSH, 1), Instruction(Operation::JMP, 0)});
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::VerifyStackMismatch);
+
+	err = verify({Instruction(Operation::POP)});
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::VerifyStackUnderflow);
+
+	err = verify({Instruction(Operation::JMP, 5)});
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::VerifyInvalidJump);
+
+	// 地址只能是栈帧中已有的slot
+	err = verify({Instruction(Operation::LOADA, 0, 1), Instruction(Operation::ILOAD), Instruction(Operation::IRET)}, 1);
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::VerifyInvalidAddress);
+	err = verify({Instruction(Operation::IPUSH, 0), Instruction(Operation::ILOAD), Instruction(Operation::IRET)});
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::VerifyInvalidAddress);
+
+	err = verify({Instruction(Operation::IPUSH, 0), Instruction(Operation::IRET), Instruction(Operation::RET)});
+	REQUIRE(err.has_value());
+	REQUIRE(err->code == c0::VerifyInvalidReturn);
+
+	// 没有通过检查的代码仍然逐条检查
+	c0::Module module;
+	module.consts = {std::string("main")};
+	module.functions.push_back({0, 0, 1, {Instruction(Operation::POP)}});
+	std::stringstream in, out;
+	c0::VirtualMachine vm(module, in, out);
+	auto runtime = vm.Run();
+	REQUIRE_FALSE(vm.IsVerified());
+	REQUIRE(runtime.has_value());
+	REQUIRE(runtime->code == c0::ErrStackUnderflow);
+}
+
+TEST_CASE("Variable addresses are resolved when loaded.") {
+	using c0::Instruction;
+	using c0::Operation;
+	// 跳回的目标是 LOADA 之后的 ILOAD，这一对不能在载入时合并
+	c0::Module module;
+	module.consts = {std::string("main")};
+	module.start = {Instruction(Operation::IPUSH, 7)};
+	module.functions.push_back({0, 0, 1, {
+		Instruction(Operation::IPUSH, 3),
+		Instruction(Operation::LOADA, 1, 0),
+		Instruction(Operation::ILOAD),
+		Instruction(Operation::IPRINT),
+		Instruction(Operation::LOADA, 0, 0),
+		Instruction(Operation::LOADA, 0, 0),
+		Instruction(Operation::ILOAD),
+		Instruction(Operation::IPUSH, 1),
+		Instruction(Operation::ISUB),
+		Instruction(Operation::ISTORE),
+		Instruction(Operation::LOADA, 0, 0),
+		Instruction(Operation::ILOAD),
+		Instruction(Operation::JE, 15),
+		Instruction(Operation::LOADA, 1, 0),
+		Instruction(Operation::JMP, 2),
+		Instruction(Operation::RET),
+	}});
+	REQUIRE_FALSE(c0::Verifier(module).Verify().has_value());
+	std::stringstream in, out;
+	c0::VirtualMachine vm(module, in, out);
+	REQUIRE_FALSE(vm.Run().has_value());
+	REQUIRE(vm.IsVerified());
+	REQUIRE(out.str() == "777");
+
+	// 没有合并超级指令时，全局变量和局部变量都通过 LOADA 访问
+	auto program = compile(sample);
+	auto plain = c0::moduleOf(program);
+	std::stringstream in2("42"), out2;
+	c0::VirtualMachine verified(plain, in2, out2);
+	REQUIRE_FALSE(verified.Run().has_value());
+	REQUIRE(verified.IsVerified());
+	REQUIRE(out2.str() == expected);
+}
+
+TEST_CASE("64-bit slots behave the same.") {
+	auto program = compile(sample);
+	for (int pass = 0; pass < 3; pass++) {
+		if (pass == 1)
+			c0::Optimizer(program).Optimize();
+		else if (pass == 2)
+			c0::fuseInstructions(program);
+		auto module = c0::moduleOf(program);
+		for (auto mode : {c0::SwitchDispatch, c0::ThreadedDispatch}) {
+			std::stringstream in("42"), out;
+			c0::VirtualMachine vm(module, in, out);
+			vm.SetDispatch(mode);
+			vm.SetSlotWidth(c0::WideSlots);
+			REQUIRE_FALSE(vm.Run().has_value());
+			REQUIRE(vm.IsWide());
+			REQUIRE(out.str() == expected);
+		}
+	}
+
+	// 两个 int 实参被当作一个 double 形参读取，只能使用 32 位slot
+	using c0::Instruction;
+	using c0::Operation;
+	c0::Module module;
+	module.consts = {std::string("main"), std::string("f")};
+	module.functions.push_back({0, 0, 1, {
+		Instruction(Operation::IPUSH, 0),
+		Instruction(Operation::IPUSH, 0x3ff00000),
+		Instruction(Operation::CALL, 1),
+		Instruction(Operation::RET),
+	}});
+	module.functions.push_back({1, 2, 1, {
+		Instruction(Operation::LOADA, 0, 0),
+		Instruction(Operation::DLOAD),
+		Instruction(Operation::DPRINT),
+		Instruction(Operation::RET),
+	}});
+	c0::Verifier verifier(module);
+	REQUIRE_FALSE(verifier.Verify().has_value());
+	REQUIRE_FALSE(verifier.IsTyped());
+	std::stringstream in, out;
+	c0::VirtualMachine vm(module, in, out);
+	vm.SetSlotWidth(c0::WideSlots);
+	REQUIRE_FALSE(vm.Run().has_value());
+	REQUIRE(vm.IsVerified());
+	REQUIRE_FALSE(vm.IsWide());
+	REQUIRE(out.str() == "1.000000");
+}
+
+TEST_CASE("Emitted C behaves the same as the vm.") {
+	// 能翻译成寄存器指令的程序和只能按栈帧数组生成的程序
+	const std::string programs[] = {
+		sample,
+		"int main() {\n"
+		"	int i = 0;\n"
+		"	while (i < 3) {\n"
+		"		int t = i * 2;\n"
+		"		print(t);\n"
+		"		i = i + 1;\n"
+		"	}\n"
+		"	scan(i);\n"
+		"	print(i);\n"
+		"	return 0;\n"
+		"}\n",
+	};
+	for (auto& source : programs) {
+		for (int32_t level : {0, c0::Optimizer::MaxLevel}) {
+			auto program = compile(source);
+			c0::Optimizer(program).Run(c0::Optimizer::PassesOf(level));
+			std::stringstream c;
+			c0::writeCSource(c0::moduleOf(program), c);
+			REQUIRE(c.str().find("int main(void)") != std::string::npos);
+#if defined(__unix__) || defined(__APPLE__)
+			// 只在有系统 C 编译器时编译执行
+			if (std::system("cc --version > /dev/null 2>&1") != 0)
+				continue;
+			// 每次使用单独的临时目录，失败时也会删除，并行执行的测试不会互相覆盖
+			TemporaryDirectory dir;
+			const auto path = [&](const char* name) { return (dir.path / name).string(); };
+			std::ofstream(path("emit.c")) << c.str();
+			std::ofstream(path("emit.in")) << "42";
+			const auto command = "cc -O1 \"" + path("emit.c") + "\" -o \"" + path("emit.bin") + "\" && \"" + path("emit.bin")
+				+ "\" < \"" + path("emit.in") + "\" > \"" + path("emit.out") + "\"";
+			REQUIRE(std::system(command.c_str()) == 0);
+			std::ifstream result(path("emit.out"));
+			std::stringstream native;
+			native << result.rdbuf();
+			result.close();
+			REQUIRE(native.str() == run(program, "42"));
+#endif
+		}
+	}
+}
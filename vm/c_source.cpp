@@ -0,0 +1,955 @@
+#include "vm.h"
+#include "register_vm.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <sstream>
+#include <string>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using uint64_t = std::uint64_t;
+
+		// 生成的 C 文件开头的运行时，与 VirtualMachine 的行为一致
+		const char* const Runtime =
+			"#include <stdint.h>\n"
+			"#include <stdio.h>\n"
+			"#include <stdlib.h>\n"
+			"#include <string.h>\n"
+			"\n"
+			"#if (defined(__unix__) || defined(__APPLE__)) && !defined(C0_NO_THREAD)\n"
+			"#include <pthread.h>\n"
+			"#define C0_THREAD\n"
+			"#endif\n"
+			"\n"
+			"#define C0_STACK_SIZE 1048576\n"
+			"#define C0_MAX_DEPTH 2097152\n"
+			"#define C0_MACHINE_STACK ((size_t)256 << 20)\n"
+			"#define C0_END (c0_stack + C0_STACK_SIZE)\n"
+			"\n"
+			"static int32_t c0_stack[C0_STACK_SIZE];\n"
+			"static int32_t c0_depth;\n"
+			"\n"
+			"static void c0_fail(int code, int function, int ip) {\n"
+			"\tstatic const char* const messages[] = {\n"
+			"\t\t\"Stack overflow.\", \"Pop from an empty stack.\", \"Access to unused stack memory.\", \"Divide by zero.\",\n"
+			"\t\t\"Invalid constant index.\", \"Invalid function index.\", \"Illegal instruction.\", \"The program has no main function.\",\n"
+			"\t\t\"Failed to read the input.\", \"Step limit exceeded.\",\n"
+			"\t};\n"
+			"\tfflush(stdout);\n"
+			"\tif (function < 0)\n"
+			"\t\tfprintf(stderr, \"Runtime error: Start code Offset: %d Error: %s\\n\", ip, messages[code]);\n"
+			"\telse\n"
+			"\t\tfprintf(stderr, \"Runtime error: Function: %d Offset: %d Error: %s\\n\", function, ip, messages[code]);\n"
+			"\texit(1);\n"
+			"}\n"
+			"\n"
+			"static inline double c0_ld(const int32_t* p) {\n"
+			"\tdouble d;\n"
+			"\tmemcpy(&d, p, sizeof d);\n"
+			"\treturn d;\n"
+			"}\n"
+			"\n"
+			"static inline void c0_sd(int32_t* p, double d) {\n"
+			"\tmemcpy(p, &d, sizeof d);\n"
+			"}\n"
+			"\n"
+			"static inline void c0_bits(int32_t* p, uint64_t bits) {\n"
+			"\tmemcpy(p, &bits, sizeof bits);\n"
+			"}\n"
+			"\n"
+			"static inline uint64_t c0_word(const int32_t* p) {\n"
+			"\tuint64_t bits;\n"
+			"\tmemcpy(&bits, p, sizeof bits);\n"
+			"\treturn bits;\n"
+			"}\n"
+			"\n"
+			"static inline double c0_double(uint64_t bits) {\n"
+			"\tdouble d;\n"
+			"\tmemcpy(&d, &bits, sizeof d);\n"
+			"\treturn d;\n"
+			"}\n"
+			"\n"
+			"static inline int c0_scan_int(int32_t* p) {\n"
+			"\treturn scanf(\"%d\", p) == 1;\n"
+			"}\n"
+			"\n"
+			"static inline int c0_scan_double(int32_t* p) {\n"
+			"\tdouble d;\n"
+			"\tif (scanf(\"%lf\", &d) != 1)\n"
+			"\t\treturn 0;\n"
+			"\tc0_sd(p, d);\n"
+			"\treturn 1;\n"
+			"}\n"
+			"\n"
+			"static inline int c0_scan_char(int32_t* p) {\n"
+			"\tchar c;\n"
+			"\tif (scanf(\" %c\", &c) != 1)\n"
+			"\t\treturn 0;\n"
+			"\t*p = (uint8_t)c;\n"
+			"\treturn 1;\n"
+			"}\n"
+			"\n";
+
+		// 指令对栈的影响，valid 为 false 的指令执行时一定出错
+		struct Effect {
+			int32_t pops;
+			int32_t pushes;
+			bool valid;
+		};
+
+		bool isJump(Operation op) {
+			return (op >= Operation::JMP && op <= Operation::JLE) || (op >= Operation::ICMPJE && op <= Operation::ICMPJLE);
+		}
+
+		bool isReturn(Operation op) {
+			return op >= Operation::RET && op <= Operation::ARET;
+		}
+
+		// 执行完不会落到下一条指令
+		bool isTerminator(Operation op) {
+			return op == Operation::JMP || isReturn(op);
+		}
+
+		std::string literal(int32_t value) {
+			if (value == std::numeric_limits<int32_t>::min())
+				return "(-2147483647 - 1)";
+			return std::to_string(value);
+		}
+
+		// 用八进制转义所有非字母数字的字符，避免十六进制转义和三字符组的歧义
+		std::string quote(const std::string& str) {
+			std::string result = "\"";
+			for (unsigned char ch : str) {
+				if (std::isalnum(ch) || ch == ' ' || ch == '_' || ch == ',' || ch == '.' || ch == ':' || ch == '=')
+					result += (char)ch;
+				else {
+					char buffer[8];
+					std::snprintf(buffer, sizeof buffer, "\\%03o", ch);
+					result += buffer;
+				}
+			}
+			return result + "\"";
+		}
+
+		void writeStrings(const Module& module, std::ostream& out) {
+			out << "static const struct {\n\tconst char* text;\n\tint length;\n} c0_strings[] = {\n";
+			for (auto& c : module.consts) {
+				if (std::holds_alternative<std::string>(c)) {
+					auto& str = std::get<std::string>(c);
+					out << "\t{" << quote(str) << ", " << str.size() << "},\n";
+				}
+				else
+					out << "\t{NULL, 0},\n";
+			}
+			// 常量表为空时 C 不允许空的初始化列表
+			out << "\t{NULL, 0},\n};\n\n";
+			out << "static inline void c0_print_string(int32_t index, int function, int ip) {\n"
+				"\tif (index < 0 || index >= " << module.consts.size() << " || c0_strings[index].text == NULL)\n"
+				"\t\tc0_fail(" << ErrInvalidConstant << ", function, ip);\n"
+				"\tfwrite(c0_strings[index].text, 1, c0_strings[index].length, stdout);\n"
+				"}\n\n";
+		}
+
+		// 函数名作为注释写在声明后面
+		std::string commentOf(const Module& module, int32_t function) {
+			auto name = module.functions[function].name;
+			if (name < 0 || name >= (int32_t)module.consts.size() || !std::holds_alternative<std::string>(module.consts[name]))
+				return "";
+			auto quoted = quote(std::get<std::string>(module.consts[name]));
+			return " /* " + quoted.substr(1, quoted.size() - 2) + " */";
+		}
+
+		// 在 c0_run 中执行 body，递归的深度只受 c0 的栈限制，在有足够大机器栈的线程中执行
+		void writeMain(std::ostream& out, const std::string& body) {
+			out << "static void* c0_run(void* unused) {\n\t(void)unused;\n\t(void)c0_stack;\n" << body << "\treturn NULL;\n}\n\n";
+			out << "int main(void) {\n"
+				"#ifdef C0_THREAD\n"
+				"\tpthread_attr_t attr;\n"
+				"\tpthread_t thread;\n"
+				"\tif (pthread_attr_init(&attr) == 0 && pthread_attr_setstacksize(&attr, C0_MACHINE_STACK) == 0\n"
+				"\t\t&& pthread_create(&thread, &attr, c0_run, NULL) == 0)\n"
+				"\t\tpthread_join(thread, NULL);\n"
+				"\telse\n"
+				"#endif\n"
+				"\t\tc0_run(NULL);\n"
+				"\tfflush(stdout);\n"
+				"\treturn 0;\n"
+				"}\n";
+		}
+
+		// 把 Module 翻译成一个 C 文件，每个函数对应一个 C 函数
+		// 所有栈帧仍在一个 int32_t 数组中，地址就是数组下标，和虚拟机相同
+		// 每条指令处栈深度都确定的函数用常数偏移访问栈帧（fp[k]），否则用运行时的栈顶指针 sp
+		class Writer final {
+		public:
+			Writer(const Module& module, std::ostream& out) : _module(module), _out(out), _widths() {}
+			Writer(const Writer&) = delete;
+			Writer& operator=(const Writer&) = delete;
+
+			void Write();
+		private:
+			const std::vector<Instruction>& codeOf(int32_t function) const;
+			bool isFunction(int32_t function) const { return function >= 0 && function < (int32_t)_module.functions.size(); }
+			Effect effectOf(const Instruction& ins) const;
+			// 函数返回值的slot数，各处返回的不一致时为 -1
+			int32_t widthOf(int32_t function) const;
+			// 每条指令执行前的栈深度，不可达的为 -1；深度不一致时返回空
+			std::optional<std::vector<int32_t> > depthsOf(int32_t function) const;
+			void writeFunction(int32_t function);
+
+		private:
+			const Module& _module;
+			std::ostream& _out;
+			std::vector<int32_t> _widths;
+		};
+
+		const std::vector<Instruction>& Writer::codeOf(int32_t function) const {
+			return function < 0 ? _module.start : _module.functions[function].code;
+		}
+
+		Effect Writer::effectOf(const Instruction& ins) const {
+			const int32_t x = ins.GetX();
+			switch (ins.GetOperation()) {
+				case Operation::NOP: case Operation::JMP: case Operation::PRINTL: case Operation::IINC:
+					return {0, 0, true};
+				case Operation::BIPUSH: case Operation::IPUSH: case Operation::LOADA:
+				case Operation::ISCAN: case Operation::CSCAN: case Operation::ILOADL: case Operation::ILOADG:
+					return {0, 1, true};
+				case Operation::DSCAN: case Operation::DLOADL: case Operation::DLOADG:
+					return {0, 2, true};
+				case Operation::POP: case Operation::IPRINT: case Operation::CPRINT: case Operation::SPRINT:
+				case Operation::JE: case Operation::JNE: case Operation::JL: case Operation::JGE: case Operation::JG: case Operation::JLE:
+				case Operation::ISTOREL: case Operation::ISTOREG:
+					return {1, 0, true};
+				case Operation::POP2: case Operation::DPRINT: case Operation::DSTOREL: case Operation::DSTOREG:
+				case Operation::ICMPJE: case Operation::ICMPJNE: case Operation::ICMPJL: case Operation::ICMPJGE: case Operation::ICMPJG: case Operation::ICMPJLE:
+					return {2, 0, true};
+				case Operation::POPN:
+					return {x, 0, x >= 0};
+				case Operation::SNEW:
+					return {0, x, x >= 0};
+				case Operation::DUP:
+					return {1, 2, true};
+				case Operation::DUP2:
+					return {2, 4, true};
+				case Operation::LOADC:
+					if (x < 0 || x >= (int32_t)_module.consts.size())
+						return {0, 0, false};
+					return {0, std::holds_alternative<double>(_module.consts[x]) ? 2 : 1, true};
+				case Operation::ILOAD: case Operation::INEG: case Operation::I2C:
+					return {1, 1, true};
+				case Operation::DLOAD: case Operation::I2D:
+					return {1, 2, true};
+				case Operation::ISTORE:
+					return {2, 0, true};
+				case Operation::DSTORE:
+					return {3, 0, true};
+				case Operation::IADD: case Operation::ISUB: case Operation::IMUL: case Operation::IDIV: case Operation::ICMP:
+					return {2, 1, true};
+				case Operation::DADD: case Operation::DSUB: case Operation::DMUL: case Operation::DDIV:
+					return {4, 2, true};
+				case Operation::DNEG:
+					return {2, 2, true};
+				case Operation::DCMP:
+					return {4, 1, true};
+				case Operation::D2I:
+					return {2, 1, true};
+				case Operation::CALL:
+					if (!isFunction(x))
+						return {0, 0, false};
+					// 返回值宽度不确定时 pushes 为 -1，只能用运行时的栈顶
+					return {_module.functions[x].params, _widths[x], true};
+				case Operation::RET:
+					return {0, 0, true};
+				case Operation::IRET: case Operation::ARET:
+					return {1, 0, true};
+				case Operation::DRET:
+					return {2, 0, true};
+				default:
+					return {0, 0, false};
+			}
+		}
+
+		int32_t Writer::widthOf(int32_t function) const {
+			auto& code = codeOf(function);
+			const int32_t size = code.size();
+			// 执行到末尾时按 RET 返回
+			int32_t width = code.empty() || !isTerminator(code.back().GetOperation()) ? 0 : -2;
+			for (auto& ins : code) {
+				auto op = ins.GetOperation();
+				int32_t w = -2;
+				if (isReturn(op))
+					w = op == Operation::RET ? 0 : op == Operation::DRET ? 2 : 1;
+				else if (isJump(op) && (ins.GetX() < 0 || ins.GetX() >= size))
+					w = 0;
+				if (w == -2)
+					continue;
+				if (width != -2 && width != w)
+					return -1;
+				width = w;
+			}
+			return std::max(width, 0);
+		}
+
+		std::optional<std::vector<int32_t> > Writer::depthsOf(int32_t function) const {
+			auto& code = codeOf(function);
+			const int32_t size = code.size();
+			std::vector<int32_t> depths(size + 1, -1);
+			std::vector<int32_t> work{0};
+			depths[0] = function < 0 ? 0 : _module.functions[function].params;
+			const auto reach = [&](int32_t target, int32_t depth) {
+				if (target < 0 || target > size)
+					target = size;
+				if (depths[target] == -1) {
+					depths[target] = depth;
+					work.push_back(target);
+				}
+				return depths[target] == depth;
+			};
+			while (!work.empty()) {
+				const int32_t i = work.back();
+				work.pop_back();
+				if (i == size)
+					continue;
+				auto& ins = code[i];
+				auto op = ins.GetOperation();
+				auto effect = effectOf(ins);
+				if (!effect.valid)
+					continue;
+				if (depths[i] < effect.pops || effect.pushes < 0)
+					return {};
+				const int32_t depth = depths[i] - effect.pops + effect.pushes;
+				if (isJump(op) && !reach(ins.GetX(), depth))
+					return {};
+				if (!isTerminator(op) && !reach(i + 1, depth))
+					return {};
+			}
+			return depths;
+		}
+
+		void Writer::writeFunction(int32_t function) {
+			auto& code = codeOf(function);
+			const int32_t size = code.size();
+			const auto depths = depthsOf(function);
+			// 静态深度下 depth 是当前指令执行前的栈深度
+			const bool fixed = depths.has_value();
+			int32_t depth = 0;
+			const auto at = [&](int32_t offset) {
+				return fixed ? "fp[" + std::to_string(depth + offset) + "]" : "sp[" + std::to_string(offset) + "]";
+			};
+			const auto ptr = [&](int32_t offset) {
+				return fixed ? "fp + " + std::to_string(depth + offset) : "sp + " + std::to_string(offset);
+			};
+			const auto fail = [&](RuntimeErrorCode code, int32_t ip) {
+				return "c0_fail(" + std::to_string(code) + ", " + std::to_string(function) + ", " + std::to_string(ip) + ");";
+			};
+			// 检查单独占一行
+			const auto guard = [&](const std::string& condition, RuntimeErrorCode code, int32_t ip) {
+				return "if (" + condition + ")\n\t\t" + fail(code, ip) + "\n\t";
+			};
+			const auto label = [&](int32_t target) {
+				return "L" + std::to_string(target < 0 || target > size ? size : target);
+			};
+
+			// 只为用到的跳转目标生成标号
+			std::set<int32_t> targets;
+			bool end = !fixed || (*depths)[size] != -1;
+			for (int32_t i = 0; i < size; i++)
+				if (isJump(code[i].GetOperation()) && (!fixed || (*depths)[i] != -1))
+					targets.insert(code[i].GetX() < 0 || code[i].GetX() > size ? size : code[i].GetX());
+
+			_out << "static int32_t c0_" << (function < 0 ? std::string("start") : "f" + std::to_string(function)) << "(int32_t* fp) {\n";
+			if (fixed) {
+				int32_t max = 0;
+				for (int32_t i = 0; i <= size; i++)
+					if ((*depths)[i] != -1) {
+						auto effect = i < size ? effectOf(code[i]) : Effect{0, 0, true};
+						max = std::max({max, (*depths)[i], (*depths)[i] - effect.pops + effect.pushes});
+					}
+				_out << "\tif (fp + " << max << " > C0_END || ++c0_depth > C0_MAX_DEPTH)\n\t\t" << fail(ErrStackOverflow, 0) << "\n";
+			}
+			else {
+				_out << "\tint32_t* sp = fp + " << (function < 0 ? 0 : _module.functions[function].params) << ";\n";
+				_out << "\tif (++c0_depth > C0_MAX_DEPTH)\n\t\t" << fail(ErrStackOverflow, 0) << "\n";
+			}
+
+			for (int32_t i = 0; i < size; i++) {
+				if (targets.count(i))
+					_out << label(i) << ":\n";
+				if (fixed && (*depths)[i] == -1)
+					continue;
+				depth = fixed ? (*depths)[i] : 0;
+				auto& ins = code[i];
+				const auto op = ins.GetOperation();
+				const int32_t x = ins.GetX(), y = ins.GetOpt();
+				const auto effect = effectOf(ins);
+				const int32_t delta = effect.pushes - effect.pops;
+				std::string s;
+				// 动态深度时压栈前检查空间
+				if (!fixed && delta > 0)
+					s += guard("sp + " + std::to_string(delta) + " > C0_END", ErrStackOverflow, i);
+				switch (op) {
+					case Operation::NOP:
+					case Operation::POP:
+					case Operation::POP2:
+					case Operation::POPN:
+						break;
+					case Operation::BIPUSH:
+					case Operation::IPUSH:
+						s += at(0) + " = " + literal(x) + ";";
+						break;
+					case Operation::DUP:
+						s += at(0) + " = " + at(-1) + ";";
+						break;
+					case Operation::DUP2:
+						s += at(0) + " = " + at(-2) + "; " + at(1) + " = " + at(-1) + ";";
+						break;
+					case Operation::LOADC: {
+						if (!effect.valid) {
+							s += fail(ErrInvalidConstant, i);
+							break;
+						}
+						auto& c = _module.consts[x];
+						if (std::holds_alternative<double>(c)) {
+							const double d = std::get<double>(c);
+							uint64_t bits;
+							std::memcpy(&bits, &d, sizeof bits);
+							char buffer[32];
+							std::snprintf(buffer, sizeof buffer, "0x%016llx", (unsigned long long)bits);
+							s += "c0_bits(" + ptr(0) + ", UINT64_C(" + buffer + "));";
+						}
+						else
+							s += at(0) + " = " + literal(std::holds_alternative<int32_t>(c) ? std::get<int32_t>(c) : x) + ";";
+						break;
+					}
+					case Operation::LOADA:
+						s += at(0) + " = " + (x == 0 ? "(int32_t)(fp - c0_stack) + " : "") + literal(y) + ";";
+						break;
+					case Operation::SNEW:
+						s += "memset(" + ptr(0) + ", 0, " + std::to_string(x) + " * sizeof(int32_t));";
+						break;
+					case Operation::ILOAD:
+						s += at(-1) + " = c0_stack[" + at(-1) + "];";
+						break;
+					case Operation::DLOAD:
+						s += "{ int32_t a = " + at(-1) + "; " + at(-1) + " = c0_stack[a]; " + at(0) + " = c0_stack[a + 1]; }";
+						break;
+					case Operation::ISTORE:
+						s += "c0_stack[" + at(-2) + "] = " + at(-1) + ";";
+						break;
+					case Operation::DSTORE:
+						s += "{ int32_t a = " + at(-3) + "; c0_stack[a] = " + at(-2) + "; c0_stack[a + 1] = " + at(-1) + "; }";
+						break;
+					case Operation::IADD:
+					case Operation::ISUB:
+					case Operation::IMUL: {
+						const char* sign = op == Operation::IADD ? " + " : op == Operation::ISUB ? " - " : " * ";
+						s += at(-2) + " = (int32_t)((uint32_t)" + at(-2) + sign + "(uint32_t)" + at(-1) + ");";
+						break;
+					}
+					case Operation::IDIV:
+						if (y == NoOverflow)
+							s += at(-2) + " = " + at(-2) + " / " + at(-1) + ";";
+						else
+							s += guard(at(-1) + " == 0", ErrDivideByZero, i)
+								+ at(-2) + " = " + at(-1) + " == -1 ? (int32_t)(0u - (uint32_t)" + at(-2) + ") : " + at(-2) + " / " + at(-1) + ";";
+						break;
+					case Operation::INEG:
+						s += at(-1) + " = (int32_t)(0u - (uint32_t)" + at(-1) + ");";
+						break;
+					case Operation::ICMP:
+						s += at(-2) + " = (" + at(-2) + " > " + at(-1) + ") - (" + at(-2) + " < " + at(-1) + ");";
+						break;
+					case Operation::DADD:
+					case Operation::DSUB:
+					case Operation::DMUL:
+					case Operation::DDIV: {
+						const char* sign = op == Operation::DADD ? " + " : op == Operation::DSUB ? " - " : op == Operation::DMUL ? " * " : " / ";
+						if (op == Operation::DDIV)
+							s += guard("c0_ld(" + ptr(-2) + ") == 0", ErrDivideByZero, i);
+						s += "c0_sd(" + ptr(-4) + ", c0_ld(" + ptr(-4) + ")" + sign + "c0_ld(" + ptr(-2) + "));";
+						break;
+					}
+					case Operation::DNEG:
+						s += "c0_sd(" + ptr(-2) + ", -c0_ld(" + ptr(-2) + "));";
+						break;
+					case Operation::DCMP:
+						s += "{ double l = c0_ld(" + ptr(-4) + "), r = c0_ld(" + ptr(-2) + "); " + at(-4) + " = (l > r) - (l < r); }";
+						break;
+					case Operation::I2D:
+						s += "c0_sd(" + ptr(-1) + ", (double)" + at(-1) + ");";
+						break;
+					case Operation::D2I:
+						s += at(-2) + " = (int32_t)c0_ld(" + ptr(-2) + ");";
+						break;
+					case Operation::I2C:
+						s += at(-1) + " = (uint8_t)" + at(-1) + ";";
+						break;
+					case Operation::CALL:
+						if (!effect.valid)
+							s += fail(ErrInvalidFunction, i);
+						else if (fixed)
+							s += "c0_f" + std::to_string(x) + "(" + ptr(-effect.pops) + ");";
+						else
+							s += "{ int32_t* b = " + ptr(-effect.pops) + "; sp = b + c0_f" + std::to_string(x) + "(b); }";
+						break;
+					case Operation::IPRINT:
+						s += "printf(\"%d\", " + at(-1) + ");";
+						break;
+					case Operation::DPRINT:
+						s += "printf(\"%f\", c0_ld(" + ptr(-2) + "));";
+						break;
+					case Operation::CPRINT:
+						s += "putchar((char)" + at(-1) + ");";
+						break;
+					case Operation::SPRINT:
+						s += "c0_print_string(" + at(-1) + ", " + std::to_string(function) + ", " + std::to_string(i) + ");";
+						break;
+					case Operation::PRINTL:
+						s += "putchar('\\n');";
+						break;
+					case Operation::ISCAN:
+					case Operation::DSCAN:
+					case Operation::CSCAN: {
+						const char* scan = op == Operation::ISCAN ? "c0_scan_int(" : op == Operation::DSCAN ? "c0_scan_double(" : "c0_scan_char(";
+						s += guard("!" + std::string(scan) + ptr(0) + ")", ErrReadFailed, i);
+						break;
+					}
+					case Operation::ILOADL:
+					case Operation::ILOADG:
+						s += at(0) + " = " + (op == Operation::ILOADL ? "fp[" : "c0_stack[") + literal(x) + "];";
+						break;
+					case Operation::DLOADL:
+					case Operation::DLOADG: {
+						const std::string base = op == Operation::DLOADL ? "fp[" : "c0_stack[";
+						s += at(0) + " = " + base + literal(x) + "]; " + at(1) + " = " + base + literal(x) + " + 1];";
+						break;
+					}
+					case Operation::ISTOREL:
+					case Operation::ISTOREG:
+						s += std::string(op == Operation::ISTOREL ? "fp[" : "c0_stack[") + literal(x) + "] = " + at(-1) + ";";
+						break;
+					case Operation::DSTOREL:
+					case Operation::DSTOREG: {
+						const std::string base = op == Operation::DSTOREL ? "fp[" : "c0_stack[";
+						s += base + literal(x) + "] = " + at(-2) + "; " + base + literal(x) + " + 1] = " + at(-1) + ";";
+						break;
+					}
+					case Operation::IINC:
+						s += "fp[" + literal(x) + "] = (int32_t)((uint32_t)fp[" + literal(x) + "] + (uint32_t)" + literal(y) + ");";
+						break;
+					default:
+						break;
+				}
+
+				// 跳转和返回要先取出栈顶的值再调整栈顶
+				std::string condition;
+				switch (op) {
+					case Operation::JE: condition = at(-1) + " == 0"; break;
+					case Operation::JNE: condition = at(-1) + " != 0"; break;
+					case Operation::JL: condition = at(-1) + " < 0"; break;
+					case Operation::JGE: condition = at(-1) + " >= 0"; break;
+					case Operation::JG: condition = at(-1) + " > 0"; break;
+					case Operation::JLE: condition = at(-1) + " <= 0"; break;
+					case Operation::ICMPJE: condition = at(-2) + " == " + at(-1); break;
+					case Operation::ICMPJNE: condition = at(-2) + " != " + at(-1); break;
+					case Operation::ICMPJL: condition = at(-2) + " < " + at(-1); break;
+					case Operation::ICMPJGE: condition = at(-2) + " >= " + at(-1); break;
+					case Operation::ICMPJG: condition = at(-2) + " > " + at(-1); break;
+					case Operation::ICMPJLE: condition = at(-2) + " <= " + at(-1); break;
+					default: break;
+				}
+				const std::string adjust = fixed || delta == 0 || op == Operation::CALL ? "" : "sp += " + std::to_string(delta) + "; ";
+				if (!effect.valid && op != Operation::LOADC && op != Operation::CALL)
+					s += fail(ErrIllegalInstruction, i);
+				else if (op == Operation::JMP)
+					s += "goto " + label(x) + ";";
+				else if (!condition.empty())
+					s += "{ const int taken = " + condition + "; " + adjust + "if (taken) goto " + label(x) + "; }";
+				else if (isReturn(op)) {
+					const int32_t width = effect.pops;
+					if (width == 1)
+						s += "fp[0] = " + at(-1) + "; ";
+					else if (width == 2)
+						s += "{ int32_t lo = " + at(-2) + ", hi = " + at(-1) + "; fp[0] = lo; fp[1] = hi; } ";
+					s += "c0_depth--; return " + std::to_string(width) + ";";
+				}
+				else
+					s += adjust;
+				while (!s.empty() && std::isspace((unsigned char)s.back()))
+					s.pop_back();
+				if (!s.empty())
+					_out << "\t" << s << "\n";
+			}
+
+			if (targets.count(size))
+				_out << label(size) << ":\n";
+			// 初始化代码执行完时栈上留下的是全局变量，函数执行到末尾时按 RET 返回
+			if (end) {
+				std::string width = function >= 0 ? "0" : fixed ? std::to_string((*depths)[size]) : "(int32_t)(sp - fp)";
+				_out << "\tc0_depth--;\n\treturn " << width << ";\n";
+			}
+			_out << "}\n\n";
+		}
+
+		void Writer::Write() {
+			const int32_t count = _module.functions.size();
+			for (int32_t i = 0; i < count; i++)
+				_widths.push_back(widthOf(i));
+			_out << Runtime;
+			writeStrings(_module, _out);
+
+			int32_t entry = -1;
+			for (int32_t i = 0; i < count; i++) {
+				auto name = _module.functions[i].name;
+				if (name >= 0 && name < (int32_t)_module.consts.size()
+					&& std::holds_alternative<std::string>(_module.consts[name]) && std::get<std::string>(_module.consts[name]) == "main")
+					entry = i;
+			}
+			// 只生成初始化代码和 main 能调用到的函数
+			std::vector<bool> used(count + 1, false);
+			std::vector<int32_t> work{-1};
+			used[0] = true;
+			if (entry != -1) {
+				used[entry + 1] = true;
+				work.push_back(entry);
+			}
+			while (!work.empty()) {
+				auto function = work.back();
+				work.pop_back();
+				for (auto& ins : codeOf(function)) {
+					const int32_t x = ins.GetX();
+					if (ins.GetOperation() == Operation::CALL && isFunction(x) && !used[x + 1]) {
+						used[x + 1] = true;
+						work.push_back(x);
+					}
+				}
+			}
+
+			_out << "static int32_t c0_start(int32_t* fp);\n";
+			for (int32_t i = 0; i < count; i++) {
+				if (!used[i + 1])
+					continue;
+				_out << "static int32_t c0_f" << i << "(int32_t* fp);" << commentOf(_module, i) << "\n";
+			}
+			_out << "\n";
+			for (int32_t i = -1; i < count; i++)
+				if (used[i + 1])
+					writeFunction(i);
+
+			std::string body = "\tint32_t globals = c0_start(c0_stack);\n";
+			if (entry == -1)
+				body += "\t(void)globals;\n\tc0_fail(" + std::to_string(ErrNoMainFunction) + ", -1, 0);\n";
+			else
+				body += "\tc0_f" + std::to_string(entry) + "(c0_stack + globals);\n";
+			writeMain(_out, body);
+		}
+	}
+
+	// 用寄存器指令生成 C 文件
+	// 寄存器指令的操作数都是常量偏移，地址不会作为值传递，所以栈帧可以是 C 函数的局部数组，
+	// 参数和返回值按slot传递，C 编译器可以把栈帧中的值放进寄存器
+	class RegisterMachine::CWriter final {
+	public:
+		CWriter(const RegisterMachine& machine, std::ostream& out) : _machine(machine), _out(out), _widths() {}
+		CWriter(const CWriter&) = delete;
+		CWriter& operator=(const CWriter&) = delete;
+
+		void Write();
+	private:
+		// 操作数第 offset 个slot的 C 表达式，初始化代码的栈帧就是全局变量
+		std::string slot(int32_t function, Operand o, int32_t offset = 0) const;
+		// 操作数中 double 的 C 表达式
+		std::string real(int32_t function, Operand o) const;
+		// 操作数中两个slot按内存顺序组成的 64 位值
+		std::string word(int32_t function, Operand o) const;
+		std::string signature(int32_t function) const;
+		void writeFunction(int32_t function);
+
+	private:
+		const RegisterMachine& _machine;
+		std::ostream& _out;
+		// 每个函数返回值的slot数
+		std::vector<int32_t> _widths;
+	};
+
+	std::string RegisterMachine::CWriter::slot(int32_t function, Operand o, int32_t offset) const {
+		const int32_t index = o.index + offset;
+		if (o.base == ConstantBase)
+			return literal(_machine._constants[index]);
+		if (o.base == GlobalBase || function < 0)
+			return "c0_stack[" + std::to_string(index) + "]";
+		return "r[" + std::to_string(index) + "]";
+	}
+
+	std::string RegisterMachine::CWriter::word(int32_t function, Operand o) const {
+		if (o.base != ConstantBase)
+			return "c0_word(&" + slot(function, o) + ")";
+		uint64_t bits;
+		std::memcpy(&bits, &_machine._constants[o.index], sizeof bits);
+		char buffer[32];
+		std::snprintf(buffer, sizeof buffer, "UINT64_C(0x%016llx)", (unsigned long long)bits);
+		return buffer;
+	}
+
+	std::string RegisterMachine::CWriter::real(int32_t function, Operand o) const {
+		if (o.base == ConstantBase)
+			return "c0_double(" + word(function, o) + ")";
+		return "c0_ld(&" + slot(function, o) + ")";
+	}
+
+	std::string RegisterMachine::CWriter::signature(int32_t function) const {
+		if (function < 0)
+			return "static void c0_start(void)";
+		const char* const types[] = {"void", "int32_t", "uint64_t"};
+		std::string s = "static " + std::string(types[_widths[function]]) + " c0_f" + std::to_string(function) + "(int32_t bp";
+		for (int32_t k = 0; k < _machine._functions[function + 1].params; k++)
+			s += ", int32_t p" + std::to_string(k);
+		return s + ")";
+	}
+
+	void RegisterMachine::CWriter::writeFunction(int32_t function) {
+		auto& f = _machine._functions[function + 1];
+		const int32_t size = f.code.size();
+		const auto fail = [&](RuntimeErrorCode code, int32_t ip) {
+			return "c0_fail(" + std::to_string(code) + ", " + std::to_string(function) + ", " + std::to_string(ip) + ");";
+		};
+		// 检查单独占一行
+		const auto guard = [&](const std::string& condition, RuntimeErrorCode code, int32_t ip) {
+			return "if (" + condition + ")\n\t\t" + fail(code, ip) + "\n\t";
+		};
+		const auto leave = [&](const std::string& value) {
+			return function < 0 ? std::string("return;") : "c0_depth--;\n\treturn" + value + ";";
+		};
+
+		std::set<int32_t> targets;
+		bool calls = false;
+		for (auto& ins : f.code) {
+			const auto op = (Op)ins.op;
+			if (op == Op::Jmp || (op >= Op::JE && op <= Op::DJLE))
+				targets.insert(ins.x);
+			calls = calls || op == Op::Call;
+		}
+
+		_out << signature(function) << " {\n";
+		if (function >= 0) {
+			if (f.frameSize > 0)
+				_out << "\tint32_t r[" << f.frameSize << "];\n\t(void)r;\n";
+			_out << "\tif (++c0_depth > C0_MAX_DEPTH)\n\t\t" << fail(ErrStackOverflow, 0) << "\n";
+			for (int32_t k = 0; k < f.params; k++)
+				_out << "\tr[" << k << "] = p" << k << ";\n";
+			if (!calls)
+				_out << "\t(void)bp;\n";
+		}
+
+		for (int32_t i = 0; i < size; i++) {
+			if (targets.count(i))
+				_out << "L" << i << ":\n";
+			auto& ins = f.code[i];
+			const auto op = (Op)ins.op;
+			const auto a = slot(function, ins.a), b = slot(function, ins.b), dst = slot(function, ins.dst);
+			const auto target = "goto L" + std::to_string(ins.x) + ";";
+			std::string s;
+			switch (op) {
+				case Op::Mov:
+					s = dst + " = " + a + ";";
+					break;
+				case Op::Mov2:
+					s = "{ int32_t lo = " + a + ", hi = " + slot(function, ins.a, 1) + "; " + dst + " = lo; " + slot(function, ins.dst, 1) + " = hi; }";
+					break;
+				case Op::IAdd:
+				case Op::ISub:
+				case Op::IMul: {
+					const char* sign = op == Op::IAdd ? " + " : op == Op::ISub ? " - " : " * ";
+					s = dst + " = (int32_t)((uint32_t)" + a + sign + "(uint32_t)" + b + ");";
+					break;
+				}
+				case Op::IDiv:
+					if (ins.x == NoOverflow)
+						s = dst + " = " + a + " / " + b + ";";
+					else
+						s = guard(b + " == 0", ErrDivideByZero, ins.origin)
+							+ "{ int32_t lhs = " + a + ", rhs = " + b + "; " + dst + " = rhs == -1 ? (int32_t)(0u - (uint32_t)lhs) : lhs / rhs; }";
+					break;
+				case Op::INeg:
+					s = dst + " = (int32_t)(0u - (uint32_t)" + a + ");";
+					break;
+				case Op::DAdd:
+				case Op::DSub:
+				case Op::DMul:
+				case Op::DDiv: {
+					const char* sign = op == Op::DAdd ? " + " : op == Op::DSub ? " - " : op == Op::DMul ? " * " : " / ";
+					if (op == Op::DDiv)
+						s = guard(real(function, ins.b) + " == 0", ErrDivideByZero, ins.origin);
+					s += "c0_sd(&" + dst + ", " + real(function, ins.a) + sign + real(function, ins.b) + ");";
+					break;
+				}
+				case Op::DNeg:
+					s = "c0_sd(&" + dst + ", -" + real(function, ins.a) + ");";
+					break;
+				case Op::ICmp:
+					s = "{ int32_t lhs = " + a + ", rhs = " + b + "; " + dst + " = (lhs > rhs) - (lhs < rhs); }";
+					break;
+				case Op::DCmp:
+					s = "{ double lhs = " + real(function, ins.a) + ", rhs = " + real(function, ins.b) + "; " + dst + " = (lhs > rhs) - (lhs < rhs); }";
+					break;
+				case Op::I2D:
+					s = "c0_sd(&" + dst + ", (double)" + a + ");";
+					break;
+				case Op::D2I:
+					s = dst + " = (int32_t)" + real(function, ins.a) + ";";
+					break;
+				case Op::I2C:
+					s = dst + " = (uint8_t)" + a + ";";
+					break;
+				case Op::Jmp:
+					s = target;
+					break;
+				case Op::JE: case Op::JNE: case Op::JL: case Op::JGE: case Op::JG: case Op::JLE:
+				case Op::IJE: case Op::IJNE: case Op::IJL: case Op::IJGE: case Op::IJG: case Op::IJLE: {
+					const char* const relations[] = {" == ", " != ", " < ", " >= ", " > ", " <= "};
+					const bool zero = op <= Op::JLE;
+					const auto relation = relations[ins.op - (int32_t)(zero ? Op::JE : Op::IJE)];
+					s = "if (" + a + relation + (zero ? "0" : b) + ")\n\t\t" + target;
+					break;
+				}
+				case Op::DJE: case Op::DJNE: case Op::DJL: case Op::DJGE: case Op::DJG: case Op::DJLE: {
+					// 与 DCMP 的结果和 0 比较一致
+					const char* const relations[] = {" == ", " != ", " < ", " >= ", " > ", " <= "};
+					s = "{ double lhs = " + real(function, ins.a) + ", rhs = " + real(function, ins.b) + "; if (((lhs > rhs) - (lhs < rhs))"
+						+ relations[ins.op - (int32_t)Op::DJE] + "0) " + target + " }";
+					break;
+				}
+				case Op::Call: {
+					auto& callee = _machine._functions[ins.x + 1];
+					const auto base = (function < 0 ? "" : "bp + ") + std::to_string(ins.dst.index);
+					s = guard(base + " + " + std::to_string(callee.frameSize) + " > C0_STACK_SIZE", ErrStackOverflow, ins.origin);
+					std::string call = "c0_f" + std::to_string(ins.x) + "(" + base;
+					for (int32_t k = 0; k < callee.params; k++)
+						call += ", " + slot(function, ins.dst, k);
+					call += ")";
+					if (_widths[ins.x] == 0)
+						s += call + ";";
+					else if (_widths[ins.x] == 1)
+						s += dst + " = " + call + ";";
+					else
+						s += "c0_bits(&" + dst + ", " + call + ");";
+					break;
+				}
+				case Op::IRet:
+					s = leave(" " + a);
+					break;
+				case Op::DRet:
+					s = leave(" " + word(function, ins.a));
+					break;
+				case Op::Ret:
+				case Op::End:
+					s = leave("");
+					break;
+				case Op::IPrint:
+					s = "printf(\"%d\", " + a + ");";
+					break;
+				case Op::DPrint:
+					s = "printf(\"%f\", " + real(function, ins.a) + ");";
+					break;
+				case Op::CPrint:
+					s = "putchar((char)" + a + ");";
+					break;
+				case Op::SPrint:
+					s = "c0_print_string(" + a + ", " + std::to_string(function) + ", " + std::to_string(ins.origin) + ");";
+					break;
+				case Op::PrintL:
+					s = "putchar('\\n');";
+					break;
+				case Op::IScan:
+				case Op::DScan:
+				case Op::CScan: {
+					const char* scan = op == Op::IScan ? "!c0_scan_int(&" : op == Op::DScan ? "!c0_scan_double(&" : "!c0_scan_char(&";
+					s = guard(scan + dst + ")", ErrReadFailed, ins.origin);
+					break;
+				}
+			}
+			while (!s.empty() && std::isspace((unsigned char)s.back()))
+				s.pop_back();
+			if (!s.empty())
+				_out << "\t" << s << "\n";
+		}
+		// 翻译结果总是以 End 结尾，这里只是防止标号悬空
+		if (targets.count(size))
+			_out << "L" << size << ":\n\t" << leave("") << "\n";
+		_out << "}\n\n";
+	}
+
+	void RegisterMachine::CWriter::Write() {
+		auto& module = _machine._module;
+		const int32_t count = module.functions.size();
+		for (int32_t i = 0; i < count; i++) {
+			int32_t width = 0;
+			for (auto& ins : module.functions[i].code)
+				if (isReturn(ins.GetOperation()))
+					width = ins.GetOperation() == Operation::RET ? 0 : ins.GetOperation() == Operation::DRET ? 2 : 1;
+			_widths.push_back(width);
+		}
+		_out << Runtime;
+		writeStrings(module, _out);
+
+		// 只生成初始化代码和 main 能调用到的函数
+		std::vector<bool> used(count + 1, false);
+		std::vector<int32_t> work{-1};
+		used[0] = true;
+		if (_machine._entry != -1) {
+			used[_machine._entry + 1] = true;
+			work.push_back(_machine._entry);
+		}
+		while (!work.empty()) {
+			auto function = work.back();
+			work.pop_back();
+			for (auto& ins : _machine._functions[function + 1].code)
+				if ((Op)ins.op == Op::Call && !used[ins.x + 1]) {
+					used[ins.x + 1] = true;
+					work.push_back(ins.x);
+				}
+		}
+
+		for (int32_t i = 0; i < count; i++)
+			if (used[i + 1])
+				_out << signature(i) << ";" << commentOf(module, i) << "\n";
+		_out << "\n";
+		for (int32_t i = -1; i < count; i++)
+			if (used[i + 1])
+				writeFunction(i);
+
+		std::string body = "\tif (" + std::to_string(_machine._functions[0].frameSize) + " > C0_STACK_SIZE)\n\t\tc0_fail("
+			+ std::to_string(ErrStackOverflow) + ", -1, 0);\n\tc0_start();\n";
+		const int32_t entry = _machine._entry;
+		if (entry == -1)
+			body += "\tc0_fail(" + std::to_string(ErrNoMainFunction) + ", -1, 0);\n";
+		else
+			body += "\tif (" + std::to_string(_machine._globals + _machine._functions[entry + 1].frameSize) + " > C0_STACK_SIZE)\n\t\tc0_fail("
+				+ std::to_string(ErrStackOverflow) + ", " + std::to_string(entry) + ", 0);\n\tc0_f" + std::to_string(entry) + "("
+				+ std::to_string(_machine._globals) + ");\n";
+		writeMain(_out, body);
+	}
+
+	void RegisterMachine::WriteCSource(std::ostream& out) const {
+		CWriter(*this, out).Write();
+	}
+
+	void writeCSource(const Module& module, std::ostream& out) {
+		// 能翻译成寄存器指令时用局部变量作栈帧，否则所有栈帧都在一个数组中
+		std::istringstream in;
+		std::ostringstream unused;
+		RegisterMachine machine(module, in, unused);
+		if (machine.IsTranslated())
+			machine.WriteCSource(out);
+		else
+			Writer(module, out).Write();
+	}
+}
@@ -0,0 +1,505 @@
+#include "jit.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define C0_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using uint8_t = std::uint8_t;
+
+		// 机器码和运行时函数共用的状态，偏移量写死在生成的代码里
+		struct Context {
+			int32_t failed;
+			int32_t code;
+			int32_t function;
+			int32_t ip;
+			// 还能嵌套调用的层数，防止耗尽机器栈
+			int32_t depth;
+			std::istream* in;
+			std::ostream* out;
+			const Module* module;
+		};
+		static_assert(offsetof(Context, failed) == 0 && offsetof(Context, code) == 4 && offsetof(Context, function) == 8
+			&& offsetof(Context, ip) == 12 && offsetof(Context, depth) == 16, "the generated code depends on the layout");
+
+		// 最多嵌套的调用层数，每层占 16 字节机器栈
+		const int32_t MaxDepth = 1 << 17;
+
+		// 生成的代码通过这些函数输入输出
+		void printInt(Context* context, int32_t value) {
+			*context->out << value;
+		}
+
+		void printChar(Context* context, int32_t value) {
+			*context->out << (char)value;
+		}
+
+		void printDouble(Context* context, double value) {
+			char buffer[512];
+			std::snprintf(buffer, sizeof buffer, "%f", value);
+			*context->out << buffer;
+		}
+
+		void printLine(Context* context) {
+			*context->out << '\n';
+		}
+
+		int32_t printString(Context* context, int32_t index) {
+			auto& consts = context->module->consts;
+			if (index < 0 || index >= (int32_t)consts.size() || !std::holds_alternative<std::string>(consts[index]))
+				return 1;
+			*context->out << std::get<std::string>(consts[index]);
+			return 0;
+		}
+
+		int32_t scanInt(Context* context, int32_t* slot) {
+			int32_t v;
+			if (!(*context->in >> v))
+				return 0;
+			*slot = v;
+			return 1;
+		}
+
+		int32_t scanChar(Context* context, int32_t* slot) {
+			char v;
+			if (!(*context->in >> v))
+				return 0;
+			*slot = (uint8_t)v;
+			return 1;
+		}
+
+		int32_t scanDouble(Context* context, int32_t* slot) {
+			double v;
+			if (!(*context->in >> v))
+				return 0;
+			std::memcpy(slot, &v, sizeof v);
+			return 1;
+		}
+
+		enum Register {
+			RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+			R8 = 8, R9 = 9, R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+		};
+
+		// jcc 的条件码
+		enum Condition {
+			CondE = 0x4, CondNE = 0x5, CondA = 0x7, CondS = 0x8, CondP = 0xa, CondL = 0xc, CondGE = 0xd, CondLE = 0xe, CondG = 0xf,
+		};
+
+		Condition conditionOf(int32_t k) {
+			static const Condition conditions[] = {CondE, CondNE, CondL, CondGE, CondG, CondLE};
+			return conditions[k];
+		}
+	}
+
+	// 只包含模板用到的那部分 x86-64 指令
+	class RegisterMachine::Jit::Assembler final {
+	public:
+		Assembler() : _bytes() {}
+		Assembler(const Assembler&) = delete;
+		Assembler& operator=(const Assembler&) = delete;
+
+		const std::vector<uint8_t>& Bytes() const { return _bytes; }
+		int32_t Size() const { return _bytes.size(); }
+
+		void Byte(int32_t b) { _bytes.push_back((uint8_t)b); }
+		void Bytes(std::initializer_list<int32_t> bytes) {
+			for (auto b : bytes)
+				Byte(b);
+		}
+		void U32(std::uint32_t v) {
+			for (int32_t k = 0; k < 4; k++)
+				Byte(v >> (k * 8));
+		}
+		void U64(std::uint64_t v) {
+			for (int32_t k = 0; k < 8; k++)
+				Byte(v >> (k * 8));
+		}
+		// [base + disp32] 形式的内存操作数
+		void Memory(std::initializer_list<int32_t> prefixes, bool wide, std::initializer_list<int32_t> opcode, int32_t reg, int32_t base, int32_t disp) {
+			Bytes(prefixes);
+			const int32_t rex = 0x40 | (wide ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((base >> 3) & 1);
+			if (rex != 0x40)
+				Byte(rex);
+			Bytes(opcode);
+			Byte(0x80 | (reg & 7) << 3 | (base & 7));
+			if ((base & 7) == RSP)
+				Byte(0x24);
+			U32(disp);
+		}
+		// rel32 跳转，返回需要回填的位置
+		int32_t Jump() {
+			Byte(0xe9);
+			U32(0);
+			return Size() - 4;
+		}
+		int32_t Jump(Condition cc) {
+			Bytes({0x0f, 0x80 | cc});
+			U32(0);
+			return Size() - 4;
+		}
+		int32_t Call() {
+			Byte(0xe8);
+			U32(0);
+			return Size() - 4;
+		}
+		void Patch(int32_t at, int32_t target) {
+			const std::uint32_t rel = target - (at + 4);
+			std::memcpy(&_bytes[at], &rel, 4);
+		}
+		void CallHelper(const void* helper) {
+			// mov rax, imm64; call rax
+			Bytes({0x48, 0xb8});
+			U64((std::uint64_t)helper);
+			Bytes({0xff, 0xd0});
+		}
+	private:
+		std::vector<uint8_t> _bytes;
+	};
+
+	RegisterMachine::Jit::~Jit() {
+#ifdef C0_JIT_SUPPORTED
+		if (_memory != nullptr)
+			munmap(_memory, _size);
+#endif
+	}
+
+	bool RegisterMachine::Jit::IsSupported() {
+#ifdef C0_JIT_SUPPORTED
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	std::unique_ptr<RegisterMachine::Jit> RegisterMachine::Jit::Compile(const std::vector<Function>& functions) {
+#ifdef C0_JIT_SUPPORTED
+		std::unique_ptr<Jit> jit(new Jit());
+		Assembler as;
+		// 从 C++ 进入生成的代码：entry(frame, stack, constants, context, limit, function)
+		jit->_trampoline = as.Size();
+		as.Bytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});
+		as.Bytes({0x49, 0x89, 0xf4, 0x49, 0x89, 0xd5, 0x49, 0x89, 0xce, 0x4d, 0x89, 0xc7});
+		as.Bytes({0x41, 0xff, 0xd1});
+		as.Bytes({0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3});
+
+		std::vector<std::pair<int32_t, int32_t> > calls;
+		for (int32_t i = 0; i < (int32_t)functions.size(); i++) {
+			jit->_entries.push_back(as.Size());
+			jit->compile(as, functions, i - 1, calls);
+		}
+		for (auto [at, callee] : calls)
+			as.Patch(at, jit->_entries[callee + 1]);
+
+		jit->_size = as.Size();
+		void* memory = mmap(nullptr, jit->_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return nullptr;
+		std::memcpy(memory, as.Bytes().data(), jit->_size);
+		if (mprotect(memory, jit->_size, PROT_READ | PROT_EXEC) != 0) {
+			munmap(memory, jit->_size);
+			return nullptr;
+		}
+		jit->_memory = memory;
+		return jit;
+#else
+		(void)functions;
+		return nullptr;
+#endif
+	}
+
+	bool RegisterMachine::Jit::CanEnter(int32_t function, int32_t ip) const {
+		return ip == 0 || _loops.count({function, ip}) != 0;
+	}
+
+	std::optional<RuntimeError> RegisterMachine::Jit::Execute(int32_t function, int32_t ip, int32_t* frame, int32_t* stack, const int32_t* constants,
+		std::istream& in, std::ostream& out, const Module& module) {
+		using Entry = int32_t (*)(int32_t*, int32_t*, const int32_t*, Context*, int32_t*, const void*);
+		Context context{0, 0, 0, 0, MaxDepth, &in, &out, &module};
+		auto base = (const uint8_t*)_memory;
+		auto entry = (Entry)(base + _trampoline);
+		entry(frame, stack, constants, &context, stack + VirtualMachine::StackSize, base + (ip == 0 ? _entries[function + 1] : _loops.at({function, ip})));
+		if (context.failed)
+			return RuntimeError{(RuntimeErrorCode)context.code, context.function, context.ip};
+		return {};
+	}
+
+	void RegisterMachine::Jit::compile(Assembler& as, const std::vector<Function>& functions, int32_t function, std::vector<std::pair<int32_t, int32_t> >& calls) {
+		auto& f = functions[function + 1];
+		// 指令下标 -> 机器码位置；待回填的跳转；出错时跳去的位置
+		std::vector<int32_t> labels(f.code.size() + 1, 0);
+		std::vector<std::pair<int32_t, int32_t> > jumps;
+		std::vector<int32_t> epilogue;
+		struct Failure {
+			int32_t at;
+			RuntimeErrorCode code;
+			int32_t origin;
+		};
+		std::vector<Failure> failures;
+
+		const auto baseOf = [](Operand o) {
+			return o.base == FrameBase ? RBX : o.base == GlobalBase ? R12 : R13;
+		};
+		// 按宽度读写 eax/rax
+		const auto load = [&](int32_t reg, Operand o, bool wide = false) {
+			as.Memory({}, wide, {0x8b}, reg, baseOf(o), o.index * 4);
+		};
+		const auto store = [&](int32_t reg, Operand o, bool wide = false) {
+			as.Memory({}, wide, {0x89}, reg, baseOf(o), o.index * 4);
+		};
+		// movsd xmm, [o] / movsd [o], xmm
+		const auto loadDouble = [&](int32_t xmm, Operand o) {
+			as.Memory({0xf2}, false, {0x0f, 0x10}, xmm, baseOf(o), o.index * 4);
+		};
+		const auto storeDouble = [&](int32_t xmm, Operand o) {
+			as.Memory({0xf2}, false, {0x0f, 0x11}, xmm, baseOf(o), o.index * 4);
+		};
+		const auto fail = [&](Condition cc, RuntimeErrorCode code, int32_t origin) {
+			failures.push_back({as.Jump(cc), code, origin});
+		};
+		// ecx = (a > b) - (a < b)，NaN 的结果是 0
+		const auto compareDoubles = [&](Operand a, Operand b) {
+			loadDouble(0, a);
+			loadDouble(1, b);
+			as.Bytes({0x31, 0xc9, 0x31, 0xd2});
+			as.Bytes({0x66, 0x0f, 0x2e, 0xc1, 0x0f, 0x97, 0xc1});
+			as.Bytes({0x66, 0x0f, 0x2e, 0xc8, 0x0f, 0x97, 0xc2});
+			as.Bytes({0x29, 0xd1});
+		};
+
+		// push rbx; mov rbx, rdi
+		as.Bytes({0x53, 0x48, 0x89, 0xfb});
+
+		for (int32_t i = 0; i < (int32_t)f.code.size(); i++) {
+			labels[i] = as.Size();
+			auto& ins = f.code[i];
+			const auto op = (Op)ins.op;
+			switch (op) {
+				case Op::Mov:
+				case Op::Mov2:
+					load(RAX, ins.a, op == Op::Mov2);
+					store(RAX, ins.dst, op == Op::Mov2);
+					break;
+				case Op::IAdd:
+				case Op::ISub:
+				case Op::IMul:
+					load(RAX, ins.a);
+					if (op == Op::IMul)
+						as.Memory({}, false, {0x0f, 0xaf}, RAX, baseOf(ins.b), ins.b.index * 4);
+					else
+						as.Memory({}, false, {op == Op::IAdd ? 0x03 : 0x2b}, RAX, baseOf(ins.b), ins.b.index * 4);
+					store(RAX, ins.dst);
+					break;
+				case Op::IDiv: {
+					load(RCX, ins.b);
+					int32_t negate = -1;
+					if (ins.x != NoOverflow) {
+						// test ecx, ecx; cmp ecx, -1
+						as.Bytes({0x85, 0xc9});
+						fail(CondE, ErrDivideByZero, ins.origin);
+						as.Bytes({0x83, 0xf9, 0xff});
+						negate = as.Jump(CondE);
+					}
+					// cdq; idiv ecx
+					load(RAX, ins.a);
+					as.Bytes({0x99, 0xf7, 0xf9});
+					if (negate >= 0) {
+						// INT_MIN / -1 按补码回绕
+						auto done = as.Jump();
+						as.Patch(negate, as.Size());
+						load(RAX, ins.a);
+						as.Bytes({0xf7, 0xd8});
+						as.Patch(done, as.Size());
+					}
+					store(RAX, ins.dst);
+					break;
+				}
+				case Op::INeg:
+					load(RAX, ins.a);
+					as.Bytes({0xf7, 0xd8});
+					store(RAX, ins.dst);
+					break;
+				case Op::DAdd:
+				case Op::DSub:
+				case Op::DMul: {
+					loadDouble(0, ins.a);
+					const int32_t code = op == Op::DAdd ? 0x58 : op == Op::DSub ? 0x5c : 0x59;
+					as.Memory({0xf2}, false, {0x0f, code}, 0, baseOf(ins.b), ins.b.index * 4);
+					storeDouble(0, ins.dst);
+					break;
+				}
+				case Op::DDiv: {
+					// 除数是 0 时出错，NaN 不算
+					loadDouble(1, ins.b);
+					as.Bytes({0x66, 0x0f, 0x57, 0xd2, 0x66, 0x0f, 0x2e, 0xca});
+					auto ordered = as.Jump(CondP);
+					fail(CondE, ErrDivideByZero, ins.origin);
+					as.Patch(ordered, as.Size());
+					loadDouble(0, ins.a);
+					as.Bytes({0xf2, 0x0f, 0x5e, 0xc1});
+					storeDouble(0, ins.dst);
+					break;
+				}
+				case Op::DNeg:
+					// 翻转符号位：btc rax, 63
+					load(RAX, ins.a, true);
+					as.Bytes({0x48, 0x0f, 0xba, 0xf8, 0x3f});
+					store(RAX, ins.dst, true);
+					break;
+				case Op::ICmp:
+					// ecx = (a > b) - (a < b)
+					load(RAX, ins.a);
+					as.Bytes({0x31, 0xc9, 0x31, 0xd2});
+					as.Memory({}, false, {0x3b}, RAX, baseOf(ins.b), ins.b.index * 4);
+					as.Bytes({0x0f, 0x9f, 0xc1, 0x0f, 0x9c, 0xc2, 0x29, 0xd1});
+					store(RCX, ins.dst);
+					break;
+				case Op::DCmp:
+					compareDoubles(ins.a, ins.b);
+					store(RCX, ins.dst);
+					break;
+				case Op::I2D:
+					as.Memory({0xf2}, false, {0x0f, 0x2a}, 0, baseOf(ins.a), ins.a.index * 4);
+					storeDouble(0, ins.dst);
+					break;
+				case Op::D2I:
+					as.Memory({0xf2}, false, {0x0f, 0x2c}, RAX, baseOf(ins.a), ins.a.index * 4);
+					store(RAX, ins.dst);
+					break;
+				case Op::I2C:
+					as.Memory({}, false, {0x0f, 0xb6}, RAX, baseOf(ins.a), ins.a.index * 4);
+					store(RAX, ins.dst);
+					break;
+				case Op::Jmp:
+					jumps.push_back({as.Jump(), ins.x});
+					break;
+				case Op::JE: case Op::JNE: case Op::JL: case Op::JGE: case Op::JG: case Op::JLE:
+					// test eax, eax
+					load(RAX, ins.a);
+					as.Bytes({0x85, 0xc0});
+					jumps.push_back({as.Jump(conditionOf(ins.op - (int32_t)Op::JE)), ins.x});
+					break;
+				case Op::IJE: case Op::IJNE: case Op::IJL: case Op::IJGE: case Op::IJG: case Op::IJLE:
+					load(RAX, ins.a);
+					as.Memory({}, false, {0x3b}, RAX, baseOf(ins.b), ins.b.index * 4);
+					jumps.push_back({as.Jump(conditionOf(ins.op - (int32_t)Op::IJE)), ins.x});
+					break;
+				case Op::DJE: case Op::DJNE: case Op::DJL: case Op::DJGE: case Op::DJG: case Op::DJLE:
+					// 与 DCMP 的结果和 0 比较一致：test ecx, ecx
+					compareDoubles(ins.a, ins.b);
+					as.Bytes({0x85, 0xc9});
+					jumps.push_back({as.Jump(conditionOf(ins.op - (int32_t)Op::DJE)), ins.x});
+					break;
+				case Op::Call:
+					// 检查栈空间和嵌套层数：lea rax, [rbx + dst + frameSize]; cmp rax, r15; dec dword [r14 + depth]
+					as.Memory({}, true, {0x8d}, RAX, RBX, (ins.dst.index + functions[ins.x + 1].frameSize) * 4);
+					as.Bytes({0x4c, 0x39, 0xf8});
+					fail(CondA, ErrStackOverflow, ins.origin);
+					as.Memory({}, false, {0xff}, 1, R14, offsetof(Context, depth));
+					fail(CondS, ErrStackOverflow, ins.origin);
+					// lea rdi, [rbx + dst]; call；被调函数出错时直接返回
+					as.Memory({}, true, {0x8d}, RDI, RBX, ins.dst.index * 4);
+					calls.push_back({as.Call(), ins.x});
+					as.Memory({}, false, {0xff}, 0, R14, offsetof(Context, depth));
+					as.Bytes({0x41, 0x83, 0x3e, 0x00});
+					epilogue.push_back(as.Jump(CondNE));
+					break;
+				case Op::IRet:
+				case Op::DRet:
+					load(RAX, ins.a, op == Op::DRet);
+					store(RAX, {FrameBase, 0}, op == Op::DRet);
+					epilogue.push_back(as.Jump());
+					break;
+				case Op::Ret:
+				case Op::End:
+					epilogue.push_back(as.Jump());
+					break;
+				case Op::IPrint:
+				case Op::CPrint:
+				case Op::SPrint:
+					// mov rdi, r14
+					as.Bytes({0x4c, 0x89, 0xf7});
+					load(RSI, ins.a);
+					as.CallHelper(op == Op::IPrint ? (const void*)&printInt : op == Op::CPrint ? (const void*)&printChar : (const void*)&printString);
+					if (op == Op::SPrint) {
+						as.Bytes({0x85, 0xc0});
+						fail(CondNE, ErrInvalidConstant, ins.origin);
+					}
+					break;
+				case Op::DPrint:
+					as.Bytes({0x4c, 0x89, 0xf7});
+					loadDouble(0, ins.a);
+					as.CallHelper((const void*)&printDouble);
+					break;
+				case Op::PrintL:
+					as.Bytes({0x4c, 0x89, 0xf7});
+					as.CallHelper((const void*)&printLine);
+					break;
+				case Op::IScan:
+				case Op::CScan:
+				case Op::DScan:
+					// lea rsi, [dst]
+					as.Bytes({0x4c, 0x89, 0xf7});
+					as.Memory({}, true, {0x8d}, RSI, baseOf(ins.dst), ins.dst.index * 4);
+					as.CallHelper(op == Op::IScan ? (const void*)&scanInt : op == Op::CScan ? (const void*)&scanChar : (const void*)&scanDouble);
+					as.Bytes({0x85, 0xc0});
+					fail(CondE, ErrReadFailed, ins.origin);
+					break;
+			}
+		}
+		labels[f.code.size()] = as.Size();
+		for (auto [at, target] : jumps)
+			as.Patch(at, labels[target]);
+
+		// 循环头的入口：push rbx; mov rbx, rdi; jmp
+		for (int32_t i = 0; i < (int32_t)f.code.size(); i++) {
+			auto op = (Op)f.code[i].op;
+			const int32_t target = f.code[i].x;
+			if ((op != Op::Jmp && (op < Op::JE || op > Op::DJLE)) || target > i || target == 0 || _loops.count({function, target}))
+				continue;
+			_loops[{function, target}] = as.Size();
+			as.Bytes({0x53, 0x48, 0x89, 0xfb});
+			as.Patch(as.Jump(), labels[target]);
+		}
+
+		// 出错：记录错误后返回
+		for (auto& failure : failures) {
+			as.Patch(failure.at, as.Size());
+			as.Memory({}, false, {0xc7}, 0, R14, offsetof(Context, code));
+			as.U32(failure.code);
+			as.Memory({}, false, {0xc7}, 0, R14, offsetof(Context, function));
+			as.U32(function);
+			as.Memory({}, false, {0xc7}, 0, R14, offsetof(Context, ip));
+			as.U32(failure.origin);
+			as.Memory({}, false, {0xc7}, 0, R14, offsetof(Context, failed));
+			as.U32(1);
+			epilogue.push_back(as.Jump());
+		}
+		// pop rbx; ret
+		for (auto at : epilogue)
+			as.Patch(at, as.Size());
+		as.Bytes({0x5b, 0xc3});
+	}
+
+	bool RegisterMachine::EnableJit() {
+		if (!_translated)
+			return false;
+		if (_jit == nullptr)
+			_jit = Jit::Compile(_functions);
+		return _jit != nullptr;
+	}
+
+	std::optional<RuntimeError> RegisterMachine::compiled(int32_t function, int32_t ip, int32_t bp) {
+		if (bp + _functions[function + 1].frameSize > VirtualMachine::StackSize)
+			return RuntimeError{ErrStackOverflow, function, 0};
+		return _jit->Execute(function, ip, _stack.data() + bp, _stack.data(), _constants.data(), _in, _out, _module);
+	}
+}
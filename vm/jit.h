@@ -0,0 +1,49 @@
+#pragma once
+
+#include "register_vm.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace c0 {
+
+	// 把寄存器指令逐条套用模板生成 x86-64 机器码
+	// rbx 是当前栈帧，r12 是全局变量，r13 是常量，r14 是 Context，r15 是栈的末尾
+	// 函数之间直接 call，参数 rdi 是被调函数的栈帧；出错时设置 Context 后逐层返回
+	// 每个循环头有一个入口，解释器可以在回边处把正在执行的函数换成机器码
+	class RegisterMachine::Jit final {
+	public:
+		Jit() : _memory(nullptr), _size(0), _entries(), _loops(), _trampoline(0) {}
+		Jit(const Jit&) = delete;
+		Jit& operator=(const Jit&) = delete;
+		~Jit();
+
+		// 当前平台能否生成机器码
+		static bool IsSupported();
+		// 不是 x86-64 或申请不到可执行内存时返回空
+		static std::unique_ptr<Jit> Compile(const std::vector<Function>& functions);
+		// 能否从第 ip 条指令进入机器码，0 是函数入口，其余是循环头
+		bool CanEnter(int32_t function, int32_t ip) const;
+		// 从第 ip 条指令开始执行函数直到它返回
+		std::optional<RuntimeError> Execute(int32_t function, int32_t ip, int32_t* frame, int32_t* stack, const int32_t* constants,
+			std::istream& in, std::ostream& out, const Module& module);
+	private:
+		class Assembler;
+
+		void compile(Assembler& as, const std::vector<Function>& functions, int32_t function, std::vector<std::pair<int32_t, int32_t> >& calls);
+
+	private:
+		void* _memory;
+		std::size_t _size;
+		// 下标为函数下标加一
+		std::vector<int32_t> _entries;
+		// (函数, 循环头) -> 栈上替换的入口
+		std::map<std::pair<int32_t, int32_t>, int32_t> _loops;
+		int32_t _trampoline;
+	};
+}
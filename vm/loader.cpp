@@ -0,0 +1,155 @@
+#include "vm.h"
+
+#include <cstring>
+#include <map>
+
+namespace c0 {
+
+	const std::vector<int>& operandSizesOf(Operation op) {
+		static const std::vector<int> none;
+		static const std::map<Operation, std::vector<int> > sizes = {
+			{ Operation::BIPUSH, {1} }, { Operation::IPUSH, {4} },
+			{ Operation::POPN, {4} },
+			{ Operation::LOADC, {2} }, { Operation::LOADA, {2, 4} },
+			{ Operation::SNEW, {4} },
+
+			{ Operation::JMP, {2} },
+			{ Operation::JE, {2} }, { Operation::JNE, {2} }, { Operation::JL, {2} }, { Operation::JGE, {2} }, { Operation::JG, {2} }, { Operation::JLE, {2} },
+
+			{ Operation::CALL, {2} },
+
+			{ Operation::ILOADL, {4} }, { Operation::DLOADL, {4} }, { Operation::ILOADG, {4} }, { Operation::DLOADG, {4} },
+			{ Operation::ISTOREL, {4} }, { Operation::DSTOREL, {4} }, { Operation::ISTOREG, {4} }, { Operation::DSTOREG, {4} },
+			{ Operation::IINC, {4, 4} },
+			{ Operation::ICMPJE, {2} }, { Operation::ICMPJNE, {2} }, { Operation::ICMPJL, {2} }, { Operation::ICMPJGE, {2} }, { Operation::ICMPJG, {2} }, { Operation::ICMPJLE, {2} },
+		};
+		auto itr = sizes.find(op);
+		return itr == sizes.end() ? none : itr->second;
+	}
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		// 按 .o0 文件的格式读取，多字节的数都是大端序
+		class Reader final {
+		public:
+			Reader(std::istream& in) : _in(in), _failed(false) {}
+			Reader(const Reader&) = delete;
+			Reader& operator=(const Reader&) = delete;
+
+			bool Failed() const { return _failed; }
+
+			std::uint64_t Read(int count) {
+				std::uint64_t value = 0;
+				for (int i = 0; i < count; i++) {
+					auto ch = _in.get();
+					if (ch == std::char_traits<char>::eof()) {
+						_failed = true;
+						return 0;
+					}
+					value = value << 8 | (std::uint8_t)ch;
+				}
+				return value;
+			}
+
+			std::string ReadString(int32_t length) {
+				std::string str(length, '\0');
+				if (length > 0 && !_in.read(&str[0], length))
+					_failed = true;
+				return str;
+			}
+		private:
+			std::istream& _in;
+			bool _failed;
+		};
+
+		// 操作码到指令的对应关系，由 getBinaryInstruction 反推
+		const std::vector<std::optional<Operation> >& operationTable() {
+			static const auto table = [] {
+				std::vector<std::optional<Operation> > result(256);
+				for (int32_t op = Operation::NOP; op < Operation::ILL; op++) {
+					auto code = Instruction((Operation)op).getBinaryInstruction();
+					if (!result[code].has_value())
+						result[code] = (Operation)op;
+				}
+				return result;
+			}();
+			return table;
+		}
+
+		int32_t readOperand(Reader& reader, int size) {
+			auto value = reader.Read(size);
+			// 只有 4 字节的操作数是有符号的
+			return size == 4 ? (int32_t)(std::uint32_t)value : (int32_t)value;
+		}
+
+		std::optional<std::vector<Instruction> > readCode(Reader& reader) {
+			auto count = reader.Read(2);
+			std::vector<Instruction> code;
+			code.reserve(count);
+			for (std::uint64_t i = 0; i < count && !reader.Failed(); i++) {
+				auto op = operationTable()[reader.Read(1)];
+				if (!op.has_value())
+					return {};
+				auto& sizes = operandSizesOf(op.value());
+				if (sizes.empty())
+					code.emplace_back(op.value());
+				else if (sizes.size() == 1)
+					code.emplace_back(op.value(), readOperand(reader, sizes[0]));
+				else {
+					auto x = readOperand(reader, sizes[0]);
+					code.emplace_back(op.value(), x, readOperand(reader, sizes[1]));
+				}
+			}
+			if (reader.Failed())
+				return {};
+			return code;
+		}
+	}
+
+	std::optional<Module> readModule(std::istream& in) {
+		Reader reader(in);
+		if (reader.Read(4) != 0x43303a29 || reader.Read(4) != 1)
+			return {};
+		Module module;
+		auto count = reader.Read(2);
+		for (std::uint64_t i = 0; i < count && !reader.Failed(); i++) {
+			switch (reader.Read(1)) {
+				case 0:
+					module.consts.emplace_back(reader.ReadString(reader.Read(2)));
+					break;
+				case 1:
+					module.consts.emplace_back((int32_t)(std::uint32_t)reader.Read(4));
+					break;
+				case 2: {
+					auto bits = reader.Read(8);
+					double d;
+					std::memcpy(&d, &bits, sizeof d);
+					module.consts.emplace_back(d);
+					break;
+				}
+				default:
+					return {};
+			}
+		}
+		auto start = readCode(reader);
+		if (!start.has_value())
+			return {};
+		module.start = std::move(start.value());
+		count = reader.Read(2);
+		for (std::uint64_t i = 0; i < count && !reader.Failed(); i++) {
+			Module::Function func;
+			func.name = reader.Read(2);
+			func.params = reader.Read(2);
+			func.level = reader.Read(2);
+			auto code = readCode(reader);
+			if (!code.has_value())
+				return {};
+			func.code = std::move(code.value());
+			module.functions.push_back(std::move(func));
+		}
+		if (reader.Failed())
+			return {};
+		return module;
+	}
+}
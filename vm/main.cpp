@@ -0,0 +1,102 @@
+#include "argparse.hpp"
+#include "fmt/core.h"
+
+#include "vm/vm.h"
+#include "vm/register_vm.h"
+#include "vm/verifier.h"
+#include "fmts.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+int main(int argc, char** argv) {
+	argparse::ArgumentParser program("c0vm");
+	program.add_argument("input")
+		.required()
+		.help("speicify the .o0 file to be executed.");
+	program.add_argument("--engine")
+		.default_value(std::string("stack"))
+		.help("execute the stack instructions directly, translate them to register instructions first, compile the register instructions to x86-64 code (jit), or interpret them and compile the whole program to x86-64 code in the background once a function or loop gets hot, switching hot calls and loops over to it (tiered).");
+	program.add_argument("--dispatch")
+		.default_value(std::string("threaded"))
+		.help("dispatch instructions with threaded code or a switch, threaded code falls back to the switch if unsupported.");
+	program.add_argument("--slots")
+		.default_value(std::string("32"))
+		.help("run the stack machine on 32-bit slots, or on 64-bit slots holding a whole double when the code is verified and uses every slot with one width.");
+	program.add_argument("--verify")
+		.default_value(false)
+		.implicit_value(true)
+		.help("check the stack depth, slot types and indices of every function and print the max stack depths instead of running.");
+
+	try {
+		program.parse_args(argc, argv);
+	}
+	catch (const std::runtime_error& err) {
+		fmt::print(stderr, "{}\n\n", err.what());
+		program.print_help();
+		exit(2);
+	}
+
+	auto input_file = program.get<std::string>("input");
+	auto dispatch = program.get<std::string>("--dispatch");
+	if (dispatch != "threaded" && dispatch != "switch") {
+		fmt::print(stderr, "Unknown dispatch mode {}, use threaded or switch.\n", dispatch);
+		exit(2);
+	}
+	auto slots = program.get<std::string>("--slots");
+	if (slots != "32" && slots != "64") {
+		fmt::print(stderr, "Unknown slot width {}, use 32 or 64.\n", slots);
+		exit(2);
+	}
+	auto engine = program.get<std::string>("--engine");
+	if (engine != "stack" && engine != "register" && engine != "jit" && engine != "tiered") {
+		fmt::print(stderr, "Unknown engine {}, use stack, register, jit or tiered.\n", engine);
+		exit(2);
+	}
+	std::ifstream inf(input_file, std::ios::binary | std::ios::in);
+	if (!inf) {
+		fmt::print(stderr, "Fail to open {} for reading.\n", input_file);
+		exit(2);
+	}
+	auto module = c0::readModule(inf);
+	if (!module.has_value()) {
+		fmt::print(stderr, "{} is not a valid .o0 file.\n", input_file);
+		exit(2);
+	}
+
+	if (program["--verify"] == true) {
+		c0::Verifier verifier(module.value());
+		auto failure = verifier.Verify();
+		if (failure.has_value()) {
+			fmt::print(stderr, "Verification error: {}\n", failure.value());
+			exit(1);
+		}
+		fmt::print("Start code Max depth: {}\n", verifier.MaxDepthOf(-1));
+		for (int i = 0; i < (int)module->functions.size(); i++)
+			fmt::print("Function: {} Max depth: {}\n", i, verifier.MaxDepthOf(i));
+		return 0;
+	}
+
+	std::optional<c0::RuntimeError> err;
+	if (engine == "register" || engine == "jit" || engine == "tiered") {
+		c0::RegisterMachine machine(module.value(), std::cin, std::cout);
+		// 不支持 JIT 时使用解释器
+		if (engine == "jit")
+			machine.EnableJit();
+		else if (engine == "tiered")
+			machine.EnableTiering();
+		err = machine.Run();
+	}
+	else {
+		c0::VirtualMachine vm(module.value(), std::cin, std::cout);
+		vm.SetDispatch(dispatch == "switch" ? c0::SwitchDispatch : c0::ThreadedDispatch);
+		vm.SetSlotWidth(slots == "64" ? c0::WideSlots : c0::NarrowSlots);
+		err = vm.Run();
+	}
+	if (err.has_value()) {
+		fmt::print(stderr, "Runtime error: {}\n", err.value());
+		exit(1);
+	}
+	return 0;
+}
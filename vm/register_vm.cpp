@@ -0,0 +1,999 @@
+#include "register_vm.h"
+#include "jit.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+		using uint32_t = std::uint32_t;
+
+		double loadDouble(const int32_t* p) {
+			double d;
+			std::memcpy(&d, p, sizeof d);
+			return d;
+		}
+
+		void storeDouble(int32_t* p, double d) {
+			std::memcpy(p, &d, sizeof d);
+		}
+
+		bool isConditionalJump(Operation op) {
+			return op >= Operation::JE && op <= Operation::JLE;
+		}
+
+		bool isJump(Operation op) {
+			return op == Operation::JMP || isConditionalJump(op) || (op >= Operation::ICMPJE && op <= Operation::ICMPJLE);
+		}
+
+		bool isReturn(Operation op) {
+			return op >= Operation::RET && op <= Operation::ARET;
+		}
+
+	}
+
+	// 把一个函数翻译成寄存器指令
+	// 栈中每个位置记录值现在在哪里：已经在自己的slot里，是某个位置的副本，或者是 LOADA 得到的地址
+	// 副本只在需要时才写进slot，跳转前后和调用前所有值都要写进slot
+	class RegisterMachine::Translator final {
+	private:
+		struct Value {
+			enum Kind { Slot, Copy, Address } kind;
+			// Copy 是值所在的位置；Address 的 base 是层次差，index 是偏移
+			Operand operand;
+		};
+	public:
+		Translator(const Module& module, std::vector<int32_t>& constants, const std::vector<int32_t>& returns, int32_t globals, int32_t function)
+			: _module(module), _constants(constants), _returns(returns), _globals(globals), _function(function),
+			_code(function < 0 ? module.start : module.functions[function].code), _values(), _result(), _fresh(-1), _failed(false), _origin(0) {}
+		Translator(const Translator&) = delete;
+		Translator& operator=(const Translator&) = delete;
+
+		// 栈深度不一致、地址不是常量或越界时无法翻译
+		std::optional<Function> Translate();
+		// 执行到末尾时的栈深度
+		int32_t EndDepth() const { return _endDepth; }
+	private:
+		std::optional<std::vector<int32_t> > depths();
+		std::optional<std::pair<int32_t, int32_t> > effectOf(const Instruction& ins) const;
+		void translate(int32_t ip);
+		// 按 JE..JLE 的顺序取对应的寄存器指令
+		static Op jumpOf(Op first, Operation op, Operation base) { return (Op)((int32_t)first + (op - base)); }
+
+		int32_t params() const { return _function < 0 ? 0 : _module.functions[_function].params; }
+		int32_t constant(int32_t value);
+		int32_t doubleConstant(int32_t index);
+		void emit(Op op, Operand dst = {}, Operand a = {}, Operand b = {}, int32_t x = 0);
+		// 产生一个新值并放在栈顶的slot里，之后紧接着的存储可以直接改写它的目标
+		void produce(Op op, int32_t width, Operand a = {}, Operand b = {}, int32_t x = 0);
+		Operand where(int32_t pos);
+		Operand pairAt(int32_t pos);
+		void materialize(int32_t pos);
+		void materializeAll();
+		// 写入 location 前，先写出所有还指向它旧值的副本
+		void invalidate(Operand location, int32_t width);
+		std::optional<Operand> resolve(Value address, int32_t width, int32_t limit);
+		void load(Operand location, int32_t width);
+		void store(Operand location, int32_t width);
+		void pop(int32_t count) { _values.resize(_values.size() - count); }
+		void push(Value value) { _values.push_back(value); }
+
+	private:
+		const Module& _module;
+		std::vector<int32_t>& _constants;
+		const std::vector<int32_t>& _returns;
+		int32_t _globals;
+		int32_t _function;
+		const std::vector<Instruction>& _code;
+		std::vector<Value> _values;
+		Function _result;
+		// 最后一条指令产生的值所在的指令下标，-1 表示没有
+		int32_t _fresh;
+		bool _failed;
+		int32_t _origin;
+		int32_t _endDepth = 0;
+		std::vector<int32_t> _depths;
+		std::vector<bool> _leaders;
+	};
+
+	int32_t RegisterMachine::Translator::constant(int32_t value) {
+		_constants.push_back(value);
+		return _constants.size() - 1;
+	}
+
+	int32_t RegisterMachine::Translator::doubleConstant(int32_t index) {
+		int32_t slots[2];
+		storeDouble(slots, std::get<double>(_module.consts[index]));
+		_constants.push_back(slots[0]);
+		_constants.push_back(slots[1]);
+		return _constants.size() - 2;
+	}
+
+	void RegisterMachine::Translator::emit(Op op, Operand dst, Operand a, Operand b, int32_t x) {
+		_result.code.push_back({(int32_t)op, x, dst, a, b, _origin});
+		_fresh = -1;
+	}
+
+	void RegisterMachine::Translator::produce(Op op, int32_t width, Operand a, Operand b, int32_t x) {
+		const int32_t pos = _values.size();
+		emit(op, {FrameBase, pos}, a, b, x);
+		for (int32_t k = 0; k < width; k++)
+			push({Value::Slot, {}});
+		_fresh = _result.code.size() - 1;
+	}
+
+	RegisterMachine::Operand RegisterMachine::Translator::where(int32_t pos) {
+		auto& v = _values[pos];
+		if (v.kind == Value::Address)
+			_failed = true;
+		return v.kind == Value::Copy ? v.operand : Operand{FrameBase, pos};
+	}
+
+	RegisterMachine::Operand RegisterMachine::Translator::pairAt(int32_t pos) {
+		auto& lo = _values[pos];
+		auto& hi = _values[pos + 1];
+		if (lo.kind == Value::Slot && hi.kind == Value::Slot)
+			return {FrameBase, pos};
+		if (lo.kind == Value::Copy && hi.kind == Value::Copy && lo.operand.base == hi.operand.base && lo.operand.index + 1 == hi.operand.index)
+			return lo.operand;
+		materialize(pos);
+		materialize(pos + 1);
+		return {FrameBase, pos};
+	}
+
+	void RegisterMachine::Translator::materialize(int32_t pos) {
+		auto& v = _values[pos];
+		if (v.kind == Value::Address)
+			_failed = true;
+		if (v.kind != Value::Copy)
+			return;
+		const auto from = v.operand;
+		v.kind = Value::Slot;
+		if (from.base != FrameBase || from.index != pos)
+			emit(Op::Mov, {FrameBase, pos}, from);
+	}
+
+	void RegisterMachine::Translator::materializeAll() {
+		for (int32_t pos = 0; pos < (int32_t)_values.size(); pos++)
+			materialize(pos);
+	}
+
+	void RegisterMachine::Translator::invalidate(Operand location, int32_t width) {
+		for (int32_t pos = 0; pos < (int32_t)_values.size(); pos++) {
+			auto& v = _values[pos];
+			if (v.kind == Value::Copy && v.operand.base == location.base
+				&& v.operand.index >= location.index && v.operand.index < location.index + width)
+				materialize(pos);
+		}
+	}
+
+	std::optional<RegisterMachine::Operand> RegisterMachine::Translator::resolve(Value address, int32_t width, int32_t limit) {
+		if (address.kind != Value::Address)
+			return {};
+		auto [level, offset] = address.operand;
+		// 初始化代码的栈帧就是全局变量
+		if (_function < 0 || level == 0) {
+			if (offset < 0 || offset + width > limit)
+				return {};
+			return Operand{FrameBase, offset};
+		}
+		if (offset < 0 || offset + width > _globals)
+			return {};
+		return Operand{GlobalBase, offset};
+	}
+
+	void RegisterMachine::Translator::load(Operand location, int32_t width) {
+		if (location.base != FrameBase) {
+			for (int32_t k = 0; k < width; k++)
+				push({Value::Copy, {location.base, location.index + k}});
+			return;
+		}
+		// 局部变量的值可能还是副本，直接传下去
+		auto operand = width == 1 ? where(location.index) : pairAt(location.index);
+		for (int32_t k = 0; k < width; k++)
+			push({Value::Copy, {operand.base, operand.index + k}});
+	}
+
+	void RegisterMachine::Translator::store(Operand location, int32_t width) {
+		const int32_t pos = _values.size() - width;
+		auto value = width == 1 ? where(pos) : pairAt(pos);
+		const int32_t fresh = _fresh;
+		const auto before = _result.code.size();
+		invalidate(location, width);
+		if (fresh >= 0 && _result.code.size() == before && value.base == FrameBase && value.index == pos
+			&& _result.code[fresh].dst.index == pos)
+			// 值是上一条指令刚算出来的，直接写到目标
+			_result.code[fresh].dst = location;
+		else
+			emit(width == 1 ? Op::Mov : Op::Mov2, location, value);
+		pop(width);
+		if (location.base == FrameBase)
+			for (int32_t k = 0; k < width; k++)
+				_values[location.index + k] = {Value::Slot, {}};
+	}
+
+	std::optional<std::pair<int32_t, int32_t> > RegisterMachine::Translator::effectOf(const Instruction& ins) const {
+		using P = std::pair<int32_t, int32_t>;
+		switch (ins.GetOperation()) {
+			case Operation::NOP: case Operation::JMP: case Operation::PRINTL: case Operation::IINC:
+				return P(0, 0);
+			case Operation::BIPUSH: case Operation::IPUSH: case Operation::LOADA: case Operation::ISCAN: case Operation::CSCAN:
+			case Operation::ILOADL: case Operation::ILOADG:
+				return P(0, 1);
+			case Operation::POP: case Operation::JE: case Operation::JNE: case Operation::JL: case Operation::JGE: case Operation::JG: case Operation::JLE:
+			case Operation::IPRINT: case Operation::CPRINT: case Operation::SPRINT: case Operation::ISTOREL: case Operation::ISTOREG:
+				return P(1, 0);
+			case Operation::POP2: case Operation::DPRINT: case Operation::DSTOREL: case Operation::DSTOREG:
+			case Operation::ICMPJE: case Operation::ICMPJNE: case Operation::ICMPJL: case Operation::ICMPJGE: case Operation::ICMPJG: case Operation::ICMPJLE:
+				return P(2, 0);
+			case Operation::POPN:
+				return P(ins.GetX(), 0);
+			case Operation::SNEW:
+				return P(0, ins.GetX());
+			case Operation::DUP:
+				return P(1, 2);
+			case Operation::DUP2:
+				return P(2, 4);
+			case Operation::LOADC:
+				if (ins.GetX() < 0 || ins.GetX() >= (int32_t)_module.consts.size())
+					return {};
+				return P(0, std::holds_alternative<double>(_module.consts[ins.GetX()]) ? 2 : 1);
+			case Operation::ILOAD: case Operation::INEG: case Operation::I2C:
+				return P(1, 1);
+			case Operation::DLOAD: case Operation::I2D:
+				return P(1, 2);
+			case Operation::ISTORE: case Operation::IADD: case Operation::ISUB: case Operation::IMUL: case Operation::IDIV: case Operation::ICMP:
+				return ins.GetOperation() == Operation::ISTORE ? P(2, 0) : P(2, 1);
+			case Operation::DSTORE:
+				return P(3, 0);
+			case Operation::DADD: case Operation::DSUB: case Operation::DMUL: case Operation::DDIV:
+				return P(4, 2);
+			case Operation::DNEG:
+				return P(2, 2);
+			case Operation::DCMP:
+				return P(4, 1);
+			case Operation::D2I:
+				return P(2, 1);
+			case Operation::DSCAN: case Operation::DLOADL: case Operation::DLOADG:
+				return P(0, 2);
+			case Operation::CALL:
+				if (ins.GetX() < 0 || ins.GetX() >= (int32_t)_module.functions.size())
+					return {};
+				return P(_module.functions[ins.GetX()].params, _returns[ins.GetX()]);
+			case Operation::RET:
+				return P(0, 0);
+			case Operation::IRET: case Operation::ARET:
+				return P(1, 0);
+			case Operation::DRET:
+				return P(2, 0);
+			default:
+				return {};
+		}
+	}
+
+	std::optional<std::vector<int32_t> > RegisterMachine::Translator::depths() {
+		const int32_t size = _code.size();
+		const int32_t returns = _function < 0 ? 0 : _returns[_function];
+		std::vector<int32_t> depth(size + 1, -1);
+		std::vector<int32_t> work{0};
+		depth[0] = params();
+		_endDepth = -1;
+		_result.frameSize = params();
+		const auto reach = [&](int32_t target, int32_t d) {
+			if (target < 0 || target > size)
+				target = size;
+			if (depth[target] == -1) {
+				depth[target] = d;
+				work.push_back(target);
+			}
+			return depth[target] == d;
+		};
+		while (!work.empty()) {
+			auto ip = work.back();
+			work.pop_back();
+			if (ip == size) {
+				// 没有返回值的函数可以执行到末尾
+				if (_function >= 0 && returns != 0)
+					return {};
+				_endDepth = depth[ip];
+				continue;
+			}
+			auto& ins = _code[ip];
+			auto effect = effectOf(ins);
+			if (!effect.has_value() || depth[ip] < effect->first)
+				return {};
+			const int32_t after = depth[ip] - effect->first + effect->second;
+			_result.frameSize = std::max(_result.frameSize, after);
+			const auto op = ins.GetOperation();
+			if (isReturn(op)) {
+				if (_function < 0 || effect->first != returns)
+					return {};
+				continue;
+			}
+			if (isJump(op) && !reach(ins.GetX(), after))
+				return {};
+			if (op != Operation::JMP && !reach(ip + 1, after))
+				return {};
+		}
+		return depth;
+	}
+
+	std::optional<RegisterMachine::Function> RegisterMachine::Translator::Translate() {
+		auto d = depths();
+		if (!d.has_value())
+			return {};
+		_depths = std::move(d.value());
+		const int32_t size = _code.size();
+		_leaders.assign(size + 1, false);
+		for (auto& ins : _code)
+			if (isJump(ins.GetOperation()))
+				_leaders[ins.GetX() < 0 || ins.GetX() > size ? size : ins.GetX()] = true;
+
+		_result.params = params();
+		std::vector<int32_t> index(size + 1, 0);
+		bool live = true;
+		_values.assign(params(), {Value::Slot, {}});
+		for (int32_t ip = 0; ip <= size && !_failed; ip++) {
+			_origin = ip;
+			if (_depths[ip] < 0) {
+				live = false;
+				index[ip] = _result.code.size();
+				continue;
+			}
+			if (_leaders[ip]) {
+				if (live)
+					materializeAll();
+				_values.assign(_depths[ip], {Value::Slot, {}});
+				_fresh = -1;
+			}
+			live = true;
+			index[ip] = _result.code.size();
+			if (ip == size) {
+				materializeAll();
+				emit(Op::End);
+				break;
+			}
+			const auto op = _code[ip].GetOperation();
+			// ICMP/DCMP 后紧接着的条件跳转合成一条
+			if ((op == Operation::ICMP || op == Operation::DCMP) && ip + 1 < size && !_leaders[ip + 1] && isConditionalJump(_code[ip + 1].GetOperation())) {
+				const int32_t width = op == Operation::ICMP ? 1 : 2;
+				const int32_t pos = _values.size() - width * 2;
+				auto a = width == 1 ? where(pos) : pairAt(pos);
+				auto b = width == 1 ? where(pos + 1) : pairAt(pos + 2);
+				pop(width * 2);
+				materializeAll();
+				auto& jump = _code[ip + 1];
+				emit(jumpOf(width == 1 ? Op::IJE : Op::DJE, jump.GetOperation(), Operation::JE), {}, a, b, jump.GetX());
+				index[++ip] = _result.code.size() - 1;
+				continue;
+			}
+			translate(ip);
+			if (op == Operation::JMP || isReturn(op))
+				live = false;
+		}
+		if (_failed)
+			return {};
+		// 跳转目标换成寄存器指令的下标
+		for (auto& code : _result.code) {
+			auto op = (Op)code.op;
+			if (op == Op::Jmp || (op >= Op::JE && op <= Op::DJLE))
+				code.x = index[code.x < 0 || code.x > size ? size : code.x];
+		}
+		return std::move(_result);
+	}
+
+	void RegisterMachine::Translator::translate(int32_t ip) {
+		auto& ins = _code[ip];
+		const int32_t depth = _values.size();
+		switch (ins.GetOperation()) {
+			case Operation::NOP:
+				break;
+			case Operation::BIPUSH:
+			case Operation::IPUSH:
+				push({Value::Copy, {ConstantBase, constant(ins.GetX())}});
+				break;
+			case Operation::POP:
+				pop(1);
+				break;
+			case Operation::POP2:
+				pop(2);
+				break;
+			case Operation::POPN:
+				pop(ins.GetX());
+				break;
+			case Operation::DUP:
+			case Operation::DUP2: {
+				const int32_t width = ins.GetOperation() == Operation::DUP ? 1 : 2;
+				for (int32_t k = depth - width; k < depth; k++)
+					push(_values[k].kind == Value::Slot ? Value{Value::Copy, {FrameBase, k}} : _values[k]);
+				break;
+			}
+			case Operation::LOADC: {
+				auto& c = _module.consts[ins.GetX()];
+				if (std::holds_alternative<double>(c)) {
+					auto k = doubleConstant(ins.GetX());
+					push({Value::Copy, {ConstantBase, k}});
+					push({Value::Copy, {ConstantBase, k + 1}});
+				}
+				else
+					// 字符串常量的“地址”就是它在常量表中的下标
+					push({Value::Copy, {ConstantBase, constant(std::holds_alternative<int32_t>(c) ? std::get<int32_t>(c) : ins.GetX())}});
+				break;
+			}
+			case Operation::LOADA:
+				push({Value::Address, {ins.GetX(), ins.GetOpt()}});
+				break;
+			case Operation::SNEW:
+				for (int32_t k = 0; k < ins.GetX(); k++)
+					push({Value::Copy, {ConstantBase, constant(0)}});
+				break;
+			case Operation::ILOAD:
+			case Operation::DLOAD: {
+				const int32_t width = ins.GetOperation() == Operation::ILOAD ? 1 : 2;
+				auto location = resolve(_values[depth - 1], width, depth - 1);
+				if (!location.has_value()) {
+					_failed = true;
+					return;
+				}
+				pop(1);
+				load(location.value(), width);
+				break;
+			}
+			case Operation::ISTORE:
+			case Operation::DSTORE: {
+				const int32_t width = ins.GetOperation() == Operation::ISTORE ? 1 : 2;
+				auto location = resolve(_values[depth - 1 - width], width, depth - 1 - width);
+				if (!location.has_value()) {
+					_failed = true;
+					return;
+				}
+				store(location.value(), width);
+				pop(1);
+				break;
+			}
+			case Operation::IADD:
+			case Operation::ISUB:
+			case Operation::IMUL:
+			case Operation::IDIV:
+			case Operation::ICMP: {
+				auto a = where(depth - 2), b = where(depth - 1);
+				pop(2);
+				static const std::map<Operation, Op> ops = {
+					{Operation::IADD, Op::IAdd}, {Operation::ISUB, Op::ISub}, {Operation::IMUL, Op::IMul}, {Operation::IDIV, Op::IDiv}, {Operation::ICMP, Op::ICmp},
+				};
+				produce(ops.at(ins.GetOperation()), 1, a, b, ins.GetOpt());
+				break;
+			}
+			case Operation::DADD:
+			case Operation::DSUB:
+			case Operation::DMUL:
+			case Operation::DDIV:
+			case Operation::DCMP: {
+				auto a = pairAt(depth - 4), b = pairAt(depth - 2);
+				pop(4);
+				static const std::map<Operation, Op> ops = {
+					{Operation::DADD, Op::DAdd}, {Operation::DSUB, Op::DSub}, {Operation::DMUL, Op::DMul}, {Operation::DDIV, Op::DDiv}, {Operation::DCMP, Op::DCmp},
+				};
+				produce(ops.at(ins.GetOperation()), ins.GetOperation() == Operation::DCMP ? 1 : 2, a, b);
+				break;
+			}
+			case Operation::INEG:
+			case Operation::I2C:
+			case Operation::I2D: {
+				auto a = where(depth - 1);
+				pop(1);
+				auto op = ins.GetOperation();
+				produce(op == Operation::INEG ? Op::INeg : op == Operation::I2C ? Op::I2C : Op::I2D, op == Operation::I2D ? 2 : 1, a);
+				break;
+			}
+			case Operation::DNEG:
+			case Operation::D2I: {
+				auto a = pairAt(depth - 2);
+				pop(2);
+				auto op = ins.GetOperation();
+				produce(op == Operation::DNEG ? Op::DNeg : Op::D2I, op == Operation::DNEG ? 2 : 1, a);
+				break;
+			}
+			case Operation::JMP:
+				materializeAll();
+				emit(Op::Jmp, {}, {}, {}, ins.GetX());
+				break;
+			case Operation::JE: case Operation::JNE: case Operation::JL: case Operation::JGE: case Operation::JG: case Operation::JLE: {
+				auto a = where(depth - 1);
+				pop(1);
+				materializeAll();
+				emit(jumpOf(Op::JE, ins.GetOperation(), Operation::JE), {}, a, {}, ins.GetX());
+				break;
+			}
+			case Operation::ICMPJE: case Operation::ICMPJNE: case Operation::ICMPJL: case Operation::ICMPJGE: case Operation::ICMPJG: case Operation::ICMPJLE: {
+				auto a = where(depth - 2), b = where(depth - 1);
+				pop(2);
+				materializeAll();
+				emit(jumpOf(Op::IJE, ins.GetOperation(), Operation::ICMPJE), {}, a, b, ins.GetX());
+				break;
+			}
+			case Operation::CALL: {
+				const int32_t params = _module.functions[ins.GetX()].params;
+				for (int32_t pos = depth - params; pos < depth; pos++)
+					materialize(pos);
+				// 被调函数可能读写全局变量，初始化代码的栈帧就是全局变量
+				for (int32_t pos = 0; pos < depth; pos++)
+					if (_values[pos].kind == Value::Copy && (_function < 0 || _values[pos].operand.base == GlobalBase))
+						materialize(pos);
+				emit(Op::Call, {FrameBase, depth - params}, {}, {}, ins.GetX());
+				pop(params);
+				for (int32_t k = 0; k < _returns[ins.GetX()]; k++)
+					push({Value::Slot, {}});
+				break;
+			}
+			case Operation::RET:
+				emit(Op::Ret);
+				break;
+			case Operation::IRET:
+			case Operation::ARET:
+				emit(Op::IRet, {}, where(depth - 1));
+				break;
+			case Operation::DRET:
+				emit(Op::DRet, {}, pairAt(depth - 2));
+				break;
+			case Operation::IPRINT:
+			case Operation::CPRINT:
+			case Operation::SPRINT: {
+				auto a = where(depth - 1);
+				pop(1);
+				auto op = ins.GetOperation();
+				emit(op == Operation::IPRINT ? Op::IPrint : op == Operation::CPRINT ? Op::CPrint : Op::SPrint, {}, a);
+				break;
+			}
+			case Operation::DPRINT: {
+				auto a = pairAt(depth - 2);
+				pop(2);
+				emit(Op::DPrint, {}, a);
+				break;
+			}
+			case Operation::PRINTL:
+				emit(Op::PrintL);
+				break;
+			case Operation::ISCAN:
+				produce(Op::IScan, 1);
+				break;
+			case Operation::CSCAN:
+				produce(Op::CScan, 1);
+				break;
+			case Operation::DSCAN:
+				produce(Op::DScan, 2);
+				break;
+			case Operation::ILOADL: case Operation::ILOADG: case Operation::DLOADL: case Operation::DLOADG: {
+				auto op = ins.GetOperation();
+				const int32_t width = op == Operation::ILOADL || op == Operation::ILOADG ? 1 : 2;
+				const int32_t level = op == Operation::ILOADL || op == Operation::DLOADL ? 0 : 1;
+				auto location = resolve({Value::Address, {level, ins.GetX()}}, width, depth);
+				if (!location.has_value()) {
+					_failed = true;
+					return;
+				}
+				load(location.value(), width);
+				break;
+			}
+			case Operation::ISTOREL: case Operation::ISTOREG: case Operation::DSTOREL: case Operation::DSTOREG: {
+				auto op = ins.GetOperation();
+				const int32_t width = op == Operation::ISTOREL || op == Operation::ISTOREG ? 1 : 2;
+				const int32_t level = op == Operation::ISTOREL || op == Operation::DSTOREL ? 0 : 1;
+				auto location = resolve({Value::Address, {level, ins.GetX()}}, width, depth - width);
+				if (!location.has_value()) {
+					_failed = true;
+					return;
+				}
+				store(location.value(), width);
+				break;
+			}
+			case Operation::IINC: {
+				auto location = resolve({Value::Address, {0, ins.GetX()}}, 1, depth);
+				if (!location.has_value()) {
+					_failed = true;
+					return;
+				}
+				auto a = where(location->index);
+				invalidate(location.value(), 1);
+				emit(Op::IAdd, location.value(), a, {ConstantBase, constant(ins.GetOpt())});
+				_values[location->index] = {Value::Slot, {}};
+				break;
+			}
+			default:
+				_failed = true;
+				break;
+		}
+	}
+
+	RegisterMachine::RegisterMachine(const Module& module, std::istream& in, std::ostream& out)
+		: _module(module), _in(in), _out(out), _translated(false), _functions(), _constants(), _globals(0), _entry(-1), _stack(), _dispatches(0), _jit(),
+		_tiered(false), _hotCalls(HotCalls), _hotLoops(HotLoops), _calls(), _loops(), _compiler(), _compiled(false), _pending(), _nativeEntries(0) {
+		const int32_t count = module.functions.size();
+		for (int32_t i = 0; i < count; i++) {
+			auto name = module.functions[i].name;
+			if (name >= 0 && name < (int32_t)module.consts.size()
+				&& std::holds_alternative<std::string>(module.consts[name]) && std::get<std::string>(module.consts[name]) == "main")
+				_entry = i;
+		}
+		// 每个函数返回值的slot数，必须唯一
+		std::vector<int32_t> returns(count, 0);
+		for (int32_t i = 0; i < count; i++) {
+			int32_t width = -1;
+			for (auto& ins : module.functions[i].code) {
+				auto op = ins.GetOperation();
+				if (!isReturn(op))
+					continue;
+				auto w = op == Operation::RET ? 0 : op == Operation::DRET ? 2 : 1;
+				if (width != -1 && width != w)
+					return;
+				width = w;
+			}
+			returns[i] = std::max(width, 0);
+		}
+		if (_entry != -1 && module.functions[_entry].params != 0)
+			return;
+		_functions.resize(count + 1);
+		Translator start(module, _constants, returns, 0, -1);
+		auto code = start.Translate();
+		if (!code.has_value() || start.EndDepth() < 0)
+			return;
+		_functions[0] = std::move(code.value());
+		_globals = start.EndDepth();
+		for (int32_t i = 0; i < count; i++) {
+			Translator translator(module, _constants, returns, _globals, i);
+			code = translator.Translate();
+			if (!code.has_value())
+				return;
+			_functions[i + 1] = std::move(code.value());
+		}
+		_translated = true;
+	}
+
+	RegisterMachine::~RegisterMachine() {
+		if (_compiler.joinable())
+			_compiler.join();
+	}
+
+	std::size_t RegisterMachine::CodeSize() const {
+		std::size_t size = 0;
+		for (auto& f : _functions)
+			size += f.code.size();
+		return size;
+	}
+
+	std::optional<RuntimeError> RegisterMachine::Run() {
+		if (!_translated) {
+			VirtualMachine vm(_module, _in, _out);
+			return vm.Run();
+		}
+		_dispatches = 0;
+		_nativeEntries = 0;
+		if (_stack.empty())
+			_stack.assign(VirtualMachine::StackSize, 0);
+		const auto run = [this](int32_t function, int32_t bp) {
+			if (_tiered)
+				return execute<true>(function, bp);
+			return _jit != nullptr ? compiled(function, 0, bp) : execute<false>(function, bp);
+		};
+		auto err = run(-1, 0);
+		if (!err.has_value() && _entry == -1)
+			err = RuntimeError{ErrNoMainFunction, -1, 0};
+		if (!err.has_value())
+			err = run(_entry, _globals);
+		_out.flush();
+		// 编译结果留给下一次 Run
+		finish();
+		return err;
+	}
+
+	bool RegisterMachine::IsJitSupported() {
+		return Jit::IsSupported();
+	}
+
+	bool RegisterMachine::EnableTiering() {
+		if (!_translated || !Jit::IsSupported())
+			return false;
+		_tiered = true;
+		_calls.assign(_functions.size(), 0);
+		_loops.resize(_functions.size());
+		for (std::size_t i = 0; i < _functions.size(); i++)
+			_loops[i].assign(_functions[i].code.size(), 0);
+		return true;
+	}
+
+	void RegisterMachine::SetTierThresholds(uint32_t calls, uint32_t loops) {
+		_hotCalls = calls;
+		_hotLoops = loops;
+	}
+
+	bool RegisterMachine::promote() {
+		if (_jit != nullptr)
+			return true;
+		if (!_compiler.joinable()) {
+			// 编译失败后不再重试
+			if (!_compiled)
+				_compiler = std::thread([this]() {
+					_pending = Jit::Compile(_functions);
+					_compiled.store(true, std::memory_order_release);
+				});
+			return false;
+		}
+		if (!_compiled.load(std::memory_order_acquire))
+			return false;
+		finish();
+		return _jit != nullptr;
+	}
+
+	void RegisterMachine::finish() {
+		if (!_compiler.joinable())
+			return;
+		_compiler.join();
+		_jit = std::move(_pending);
+	}
+
+	template<bool Tiered>
+	std::optional<RuntimeError> RegisterMachine::execute(int32_t function, int32_t bp) {
+		const Function* f = &_functions[function + 1];
+		if (bp + f->frameSize > VirtualMachine::StackSize)
+			return RuntimeError{ErrStackOverflow, function, 0};
+		std::vector<Frame> frames;
+		const Code* code = f->code.data();
+		int32_t ip = 0;
+		int32_t* stack = _stack.data();
+		// 三种操作数的基址，栈帧的基址随调用变化
+		int32_t* bases[3] = {stack + bp, stack, _constants.data()};
+		uint64_t dispatches = 0;
+
+#define VM_ERROR(code) do { _dispatches += dispatches; return RuntimeError{code, function, ins.origin}; } while (0)
+#define VM_I(o) (bases[(o).base][(o).index])
+#define VM_D(o) loadDouble(&VM_I(o))
+#define VM_CONDITION(first, lhs, rhs) \
+			const auto cmp = (ins.op - (int32_t)(first)); \
+			const auto l = (lhs), r = (rhs); \
+			const bool taken = cmp == 0 ? l == r : cmp == 1 ? l != r : cmp == 2 ? l < r : cmp == 3 ? l >= r : cmp == 4 ? l > r : l <= r; \
+			if (taken) \
+				VM_JUMP(ins.x);
+// 分层执行时统计回边，循环变热后从循环头换成机器码执行到函数返回
+#define VM_JUMP(target) do { \
+				ip = (target); \
+				if (Tiered && ip <= (int32_t)(&ins - code) && backEdge()) { \
+					_dispatches += dispatches; \
+					if (failure.has_value()) \
+						return failure; \
+					dispatches = 0; \
+					if (!leave()) \
+						return {}; \
+				} \
+			} while (0)
+
+		// 从当前函数返回，返回值已经写到了栈帧的起点
+		const auto leave = [&]() {
+			if (frames.empty())
+				return false;
+			auto frame = frames.back();
+			frames.pop_back();
+			function = frame.function;
+			code = _functions[function + 1].code.data();
+			bp = frame.bp;
+			bases[0] = stack + bp;
+			ip = frame.ip;
+			return true;
+		};
+		std::optional<RuntimeError> failure;
+		const auto backEdge = [&]() {
+			auto& counter = _loops[function + 1][ip];
+			if (counter < _hotLoops) {
+				counter++;
+				return false;
+			}
+			if (!promote() || !_jit->CanEnter(function, ip))
+				return false;
+			_nativeEntries++;
+			failure = compiled(function, ip, bp);
+			return true;
+		};
+		const auto hotCall = [&](int32_t callee) {
+			auto& counter = _calls[callee + 1];
+			if (counter < _hotCalls) {
+				counter++;
+				return false;
+			}
+			return promote();
+		};
+
+		while (true) {
+			auto& ins = code[ip++];
+			dispatches++;
+			switch ((Op)ins.op) {
+				case Op::Mov:
+					VM_I(ins.dst) = VM_I(ins.a);
+					break;
+				case Op::Mov2: {
+					auto lo = VM_I(ins.a), hi = (&VM_I(ins.a))[1];
+					VM_I(ins.dst) = lo;
+					(&VM_I(ins.dst))[1] = hi;
+					break;
+				}
+				case Op::IAdd:
+					VM_I(ins.dst) = (int32_t)((uint32_t)VM_I(ins.a) + (uint32_t)VM_I(ins.b));
+					break;
+				case Op::ISub:
+					VM_I(ins.dst) = (int32_t)((uint32_t)VM_I(ins.a) - (uint32_t)VM_I(ins.b));
+					break;
+				case Op::IMul:
+					VM_I(ins.dst) = (int32_t)((uint32_t)VM_I(ins.a) * (uint32_t)VM_I(ins.b));
+					break;
+				case Op::IDiv: {
+					auto lhs = VM_I(ins.a), rhs = VM_I(ins.b);
+					if (ins.x != NoOverflow) {
+						if (rhs == 0)
+							VM_ERROR(ErrDivideByZero);
+						// INT_MIN / -1 按补码回绕
+						if (rhs == -1) {
+							VM_I(ins.dst) = (int32_t)(0u - (uint32_t)lhs);
+							break;
+						}
+					}
+					VM_I(ins.dst) = lhs / rhs;
+					break;
+				}
+				case Op::INeg:
+					VM_I(ins.dst) = (int32_t)(0u - (uint32_t)VM_I(ins.a));
+					break;
+				case Op::DAdd:
+					storeDouble(&VM_I(ins.dst), VM_D(ins.a) + VM_D(ins.b));
+					break;
+				case Op::DSub:
+					storeDouble(&VM_I(ins.dst), VM_D(ins.a) - VM_D(ins.b));
+					break;
+				case Op::DMul:
+					storeDouble(&VM_I(ins.dst), VM_D(ins.a) * VM_D(ins.b));
+					break;
+				case Op::DDiv: {
+					auto rhs = VM_D(ins.b);
+					if (rhs == 0)
+						VM_ERROR(ErrDivideByZero);
+					storeDouble(&VM_I(ins.dst), VM_D(ins.a) / rhs);
+					break;
+				}
+				case Op::DNeg:
+					storeDouble(&VM_I(ins.dst), -VM_D(ins.a));
+					break;
+				case Op::ICmp: {
+					auto lhs = VM_I(ins.a), rhs = VM_I(ins.b);
+					VM_I(ins.dst) = (lhs > rhs) - (lhs < rhs);
+					break;
+				}
+				case Op::DCmp: {
+					auto lhs = VM_D(ins.a), rhs = VM_D(ins.b);
+					VM_I(ins.dst) = (lhs > rhs) - (lhs < rhs);
+					break;
+				}
+				case Op::I2D:
+					storeDouble(&VM_I(ins.dst), (double)VM_I(ins.a));
+					break;
+				case Op::D2I:
+					VM_I(ins.dst) = (int32_t)VM_D(ins.a);
+					break;
+				case Op::I2C:
+					VM_I(ins.dst) = (uint8_t)VM_I(ins.a);
+					break;
+				case Op::Jmp:
+					VM_JUMP(ins.x);
+					break;
+				case Op::JE: case Op::JNE: case Op::JL: case Op::JGE: case Op::JG: case Op::JLE: {
+					VM_CONDITION(Op::JE, VM_I(ins.a), 0);
+					break;
+				}
+				case Op::IJE: case Op::IJNE: case Op::IJL: case Op::IJGE: case Op::IJG: case Op::IJLE: {
+					VM_CONDITION(Op::IJE, VM_I(ins.a), VM_I(ins.b));
+					break;
+				}
+				case Op::DJE: case Op::DJNE: case Op::DJL: case Op::DJGE: case Op::DJG: case Op::DJLE: {
+					// 与 DCMP 的结果和 0 比较一致
+					auto lhs = VM_D(ins.a), rhs = VM_D(ins.b);
+					VM_CONDITION(Op::DJE, (lhs > rhs) - (lhs < rhs), 0);
+					break;
+				}
+				case Op::Call: {
+					auto& callee = _functions[ins.x + 1];
+					const int32_t base = bp + ins.dst.index;
+					if (base + callee.frameSize > VirtualMachine::StackSize)
+						VM_ERROR(ErrStackOverflow);
+					if (Tiered && hotCall(ins.x)) {
+						_nativeEntries++;
+						auto err = compiled(ins.x, 0, base);
+						if (err.has_value()) {
+							_dispatches += dispatches;
+							return err;
+						}
+						break;
+					}
+					frames.push_back({function, ip, bp});
+					function = ins.x;
+					code = callee.code.data();
+					bp = base;
+					bases[0] = stack + bp;
+					ip = 0;
+					break;
+				}
+				case Op::IRet:
+					stack[bp] = VM_I(ins.a);
+					if (!leave()) {
+						_dispatches += dispatches;
+						return {};
+					}
+					break;
+				case Op::DRet: {
+					auto lo = VM_I(ins.a), hi = (&VM_I(ins.a))[1];
+					stack[bp] = lo;
+					stack[bp + 1] = hi;
+					if (!leave()) {
+						_dispatches += dispatches;
+						return {};
+					}
+					break;
+				}
+				case Op::Ret:
+				case Op::End:
+					if (!leave()) {
+						_dispatches += dispatches;
+						return {};
+					}
+					break;
+				case Op::IPrint:
+					_out << VM_I(ins.a);
+					break;
+				case Op::DPrint: {
+					char buffer[512];
+					std::snprintf(buffer, sizeof buffer, "%f", VM_D(ins.a));
+					_out << buffer;
+					break;
+				}
+				case Op::CPrint:
+					_out << (char)VM_I(ins.a);
+					break;
+				case Op::SPrint: {
+					auto index = VM_I(ins.a);
+					if (index < 0 || index >= (int32_t)_module.consts.size() || !std::holds_alternative<std::string>(_module.consts[index]))
+						VM_ERROR(ErrInvalidConstant);
+					_out << std::get<std::string>(_module.consts[index]);
+					break;
+				}
+				case Op::PrintL:
+					_out << '\n';
+					break;
+				case Op::IScan: {
+					int32_t v;
+					if (!(_in >> v))
+						VM_ERROR(ErrReadFailed);
+					VM_I(ins.dst) = v;
+					break;
+				}
+				case Op::DScan: {
+					double v;
+					if (!(_in >> v))
+						VM_ERROR(ErrReadFailed);
+					storeDouble(&VM_I(ins.dst), v);
+					break;
+				}
+				case Op::CScan: {
+					char v;
+					if (!(_in >> v))
+						VM_ERROR(ErrReadFailed);
+					VM_I(ins.dst) = (uint8_t)v;
+					break;
+				}
+			}
+		}
+
+#undef VM_ERROR
+#undef VM_I
+#undef VM_D
+#undef VM_CONDITION
+#undef VM_JUMP
+	}
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "vm.h"
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace c0 {
+
+	// 先把栈式指令翻译成三地址的寄存器指令再执行
+	// 寄存器就是栈帧中的slot，翻译时已经知道每条指令处的栈深度，所以不需要栈顶指针
+	// 全局变量和常量可以直接作为操作数，局部变量的读取会尽量直接用到使用它的指令上
+	// 有函数无法翻译时整个程序交给 VirtualMachine 执行
+	// 分层执行时先解释执行，调用次数或循环次数达到阈值后在后台线程中编译成机器码，
+	// 之后调用热点函数时执行机器码，正在执行的热循环在回边处换成机器码继续执行
+	class RegisterMachine final {
+	private:
+		// 寄存器指令
+		enum class Op {
+			Mov, Mov2,
+			IAdd, ISub, IMul, IDiv, INeg,
+			DAdd, DSub, DMul, DDiv, DNeg,
+			ICmp, DCmp,
+			I2D, D2I, I2C,
+			Jmp,
+			// 和 0 比较后跳转
+			JE, JNE, JL, JGE, JG, JLE,
+			// 比较两个 int 后跳转
+			IJE, IJNE, IJL, IJGE, IJG, IJLE,
+			// 比较两个 double 后跳转
+			DJE, DJNE, DJL, DJGE, DJG, DJLE,
+			Call, Ret, IRet, DRet,
+			// 执行到了代码末尾
+			End,
+			IPrint, DPrint, CPrint, SPrint, PrintL,
+			IScan, DScan, CScan,
+		};
+		using int32_t = std::int32_t;
+		using uint32_t = std::uint32_t;
+		using uint64_t = std::uint64_t;
+
+		static const int32_t FrameBase = 0;
+		static const int32_t GlobalBase = 1;
+		static const int32_t ConstantBase = 2;
+
+		// 操作数在 bases[base][index]，base 是栈帧、全局变量或常量
+		struct Operand {
+			int32_t base;
+			int32_t index;
+		};
+		struct Code {
+			int32_t op;
+			// 跳转目标、被调函数或 IDIV 的 NoOverflow 标记
+			int32_t x;
+			Operand dst;
+			Operand a;
+			Operand b;
+			// 对应的栈式指令，用于报告运行时错误
+			int32_t origin;
+		};
+		struct Function {
+			int32_t params;
+			// 栈帧最多用到的slot数
+			int32_t frameSize;
+			std::vector<Code> code;
+		};
+		struct Frame {
+			int32_t function;
+			int32_t ip;
+			int32_t bp;
+		};
+		class Translator;
+		class Jit;
+		class CWriter;
+	public:
+		// 分层执行的默认阈值
+		static const uint32_t HotCalls = 1000;
+		static const uint32_t HotLoops = 1000;
+
+		RegisterMachine(const Module& module, std::istream& in, std::ostream& out);
+		RegisterMachine(const RegisterMachine&) = delete;
+		RegisterMachine& operator=(const RegisterMachine&) = delete;
+		~RegisterMachine();
+
+		// 接口
+		std::optional<RuntimeError> Run();
+		// 是否所有函数都翻译成了寄存器指令
+		bool IsTranslated() const { return _translated; }
+		// 翻译后的指令条数
+		std::size_t CodeSize() const;
+		// 上一次 Run 分派的指令条数，使用 JIT 时不计数
+		uint64_t GetDispatches() const { return _dispatches; }
+		// 把寄存器指令编译成 x86-64 机器码执行，不是 x86-64 或没有翻译成功时返回 false，继续使用解释器
+		bool EnableJit();
+		bool IsJitEnabled() const { return _jit != nullptr; }
+		// 当前平台能否生成机器码，不能时 EnableJit 和 EnableTiering 都返回 false
+		static bool IsJitSupported();
+		// 分层执行，不支持 JIT 时返回 false，只使用解释器
+		bool EnableTiering();
+		// 函数被调用 calls 次或循环头被跳回 loops 次后开始编译
+		void SetTierThresholds(uint32_t calls, uint32_t loops);
+		// 上一次 Run 从解释器进入机器码的次数
+		uint64_t GetNativeEntries() const { return _nativeEntries; }
+		// 把寄存器指令写成 C 文件，栈帧是 C 函数的局部变量，只能在翻译成功时调用
+		void WriteCSource(std::ostream& out) const;
+	private:
+		template<bool Tiered>
+		std::optional<RuntimeError> execute(int32_t function, int32_t bp);
+		// 执行 JIT 生成的机器码，从第 ip 条指令开始
+		std::optional<RuntimeError> compiled(int32_t function, int32_t ip, int32_t bp);
+		// 达到阈值时调用，第一次调用时开始后台编译，编译好之后返回 true
+		bool promote();
+		// 等待后台编译结束
+		void finish();
+
+	private:
+		const Module& _module;
+		std::istream& _in;
+		std::ostream& _out;
+		bool _translated;
+		// 下标为函数下标加一，0 是初始化代码
+		std::vector<Function> _functions;
+		// 所有指令用到的常量，double 占两个slot
+		std::vector<int32_t> _constants;
+		// 初始化代码执行后全局变量所占的slot数
+		int32_t _globals;
+		int32_t _entry;
+		std::vector<int32_t> _stack;
+		uint64_t _dispatches;
+		std::unique_ptr<Jit> _jit;
+		// 分层执行的状态，计数在多次 Run 之间保留
+		bool _tiered;
+		uint32_t _hotCalls;
+		uint32_t _hotLoops;
+		// 下标为函数下标加一
+		std::vector<uint32_t> _calls;
+		// 每个循环头被跳回的次数
+		std::vector<std::vector<uint32_t> > _loops;
+		std::thread _compiler;
+		std::atomic<bool> _compiled;
+		// 后台线程的编译结果，_compiled 为 true 后才能读取
+		std::unique_ptr<Jit> _pending;
+		uint64_t _nativeEntries;
+	};
+}
@@ -0,0 +1,471 @@
+#include "verifier.h"
+
+#include <algorithm>
+
+namespace c0 {
+
+	namespace {
+		using int32_t = std::int32_t;
+
+		bool isJump(Operation op) {
+			return (op >= Operation::JMP && op <= Operation::JLE) || (op >= Operation::ICMPJE && op <= Operation::ICMPJLE);
+		}
+
+		bool isReturn(Operation op) {
+			return op >= Operation::RET && op <= Operation::ARET;
+		}
+	}
+
+	const std::vector<Instruction>& Verifier::codeOf(int32_t function) const {
+		return function < 0 ? _module.start : _module.functions[function].code;
+	}
+
+	Verifier::Value Verifier::merge(Value lhs, Value rhs) {
+		if (lhs == rhs)
+			return lhs;
+		if (lhs.kind == Kind::Conflict || rhs.kind == Kind::Conflict)
+			return {Kind::Conflict, 0, 0};
+		if (lhs.kind == Kind::Any || rhs.kind == Kind::Any)
+			return {Kind::Any, 0, 0};
+		// 不同的地址汇合后只知道是一个 int
+		const auto integer = [](Kind kind) { return kind == Kind::Int || kind == Kind::Address; };
+		const auto concrete = [](Value v) { return v.kind == Kind::Address ? Value{Kind::Int, 0, 0} : v; };
+		if (lhs.kind == Kind::Param && rhs.kind == Kind::Param) {
+			unite(lhs.offset, rhs.offset);
+			return lhs;
+		}
+		// 参数和另一条路径上的值汇合，参数的类型就是那个值的类型
+		if (lhs.kind == Kind::Param || rhs.kind == Kind::Param) {
+			const auto param = lhs.kind == Kind::Param ? lhs : rhs, other = lhs.kind == Kind::Param ? rhs : lhs;
+			if (other.kind == Kind::Zero)
+				return param;
+			use(param, concrete(other).kind);
+			return concrete(other);
+		}
+		// 0 当作哪种类型都一样，但和地址汇合后不再是常量地址
+		if (lhs.kind == Kind::Zero)
+			return concrete(rhs);
+		if (rhs.kind == Kind::Zero)
+			return concrete(lhs);
+		if (integer(lhs.kind) && integer(rhs.kind))
+			return {Kind::Int, 0, 0};
+		return {Kind::Conflict, 0, 0};
+	}
+
+	void Verifier::use(const Value& v, Kind kind) {
+		if (v.kind == Kind::Param)
+			constrain(v.offset, kind);
+		else if (v.kind == Kind::Any)
+			_typed = false;
+	}
+
+	void Verifier::useGlobal(int32_t offset, int32_t width) {
+		for (int32_t k = 0; k < width; k++) {
+			const auto kind = _globals[offset + k].kind;
+			if (kind == Kind::Any)
+				_typed = false;
+			if (kind != Kind::Zero)
+				continue;
+			const auto role = width == 1 ? Kind::Int : k == 0 ? Kind::Low : Kind::High;
+			if (_roles[offset + k] == Kind::Any)
+				_roles[offset + k] = role;
+			else if (_roles[offset + k] != role)
+				_typed = false;
+		}
+	}
+
+	int32_t Verifier::find(int32_t param) {
+		while (_parents[param] != param)
+			param = _parents[param] = _parents[_parents[param]];
+		return param;
+	}
+
+	void Verifier::constrain(int32_t param, Kind kind) {
+		auto& k = _kinds[find(param)];
+		if (k == Kind::Any)
+			k = kind;
+		else if (k != kind)
+			_typed = false;
+	}
+
+	void Verifier::unite(int32_t lhs, int32_t rhs) {
+		lhs = find(lhs);
+		rhs = find(rhs);
+		if (lhs == rhs)
+			return;
+		_parents[rhs] = lhs;
+		if (_kinds[rhs] != Kind::Any)
+			constrain(lhs, _kinds[rhs]);
+	}
+
+	std::optional<VerifyError> Verifier::Verify() {
+		const int32_t count = _module.functions.size();
+		_widths.assign(count, 0);
+		_depths.assign(count + 1, 0);
+		_globals.clear();
+		_roles.clear();
+		_typed = true;
+		_params.assign(count, 0);
+		// 每个函数返回值的slot数必须唯一，调用后的栈深度才是确定的
+		for (int32_t i = 0; i < count; i++) {
+			auto& code = _module.functions[i].code;
+			if (_module.functions[i].params < 0)
+				return VerifyError{VerifyInvalidFunction, i, 0};
+			int32_t width = -1;
+			for (int32_t ip = 0; ip < (int32_t)code.size(); ip++) {
+				auto op = code[ip].GetOperation();
+				if (!isReturn(op))
+					continue;
+				const int32_t w = op == Operation::RET ? 0 : op == Operation::DRET ? 2 : 1;
+				if (width != -1 && width != w)
+					return VerifyError{VerifyInvalidReturn, i, ip};
+				width = w;
+			}
+			_widths[i] = std::max(width, 0);
+			if (i + 1 < count)
+				_params[i + 1] = _params[i] + _module.functions[i].params;
+		}
+		const int32_t total = count == 0 ? 0 : _params[count - 1] + _module.functions[count - 1].params;
+		_parents.resize(total);
+		for (int32_t i = 0; i < total; i++)
+			_parents[i] = i;
+		_kinds.assign(total, Kind::Any);
+		// 函数要用到初始化代码得到的全局变量类型
+		for (int32_t i = -1; i < count; i++) {
+			auto err = verify(i);
+			if (err.has_value())
+				return err;
+		}
+		for (int32_t i = 0; i < count; i++) {
+			auto name = _module.functions[i].name;
+			if (name >= 0 && name < (int32_t)_module.consts.size() && std::holds_alternative<std::string>(_module.consts[name])
+				&& std::get<std::string>(_module.consts[name]) == "main" && _module.functions[i].params != 0)
+				return VerifyError{VerifyInvalidEntry, i, 0};
+		}
+		return {};
+	}
+
+	std::optional<VerifyError> Verifier::verify(int32_t function) {
+		using State = std::vector<Value>;
+		auto& code = codeOf(function);
+		const int32_t size = code.size();
+		const int32_t params = function < 0 ? 0 : _module.functions[function].params;
+		const Value integer{Kind::Int, 0, 0}, low{Kind::Low, 0, 0}, high{Kind::High, 0, 0};
+		// 每条指令执行前的栈，还没有到达的为空
+		std::vector<std::optional<State> > states(size + 1);
+		std::vector<int32_t> work{0};
+		states[0] = State();
+		for (int32_t k = 0; k < params; k++)
+			states[0]->push_back({Kind::Param, 0, _params[function] + k});
+		int32_t depth = params;
+		int32_t ip = 0;
+		std::optional<VerifyErrorCode> failure;
+		const auto check = [&](bool ok, VerifyErrorCode code) {
+			if (!ok && !failure.has_value())
+				failure = code;
+			return ok;
+		};
+		// 把 state 合并到 target 处，有变化时重新检查 target
+		const auto flow = [&](int32_t target, const State& state) {
+			if (!check(target >= 0 && target <= size, VerifyInvalidJump))
+				return;
+			auto& s = states[target];
+			if (!s.has_value()) {
+				s = state;
+				work.push_back(target);
+				return;
+			}
+			if (!check(s->size() == state.size(), VerifyStackMismatch))
+				return;
+			bool changed = false;
+			for (std::size_t k = 0; k < state.size(); k++) {
+				auto v = merge((*s)[k], state[k]);
+				if (!(v == (*s)[k])) {
+					(*s)[k] = v;
+					changed = true;
+				}
+			}
+			if (changed)
+				work.push_back(target);
+		};
+
+		while (!work.empty()) {
+			ip = work.back();
+			work.pop_back();
+			State s = states[ip].value();
+			if (ip == size) {
+				// 执行到末尾和 RET 一样
+				if (function >= 0 && _widths[function] != 0)
+					return VerifyError{VerifyInvalidReturn, function, ip};
+				continue;
+			}
+			auto& ins = code[ip];
+			const auto op = ins.GetOperation();
+			const int32_t x = ins.GetX(), y = ins.GetOpt();
+			const int32_t d = s.size();
+
+			const auto need = [&](int32_t n) { return check(d >= n, VerifyStackUnderflow); };
+			// 0、参数和来源不明的值可以当作任何类型，用过之后参数的类型就确定了
+			const auto loose = [](const Value& v) { return v.kind == Kind::Zero || v.kind == Kind::Param || v.kind == Kind::Any; };
+			const auto isInteger = [&](const Value& v) {
+				use(v, Kind::Int);
+				return v.kind == Kind::Int || v.kind == Kind::Address || loose(v);
+			};
+			const auto isReal = [&](const Value* v) {
+				use(v[0], Kind::Low);
+				use(v[1], Kind::High);
+				return (v[0].kind == Kind::Low || loose(v[0])) && (v[1].kind == Kind::High || loose(v[1]));
+			};
+			const auto intAt = [&](int32_t pos) { return check(isInteger(s[pos]), VerifyTypeMismatch); };
+			const auto realAt = [&](int32_t pos) { return check(isReal(&s[pos]), VerifyTypeMismatch); };
+			const auto pop = [&](int32_t n) { s.resize(s.size() - n); };
+			const auto pushReal = [&]() {
+				s.push_back(low);
+				s.push_back(high);
+			};
+			// 地址必须是常量，并且在栈帧中 limit 以下或全局变量中
+			const auto resolve = [&](const Value& address, int32_t width, int32_t limit) -> Value* {
+				if (!check(address.kind == Kind::Address && address.offset >= 0, VerifyInvalidAddress))
+					return nullptr;
+				// 初始化代码的栈帧就是全局变量
+				if (function < 0 || address.level == 0)
+					return check(address.offset + width <= limit, VerifyInvalidAddress) ? &s[address.offset] : nullptr;
+				if (!check(address.offset + width <= (int32_t)_globals.size(), VerifyInvalidAddress))
+					return nullptr;
+				useGlobal(address.offset, width);
+				return &_globals[address.offset];
+			};
+			const auto load = [&](const Value& address, int32_t width, int32_t limit) {
+				auto p = resolve(address, width, limit);
+				if (p == nullptr)
+					return;
+				if (width == 2) {
+					if (check(isReal(p), VerifyTypeMismatch))
+						pushReal();
+				}
+				else if (check(isInteger(*p), VerifyTypeMismatch)) {
+					// 函数中读到的全局变量可能已经被别的函数改写，只知道是一个 int
+					const Value v = p->kind == Kind::Zero && function >= 0 && address.level != 0 ? integer : *p;
+					s.push_back(v);
+				}
+			};
+			// 要写入的值在栈顶，全局变量的类型在初始化代码之后不再改变
+			const auto store = [&](const Value& address, int32_t width, int32_t limit) {
+				const int32_t pos = s.size() - width;
+				if (!(width == 2 ? realAt(pos) : intAt(pos)))
+					return;
+				auto p = resolve(address, width, limit);
+				if (p == nullptr)
+					return;
+				if (function >= 0 && address.level != 0)
+					check(width == 2 ? isReal(p) : isInteger(*p), VerifyTypeMismatch);
+				else if (width == 2) {
+					p[0] = low;
+					p[1] = high;
+				}
+				else
+					p[0] = s[pos];
+			};
+
+			switch (op) {
+				case Operation::NOP:
+				case Operation::JMP:
+				case Operation::PRINTL:
+				case Operation::RET:
+					break;
+				case Operation::BIPUSH:
+				case Operation::IPUSH:
+				case Operation::ISCAN:
+				case Operation::CSCAN:
+					s.push_back(integer);
+					break;
+				case Operation::DSCAN:
+					pushReal();
+					break;
+				case Operation::POP:
+				case Operation::POP2:
+				case Operation::POPN: {
+					const int32_t n = op == Operation::POP ? 1 : op == Operation::POP2 ? 2 : x;
+					if (check(n >= 0, VerifyIllegalInstruction) && need(n))
+						pop(n);
+					break;
+				}
+				case Operation::DUP:
+					if (need(1) && intAt(d - 1)) {
+						const Value v = s[d - 1];
+						s.push_back(v);
+					}
+					break;
+				case Operation::DUP2:
+					if (need(2) && check(s[d - 2].kind != Kind::Conflict && s[d - 1].kind != Kind::Conflict, VerifyTypeMismatch)) {
+						const Value lo = s[d - 2], hi = s[d - 1];
+						s.push_back(lo);
+						s.push_back(hi);
+					}
+					break;
+				case Operation::LOADC:
+					if (!check(x >= 0 && x < (int32_t)_module.consts.size(), VerifyInvalidConstant))
+						break;
+					if (std::holds_alternative<double>(_module.consts[x]))
+						pushReal();
+					else
+						s.push_back(integer);
+					break;
+				case Operation::LOADA:
+					s.push_back({Kind::Address, x == 0 ? 0 : 1, y});
+					break;
+				case Operation::SNEW:
+					if (check(x >= 0 && x <= VirtualMachine::StackSize, VerifyStackOverflow))
+						s.resize(d + x, Value{Kind::Zero, 0, 0});
+					break;
+				case Operation::ILOAD:
+				case Operation::DLOAD:
+					if (need(1)) {
+						const Value address = s[d - 1];
+						pop(1);
+						load(address, op == Operation::ILOAD ? 1 : 2, d - 1);
+					}
+					break;
+				case Operation::ISTORE:
+				case Operation::DSTORE: {
+					const int32_t width = op == Operation::ISTORE ? 1 : 2;
+					if (need(width + 1)) {
+						store(s[d - width - 1], width, d - width - 1);
+						pop(width + 1);
+					}
+					break;
+				}
+				case Operation::IADD: case Operation::ISUB: case Operation::IMUL: case Operation::IDIV: case Operation::ICMP:
+					if (need(2) && intAt(d - 2) && intAt(d - 1)) {
+						pop(2);
+						s.push_back(integer);
+					}
+					break;
+				case Operation::INEG:
+				case Operation::I2C:
+					if (need(1) && intAt(d - 1))
+						s[d - 1] = integer;
+					break;
+				case Operation::I2D:
+					if (need(1) && intAt(d - 1)) {
+						pop(1);
+						pushReal();
+					}
+					break;
+				case Operation::DADD: case Operation::DSUB: case Operation::DMUL: case Operation::DDIV: case Operation::DCMP:
+					if (need(4) && realAt(d - 4) && realAt(d - 2)) {
+						pop(4);
+						if (op == Operation::DCMP)
+							s.push_back(integer);
+						else
+							pushReal();
+					}
+					break;
+				case Operation::DNEG:
+				case Operation::D2I:
+					if (need(2) && realAt(d - 2)) {
+						pop(2);
+						if (op == Operation::D2I)
+							s.push_back(integer);
+						else
+							pushReal();
+					}
+					break;
+				case Operation::JE: case Operation::JNE: case Operation::JL: case Operation::JGE: case Operation::JG: case Operation::JLE:
+				case Operation::IPRINT: case Operation::CPRINT: case Operation::SPRINT:
+					if (need(1) && intAt(d - 1))
+						pop(1);
+					break;
+				case Operation::ICMPJE: case Operation::ICMPJNE: case Operation::ICMPJL:
+				case Operation::ICMPJGE: case Operation::ICMPJG: case Operation::ICMPJLE:
+					if (need(2) && intAt(d - 2) && intAt(d - 1))
+						pop(2);
+					break;
+				case Operation::DPRINT:
+					if (need(2) && realAt(d - 2))
+						pop(2);
+					break;
+				case Operation::CALL: {
+					if (!check(x >= 0 && x < (int32_t)_module.functions.size(), VerifyInvalidFunction))
+						break;
+					const int32_t n = _module.functions[x].params;
+					if (!need(n))
+						break;
+					for (int32_t k = d - n; k < d; k++) {
+						if (!check(s[k].kind != Kind::Conflict, VerifyTypeMismatch))
+							break;
+						// 实参的类型就是形参的类型，0 当作哪种类型都一样
+						const int32_t param = _params[x] + k - (d - n);
+						if (s[k].kind == Kind::Param)
+							unite(param, s[k].offset);
+						else if (s[k].kind == Kind::Any)
+							_typed = false;
+						else if (s[k].kind != Kind::Zero)
+							constrain(param, s[k].kind == Kind::Address ? Kind::Int : s[k].kind);
+					}
+					pop(n);
+					if (_widths[x] == 1)
+						s.push_back(integer);
+					else if (_widths[x] == 2)
+						pushReal();
+					break;
+				}
+				case Operation::IRET:
+				case Operation::ARET:
+					if (need(1))
+						intAt(d - 1);
+					break;
+				case Operation::DRET:
+					if (need(2))
+						realAt(d - 2);
+					break;
+				case Operation::ILOADL: case Operation::ILOADG: case Operation::DLOADL: case Operation::DLOADG: {
+					const int32_t width = op == Operation::ILOADL || op == Operation::ILOADG ? 1 : 2;
+					load({Kind::Address, op == Operation::ILOADL || op == Operation::DLOADL ? 0 : 1, x}, width, d);
+					break;
+				}
+				case Operation::ISTOREL: case Operation::ISTOREG: case Operation::DSTOREL: case Operation::DSTOREG: {
+					const int32_t width = op == Operation::ISTOREL || op == Operation::ISTOREG ? 1 : 2;
+					if (need(width)) {
+						store({Kind::Address, op == Operation::ISTOREL || op == Operation::DSTOREL ? 0 : 1, x}, width, d - width);
+						pop(width);
+					}
+					break;
+				}
+				case Operation::IINC: {
+					auto p = resolve({Kind::Address, 0, x}, 1, d);
+					if (p != nullptr && check(isInteger(*p), VerifyTypeMismatch))
+						*p = integer;
+					break;
+				}
+				default:
+					check(false, VerifyIllegalInstruction);
+					break;
+			}
+			if (isReturn(op))
+				check(function >= 0, VerifyInvalidReturn);
+			check((int32_t)s.size() <= VirtualMachine::StackSize, VerifyStackOverflow);
+			if (failure.has_value())
+				return VerifyError{failure.value(), function, ip};
+			depth = std::max(depth, (int32_t)s.size());
+
+			if (isJump(op))
+				flow(x, s);
+			if (op != Operation::JMP && !isReturn(op))
+				flow(ip + 1, s);
+			if (failure.has_value())
+				return VerifyError{failure.value(), function, ip};
+		}
+
+		_depths[function + 1] = depth;
+		if (function < 0 && states[size].has_value()) {
+			// 函数中只能看到初始化代码结束时的类型，地址可能已经被改写
+			_globals = states[size].value();
+			for (auto& v : _globals)
+				if (v.kind == Kind::Address)
+					v = integer;
+			_roles.assign(_globals.size(), Kind::Any);
+		}
+		return {};
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "vm.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace c0 {
+
+	enum VerifyErrorCode {
+		VerifyIllegalInstruction,
+		VerifyInvalidJump,
+		VerifyInvalidFunction,
+		VerifyInvalidConstant,
+		VerifyStackUnderflow,
+		// 栈帧比整个栈还大
+		VerifyStackOverflow,
+		// 控制流汇合处的栈深度不同
+		VerifyStackMismatch,
+		// int 和 double 的slot混用，或读了类型冲突的slot
+		VerifyTypeMismatch,
+		// 地址不是常量，或超出了栈帧和全局变量
+		VerifyInvalidAddress,
+		// 返回值宽度不一致，或初始化代码中有返回
+		VerifyInvalidReturn,
+		// main 有参数
+		VerifyInvalidEntry,
+	};
+
+	struct VerifyError final {
+		VerifyErrorCode code;
+		// -1 表示全局变量的初始化代码
+		std::int32_t function;
+		std::int32_t ip;
+	};
+
+	// 在执行前静态检查 Module
+	// 对每个函数做抽象解释，每个位置记录栈中每个slot的类型，保证：
+	// 汇合处栈深度一致，int 和 double 不混用，跳转、调用和常量的下标合法，读写的地址都是栈帧或全局变量中的常量位置
+	// 通过检查的代码执行时不会越过栈帧，虚拟机只需在进入函数时预留 MaxDepthOf 个slot
+	// 同时推断参数和未初始化的全局变量的类型，判断每个slot是否始终只按一种宽度使用
+	class Verifier final {
+	private:
+		using int32_t = std::int32_t;
+
+		// slot中值的类型，Conflict 是汇合时类型冲突的值
+		// Zero 是 SNEW 得到的 0，Param 是还没有用过的参数，Any 是来源不明的值，它们都可以当作任何类型
+		enum class Kind { Int, Low, High, Address, Zero, Param, Any, Conflict };
+		struct Value {
+			Kind kind;
+			// Address 的层次和偏移，0 是当前栈帧，1 是全局变量
+			int32_t level;
+			// Address 的偏移，或 Param 对应的参数编号
+			int32_t offset;
+
+			bool operator==(const Value& rhs) const { return kind == rhs.kind && level == rhs.level && offset == rhs.offset; }
+		};
+	public:
+		explicit Verifier(const Module& module)
+			: _module(module), _widths(), _depths(), _globals(), _typed(true), _params(), _parents(), _kinds(), _roles() {}
+		Verifier(const Verifier&) = delete;
+		Verifier& operator=(const Verifier&) = delete;
+
+		// 接口
+		std::optional<VerifyError> Verify();
+		// 通过检查后函数栈帧最多用到的slot数，包括参数；-1 表示初始化代码
+		int32_t MaxDepthOf(int32_t function) const { return _depths[function + 1]; }
+		// 通过检查后，是否每个slot都只按一种宽度读写：int 只当作 int 读，double 总是整对读写
+		// 成立时 double 可以整个放在一个 64 位的slot中
+		bool IsTyped() const { return _typed; }
+	private:
+		std::optional<VerifyError> verify(int32_t function);
+		const std::vector<Instruction>& codeOf(int32_t function) const;
+		Value merge(Value lhs, Value rhs);
+		// 按 kind 使用值 v，参数在第一次使用时确定类型
+		void use(const Value& v, Kind kind);
+		// 函数中按 width 访问初始化代码没有写过的全局变量
+		void useGlobal(int32_t offset, int32_t width);
+		int32_t find(int32_t param);
+		void constrain(int32_t param, Kind kind);
+		void unite(int32_t lhs, int32_t rhs);
+
+	private:
+		const Module& _module;
+		// 每个函数返回值的slot数
+		std::vector<int32_t> _widths;
+		// 下标为函数下标加一，0 是初始化代码
+		std::vector<int32_t> _depths;
+		// 初始化代码执行完后全局变量的类型
+		std::vector<Value> _globals;
+		bool _typed;
+		// 每个函数第一个参数的编号，所有函数的参数一起编号
+		std::vector<int32_t> _params;
+		// 参数的类型由调用处和函数中的使用方式共同决定，互相传递的参数用并查集合并
+		std::vector<int32_t> _parents;
+		// 参数所在集合的类型，Any 表示还没有确定
+		std::vector<Kind> _kinds;
+		// 初始化代码没有写过的全局变量在函数中的类型，Any 表示还没有用过
+		std::vector<Kind> _roles;
+	};
+}
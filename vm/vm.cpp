@@ -0,0 +1,789 @@
+#include "vm.h"
+#include "verifier.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <type_traits>
+
+namespace c0 {
+
+	std::string unescape(const std::string& str) {
+		std::string result;
+		for (std::size_t i = 0; i < str.size(); i++) {
+			if (str[i] != '\\' || i + 1 == str.size()) {
+				result += str[i];
+				continue;
+			}
+			switch (str[++i]) {
+				case 't':
+					result += '\t';
+					break;
+				case 'n':
+					result += '\n';
+					break;
+				case 'r':
+					result += '\r';
+					break;
+				case 'x':
+					if (i + 2 < str.size()) {
+						result += (char)std::stoi(str.substr(i + 1, 2), nullptr, 16);
+						i += 2;
+					}
+					break;
+				default:
+					// \\ \" \'
+					result += str[i];
+					break;
+			}
+		}
+		return result;
+	}
+
+	Module moduleOf(const Program& program) {
+		Module module;
+		for (auto& [index, c] : program.consts) {
+			auto& [type, value] = c;
+			if ((int32_t)module.consts.size() <= index)
+				module.consts.resize(index + 1);
+			if (type == "S")
+				module.consts[index] = unescape(value);
+			else if (type == "I")
+				module.consts[index] = (int32_t)std::stoll(value, nullptr, 16);
+			else {
+				double d;
+				std::stringstream ss(value);
+				ss >> d;
+				module.consts[index] = d;
+			}
+		}
+		module.start = program.start;
+		for (auto& [index, f] : program.funcs) {
+			if ((int32_t)module.functions.size() <= index)
+				module.functions.resize(index + 1);
+			auto& [_, name, params, level] = f;
+			auto code = program.functions.find(index);
+			module.functions[index] = {name, params, level, code == program.functions.end() ? std::vector<Instruction>() : code->second};
+		}
+		return module;
+	}
+
+	namespace {
+		double loadDouble(const std::int32_t* p) {
+			double d;
+			std::memcpy(&d, p, sizeof d);
+			return d;
+		}
+
+		void storeDouble(std::int32_t* p, double d) {
+			std::memcpy(p, &d, sizeof d);
+		}
+
+		// 64 位slot中 double 只占第一个slot
+		double loadDouble(const std::int64_t* p) {
+			double d;
+			std::memcpy(&d, p, sizeof d);
+			return d;
+		}
+
+		void storeDouble(std::int64_t* p, double d) {
+			std::memcpy(p, &d, sizeof d);
+		}
+
+		void copyDouble(std::int32_t* dst, const std::int32_t* src) {
+			dst[0] = src[0];
+			dst[1] = src[1];
+		}
+
+		void copyDouble(std::int64_t* dst, const std::int64_t* src) {
+			dst[0] = src[0];
+		}
+
+		// 常量表中的 double 总是两个 32 位的slot
+		void copyDouble(std::int64_t* dst, const std::int32_t* src) {
+			std::memcpy(dst, src, sizeof(double));
+		}
+	}
+
+	const std::vector<Instruction>& VirtualMachine::codeOf(int32_t function) const {
+		if (function < 0)
+			return _module.start;
+		return _module.functions[function].code;
+	}
+
+	VirtualMachine::Counters& VirtualMachine::countersOf(int32_t function) {
+		if (_counters.empty()) {
+			_counters.resize(_module.functions.size() + 1);
+			for (int32_t i = -1; i < (int32_t)_module.functions.size(); i++) {
+				_counters[i + 1].taken.resize(codeOf(i).size());
+				_counters[i + 1].fallthrough.resize(codeOf(i).size());
+			}
+		}
+		return _counters[function + 1];
+	}
+
+	Profile VirtualMachine::GetProfile() const {
+		Profile profile;
+		for (int32_t i = 0; i < (int32_t)_counters.size(); i++) {
+			auto& c = _counters[i];
+			auto& code = codeOf(i - 1);
+			auto& f = profile.functions[i - 1];
+			f.size = code.size();
+			f.calls = c.calls;
+			for (int32_t k = 0; k < (int32_t)code.size(); k++) {
+				if (code[k].GetOperation() == Operation::CALL && c.taken[k] > 0)
+					f.sites[k] = c.taken[k];
+				else if (c.taken[k] > 0 || c.fallthrough[k] > 0)
+					f.branches[k] = {c.taken[k], c.fallthrough[k]};
+			}
+		}
+		return profile;
+	}
+
+	std::optional<RuntimeError> VirtualMachine::Run() {
+		_sp = 0;
+		_steps = 0;
+		_frames = {{-1, 0, 0}};
+		_loaded = false;
+		Verifier verifier(_module);
+		_verified = !verifier.Verify().has_value();
+		_wide = _slots == WideSlots && _verified && verifier.IsTyped();
+		// 和 _stack 一样只分配一次，多次 Run 之间不再清零
+		if (_wide && _wideStack.empty())
+			_wideStack.resize(StackSize, 0);
+		_depths.clear();
+		if (_verified)
+			for (int32_t i = -1; i < (int32_t)_module.functions.size(); i++)
+				_depths.push_back(verifier.MaxDepthOf(i));
+		auto err = execute(-1);
+		if (err.has_value())
+			return err;
+
+		int32_t entry = -1;
+		for (int32_t i = 0; i < (int32_t)_module.functions.size(); i++) {
+			auto name = _module.functions[i].name;
+			if (name >= 0 && name < (int32_t)_module.consts.size()
+				&& std::holds_alternative<std::string>(_module.consts[name]) && std::get<std::string>(_module.consts[name]) == "main")
+				entry = i;
+		}
+		if (entry == -1)
+			return RuntimeError{ErrNoMainFunction, -1, 0};
+		_frames.push_back({entry, -1, _sp});
+		if (_profiling)
+			countersOf(entry).calls++;
+		err = execute(entry);
+		_out.flush();
+		return err;
+	}
+
+	std::pair<std::vector<std::int32_t>, std::optional<RuntimeError> > VirtualMachine::Call(int32_t function, const std::vector<int32_t>& args) {
+		if (function < 0 || function >= (int32_t)_module.functions.size())
+			return {{}, RuntimeError{ErrInvalidFunction, -1, 0}};
+		if (args.size() > _stack.size())
+			return {{}, RuntimeError{ErrStackOverflow, -1, 0}};
+		std::copy(args.begin(), args.end(), _stack.begin());
+		_sp = args.size();
+		_steps = 0;
+		_frames = {{-1, 0, 0}, {function, -1, 0}};
+		_loaded = false;
+		// 参数个数由调用者决定，只能逐条检查
+		_verified = false;
+		_wide = false;
+		auto err = execute(function);
+		if (err.has_value())
+			return {{}, err};
+		return {std::vector<int32_t>(_stack.begin(), _stack.begin() + _sp), {}};
+	}
+
+	void VirtualMachine::load(const void* const* handlers) {
+		const int32_t count = _module.functions.size();
+		_constants.assign(_module.consts.size() * 2, 0);
+		for (std::size_t i = 0; i < _module.consts.size(); i++)
+			if (std::holds_alternative<double>(_module.consts[i]))
+				storeDouble(&_constants[i * 2], std::get<double>(_module.consts[i]));
+		// 先分配好全部空间，之后指向指令的指针不会失效
+		std::size_t total = 0;
+		for (int32_t i = -1; i < count; i++)
+			total += codeOf(i).size() + 1;
+		_code.assign(total, Decoded());
+		_callees.assign(count + 1, Callee());
+		total = 0;
+		for (int32_t i = -1; i < count; i++) {
+			_callees[i + 1] = {i, i < 0 ? 0 : _module.functions[i].params, _verified ? _depths[i + 1] : 0, &_code[total]};
+			total += codeOf(i).size() + 1;
+		}
+		// 被调函数都有了位置才能解析 CALL
+		for (int32_t i = -1; i < count; i++)
+			decode(i, &_code[_callees[i + 1].code - _code.data()], handlers);
+		_loaded = true;
+	}
+
+	void VirtualMachine::decode(int32_t function, Decoded* decoded, const void* const* handlers) {
+		auto& code = codeOf(function);
+		const int32_t size = code.size();
+		// 跳转目标之前的指令不能和它合并
+		std::vector<bool> targets(size + 1, false);
+		for (auto& ins : code) {
+			auto op = ins.GetOperation();
+			if ((op >= Operation::JMP && op <= Operation::JLE) || (op >= Operation::ICMPJE && op <= Operation::ICMPJLE))
+				targets[ins.GetX() < 0 || ins.GetX() > size ? size : ins.GetX()] = true;
+		}
+		for (int32_t i = 0; i <= size; i++) {
+			auto& d = decoded[i];
+			d.target = nullptr;
+			if (i == size) {
+				d.op = EndOfCode;
+				d.x = d.y = 0;
+			}
+			else {
+				d.op = code[i].GetOperation();
+				d.x = code[i].GetX();
+				d.y = code[i].GetOpt();
+			}
+			switch (d.op) {
+				case Operation::JMP: case Operation::JE: case Operation::JNE: case Operation::JL: case Operation::JGE: case Operation::JG: case Operation::JLE:
+				case Operation::ICMPJE: case Operation::ICMPJNE: case Operation::ICMPJL: case Operation::ICMPJGE: case Operation::ICMPJG: case Operation::ICMPJLE:
+					// 跳出代码范围和执行到末尾一样
+					d.target = decoded + (d.x < 0 || d.x > size ? size : d.x);
+					break;
+				case Operation::CALL:
+					// 不存在的函数留到执行时报错
+					if (d.x >= 0 && d.x < (int32_t)_module.functions.size())
+						d.callee = &_callees[d.x + 1];
+					break;
+				case Operation::LOADA: {
+					// 只有两层作用域，显示表中外层是初始化代码的基址 0，内层就是当前的 bp
+					// 全局变量的地址在载入时就是常量，执行时不用再区分层次
+					// 通过检查的代码中紧接着的 ILOAD/DLOAD 不会出错，合成按层次区分的读取，执行时跳过后一条
+					const auto next = _verified && i + 1 < size && !targets[i + 1] ? code[i + 1].GetOperation() : Operation::NOP;
+					if (next == Operation::ILOAD || next == Operation::DLOAD) {
+						const bool local = d.x == 0;
+						d.op = next == Operation::ILOAD ? (local ? Operation::ILOADL : Operation::ILOADG) : (local ? Operation::DLOADL : Operation::DLOADG);
+						d.x = d.y;
+						d.target = decoded + i + 2;
+					}
+					else if (d.x != 0) {
+						d.op = Operation::IPUSH;
+						d.x = d.y;
+					}
+					break;
+				}
+				case Operation::ILOADL: case Operation::ILOADG: case Operation::DLOADL: case Operation::DLOADG:
+					d.target = decoded + i + 1;
+					break;
+				case Operation::LOADC:
+					if (d.x < 0 || d.x >= (int32_t)_module.consts.size())
+						break;
+					// int 常量和字符串的“地址”直接压栈，只有 double 常量需要读常量表
+					if (std::holds_alternative<double>(_module.consts[d.x]))
+						d.constant = &_constants[d.x * 2];
+					else {
+						d.op = Operation::IPUSH;
+						if (std::holds_alternative<int32_t>(_module.consts[d.x]))
+							d.x = std::get<int32_t>(_module.consts[d.x]);
+					}
+					break;
+				default:
+					break;
+			}
+			d.handler = handlers == nullptr ? nullptr : handlers[d.op];
+		}
+	}
+
+	std::optional<RuntimeError> VirtualMachine::execute(int32_t function) {
+#ifdef C0_THREADED_DISPATCH
+		if (_dispatch == ThreadedDispatch)
+			return _wide ? interpret<true, false, true>(function) : _verified ? interpret<true, false, false>(function) : interpret<true, true, false>(function);
+#endif
+		return _wide ? interpret<false, false, true>(function) : _verified ? interpret<false, false, false>(function) : interpret<false, true, false>(function);
+	}
+
+	// 所有指令的处理代码，顺序与 Operation 相同
+	// X 是虚拟机实现了的指令，U 是不能执行的指令
+#define VM_OPERATIONS(X, U) \
+	X(NOP) X(BIPUSH) X(IPUSH) X(POP) X(POP2) X(POPN) X(DUP) X(DUP2) X(LOADC) X(LOADA) \
+	U(NEW) X(SNEW) X(ILOAD) X(DLOAD) U(ALOAD) X(ISTORE) X(DSTORE) U(ASTORE) U(IASTORE) U(DASTORE) U(AASTORE) \
+	X(IADD) X(DADD) X(ISUB) X(DSUB) X(IMUL) X(DMUL) X(IDIV) X(DDIV) X(INEG) X(DNEG) X(ICMP) X(DCMP) \
+	X(I2D) X(D2I) X(I2C) X(JMP) X(JE) X(JNE) X(JL) X(JGE) X(JG) X(JLE) X(CALL) X(RET) X(IRET) X(DRET) X(ARET) \
+	X(IPRINT) X(DPRINT) X(CPRINT) X(SPRINT) X(PRINTL) X(ISCAN) X(DSCAN) X(CSCAN) \
+	X(ILOADL) X(DLOADL) X(ILOADG) X(DLOADG) X(ISTOREL) X(DSTOREL) X(ISTOREG) X(DSTOREG) \
+	X(IINC) X(ICMPJE) X(ICMPJNE) X(ICMPJL) X(ICMPJGE) X(ICMPJG) X(ICMPJLE) U(ILL)
+
+#ifdef C0_THREADED_DISPATCH
+	// 标签地址和 goto * 是 GCC/Clang 的扩展
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+	// 整个解释循环不递归，函数调用只压入 _frames
+	// 当返回到调用 interpret 之前的那一帧时结束
+	// Threaded 为真时每条指令直接跳到下一条指令的处理代码，否则回到 switch 分派
+	// Checked 为假时每个栈帧在进入时按 Verifier 算出的最大深度检查一次，之后不再检查栈顶和地址
+	// Wide 为真时每个slot是 64 位，int 符号扩展后存放，double 直接存放在第一个slot中
+	template<bool Threaded, bool Checked, bool Wide>
+	std::optional<RuntimeError> VirtualMachine::interpret(int32_t function) {
+#ifdef C0_THREADED_DISPATCH
+#define VM_HANDLER(op) &&L_##op,
+#define VM_ILLEGAL(op) &&L_ILLEGAL,
+		static const void* const handlers[] = {VM_OPERATIONS(VM_HANDLER, VM_ILLEGAL) &&L_END};
+		static_assert(sizeof handlers / sizeof handlers[0] == EndOfCode + 1, "every operation needs a handler");
+#undef VM_HANDLER
+#undef VM_ILLEGAL
+		const void* const* table = Threaded ? handlers : nullptr;
+#else
+		const void* const* table = nullptr;
+#endif
+		if (!_loaded)
+			load(table);
+
+		const std::size_t base = _frames.size();
+		const Decoded* code = _callees[function + 1].code;
+		const Decoded* pc = code;
+		const Decoded* ins = code;
+		int32_t bp = _frames.back().bp;
+		using Slot = std::conditional_t<Wide, int64_t, int32_t>;
+		Slot* stack;
+		if constexpr (Wide)
+			stack = _wideStack.data();
+		else
+			stack = _stack.data();
+		if (!Checked && bp + _callees[function + 1].depth > StackSize)
+			return RuntimeError{ErrStackOverflow, function, 0};
+
+#define VM_IP() ((int32_t)(ins - code))
+#define VM_ERROR(err) return RuntimeError{err, function, VM_IP()}
+#define VM_NEED(n) do { if (Checked && _sp < (n)) VM_ERROR(ErrStackUnderflow); } while (0)
+#define VM_ROOM(n) do { if (Checked && _sp + (n) > StackSize) VM_ERROR(ErrStackOverflow); } while (0)
+#define VM_ADDRESS(a, n) do { if (Checked && ((a) < 0 || (a) + (n) > _sp)) VM_ERROR(ErrInvalidAddress); } while (0)
+#define VM_STEP() do { if (++_steps > _stepLimit) VM_ERROR(ErrStepLimitExceeded); } while (0)
+#define VM_JUMP(cond) do { \
+			const bool taken = (cond); \
+			if (_profiling) \
+				(taken ? countersOf(function).taken : countersOf(function).fallthrough)[VM_IP()]++; \
+			if (taken) { \
+				VM_STEP(); \
+				pc = ins->target; \
+			} \
+		} while (0)
+#ifdef C0_THREADED_DISPATCH
+#define VM_NEXT() do { \
+			if constexpr (Threaded) { \
+				ins = pc++; \
+				goto *ins->handler; \
+			} \
+			else \
+				goto dispatch; \
+		} while (0)
+#else
+#define VM_NEXT() goto dispatch
+#endif
+
+		// 从当前函数返回，返回值已经留在了 [_sp - slots, _sp)
+		const auto leave = [&](int32_t slots) {
+			std::memmove(stack + bp, stack + _sp - slots, slots * sizeof(Slot));
+			_sp = bp + slots;
+			auto frame = _frames.back();
+			_frames.pop_back();
+			if (_frames.size() < base)
+				return false;
+			function = _frames.back().function;
+			code = _callees[function + 1].code;
+			bp = _frames.back().bp;
+			pc = code + frame.ip;
+			return true;
+		};
+
+		VM_NEXT();
+#ifdef C0_THREADED_DISPATCH
+		// 直接线索化时不经过这里
+	dispatch: __attribute__((unused));
+#else
+	dispatch:
+#endif
+		ins = pc++;
+		switch (ins->op) {
+#define VM_CASE(op) case Operation::op: goto L_##op;
+#define VM_SKIP(op)
+			VM_OPERATIONS(VM_CASE, VM_SKIP)
+#undef VM_CASE
+#undef VM_SKIP
+			case EndOfCode:
+				goto L_END;
+			default:
+				goto L_ILLEGAL;
+		}
+
+	L_END:
+		// 初始化代码执行完毕，或函数没有 ret 就到了末尾
+		if (_frames.size() == base && function < 0)
+			return {};
+		if (!leave(0))
+			return {};
+		VM_NEXT();
+	L_ILLEGAL:
+		VM_ERROR(ErrIllegalInstruction);
+	L_NOP:
+		VM_NEXT();
+	L_BIPUSH:
+	L_IPUSH:
+		VM_ROOM(1);
+		stack[_sp++] = ins->x;
+		VM_NEXT();
+	L_POP:
+		VM_NEED(1);
+		_sp--;
+		VM_NEXT();
+	L_POP2:
+		VM_NEED(2);
+		_sp -= 2;
+		VM_NEXT();
+	L_POPN:
+		VM_NEED(ins->x);
+		_sp -= ins->x;
+		VM_NEXT();
+	L_DUP:
+		VM_NEED(1);
+		VM_ROOM(1);
+		stack[_sp] = stack[_sp - 1];
+		_sp++;
+		VM_NEXT();
+	L_DUP2:
+		VM_NEED(2);
+		VM_ROOM(2);
+		stack[_sp] = stack[_sp - 2];
+		stack[_sp + 1] = stack[_sp - 1];
+		_sp += 2;
+		VM_NEXT();
+	L_LOADC:
+		// 载入时只留下了 double 常量和不存在的常量
+		if (Checked && ins->constant == nullptr)
+			VM_ERROR(ErrInvalidConstant);
+		VM_ROOM(2);
+		copyDouble(stack + _sp, ins->constant);
+		_sp += 2;
+		VM_NEXT();
+	L_LOADA:
+		VM_ROOM(1);
+		// 载入时只留下了局部变量的地址
+		stack[_sp++] = bp + ins->y;
+		VM_NEXT();
+	L_SNEW:
+		VM_ROOM(ins->x);
+		std::memset(stack + _sp, 0, ins->x * sizeof(Slot));
+		_sp += ins->x;
+		VM_NEXT();
+	L_ILOAD: {
+		VM_NEED(1);
+		auto a = stack[_sp - 1];
+		VM_ADDRESS(a, 1);
+		stack[_sp - 1] = stack[a];
+		VM_NEXT();
+	}
+	L_DLOAD: {
+		VM_NEED(1);
+		VM_ROOM(1);
+		auto a = stack[_sp - 1];
+		VM_ADDRESS(a, 2);
+		copyDouble(stack + _sp - 1, stack + a);
+		_sp++;
+		VM_NEXT();
+	}
+	L_ISTORE: {
+		VM_NEED(2);
+		auto a = stack[_sp - 2];
+		VM_ADDRESS(a, 1);
+		stack[a] = stack[_sp - 1];
+		_sp -= 2;
+		VM_NEXT();
+	}
+	L_DSTORE: {
+		VM_NEED(3);
+		auto a = stack[_sp - 3];
+		VM_ADDRESS(a, 2);
+		copyDouble(stack + a, stack + _sp - 2);
+		_sp -= 3;
+		VM_NEXT();
+	}
+	L_IADD:
+		VM_NEED(2);
+		stack[_sp - 2] = (int32_t)((uint32_t)stack[_sp - 2] + (uint32_t)stack[_sp - 1]);
+		_sp--;
+		VM_NEXT();
+	L_ISUB:
+		VM_NEED(2);
+		stack[_sp - 2] = (int32_t)((uint32_t)stack[_sp - 2] - (uint32_t)stack[_sp - 1]);
+		_sp--;
+		VM_NEXT();
+	L_IMUL:
+		VM_NEED(2);
+		stack[_sp - 2] = (int32_t)((uint32_t)stack[_sp - 2] * (uint32_t)stack[_sp - 1]);
+		_sp--;
+		VM_NEXT();
+	L_IDIV: {
+		VM_NEED(2);
+		auto rhs = stack[_sp - 1], lhs = stack[_sp - 2];
+		// 值域分析已经排除了除以 0 和回绕
+		if (ins->y == NoOverflow) {
+			stack[_sp - 2] = lhs / rhs;
+			_sp--;
+			VM_NEXT();
+		}
+		if (rhs == 0)
+			VM_ERROR(ErrDivideByZero);
+		// INT_MIN / -1 按补码回绕
+		stack[_sp - 2] = rhs == -1 ? (int32_t)(0u - (uint32_t)lhs) : lhs / rhs;
+		_sp--;
+		VM_NEXT();
+	}
+	L_INEG:
+		VM_NEED(1);
+		stack[_sp - 1] = (int32_t)(0u - (uint32_t)stack[_sp - 1]);
+		VM_NEXT();
+	L_ICMP: {
+		VM_NEED(2);
+		auto rhs = stack[_sp - 1], lhs = stack[_sp - 2];
+		stack[_sp - 2] = (lhs > rhs) - (lhs < rhs);
+		_sp--;
+		VM_NEXT();
+	}
+	L_DADD:
+		VM_NEED(4);
+		storeDouble(stack + _sp - 4, loadDouble(stack + _sp - 4) + loadDouble(stack + _sp - 2));
+		_sp -= 2;
+		VM_NEXT();
+	L_DSUB:
+		VM_NEED(4);
+		storeDouble(stack + _sp - 4, loadDouble(stack + _sp - 4) - loadDouble(stack + _sp - 2));
+		_sp -= 2;
+		VM_NEXT();
+	L_DMUL:
+		VM_NEED(4);
+		storeDouble(stack + _sp - 4, loadDouble(stack + _sp - 4) * loadDouble(stack + _sp - 2));
+		_sp -= 2;
+		VM_NEXT();
+	L_DDIV: {
+		VM_NEED(4);
+		auto rhs = loadDouble(stack + _sp - 2);
+		if (rhs == 0)
+			VM_ERROR(ErrDivideByZero);
+		storeDouble(stack + _sp - 4, loadDouble(stack + _sp - 4) / rhs);
+		_sp -= 2;
+		VM_NEXT();
+	}
+	L_DNEG:
+		VM_NEED(2);
+		storeDouble(stack + _sp - 2, -loadDouble(stack + _sp - 2));
+		VM_NEXT();
+	L_DCMP: {
+		VM_NEED(4);
+		auto rhs = loadDouble(stack + _sp - 2), lhs = loadDouble(stack + _sp - 4);
+		stack[_sp - 4] = (lhs > rhs) - (lhs < rhs);
+		_sp -= 3;
+		VM_NEXT();
+	}
+	L_I2D:
+		VM_NEED(1);
+		VM_ROOM(1);
+		storeDouble(stack + _sp - 1, (double)stack[_sp - 1]);
+		_sp++;
+		VM_NEXT();
+	L_D2I:
+		VM_NEED(2);
+		stack[_sp - 2] = (int32_t)loadDouble(stack + _sp - 2);
+		_sp--;
+		VM_NEXT();
+	L_I2C:
+		VM_NEED(1);
+		stack[_sp - 1] = (uint8_t)stack[_sp - 1];
+		VM_NEXT();
+	L_JMP:
+		VM_STEP();
+		pc = ins->target;
+		VM_NEXT();
+	L_JE:
+		VM_NEED(1);
+		VM_JUMP(stack[--_sp] == 0);
+		VM_NEXT();
+	L_JNE:
+		VM_NEED(1);
+		VM_JUMP(stack[--_sp] != 0);
+		VM_NEXT();
+	L_JL:
+		VM_NEED(1);
+		VM_JUMP(stack[--_sp] < 0);
+		VM_NEXT();
+	L_JGE:
+		VM_NEED(1);
+		VM_JUMP(stack[--_sp] >= 0);
+		VM_NEXT();
+	L_JG:
+		VM_NEED(1);
+		VM_JUMP(stack[--_sp] > 0);
+		VM_NEXT();
+	L_JLE:
+		VM_NEED(1);
+		VM_JUMP(stack[--_sp] <= 0);
+		VM_NEXT();
+	L_CALL: {
+		auto callee = ins->callee;
+		if (Checked && callee == nullptr)
+			VM_ERROR(ErrInvalidFunction);
+		VM_NEED(callee->params);
+		// 通过检查的代码在进入函数时一次预留整个栈帧
+		if (!Checked && _sp - callee->params + callee->depth > StackSize)
+			VM_ERROR(ErrStackOverflow);
+		VM_STEP();
+		if (_profiling) {
+			countersOf(function).taken[VM_IP()]++;
+			countersOf(callee->function).calls++;
+		}
+		bp = _sp - callee->params;
+		_frames.push_back({callee->function, (int32_t)(pc - code), bp});
+		function = callee->function;
+		code = callee->code;
+		pc = code;
+		VM_NEXT();
+	}
+	L_RET:
+		if (!leave(0))
+			return {};
+		VM_NEXT();
+	L_IRET:
+	L_ARET:
+		VM_NEED(1);
+		if (!leave(1))
+			return {};
+		VM_NEXT();
+	L_DRET:
+		VM_NEED(2);
+		if (!leave(2))
+			return {};
+		VM_NEXT();
+	L_IPRINT:
+		VM_NEED(1);
+		_out << stack[--_sp];
+		VM_NEXT();
+	L_DPRINT: {
+		VM_NEED(2);
+		_sp -= 2;
+		char buffer[512];
+		std::snprintf(buffer, sizeof buffer, "%f", loadDouble(stack + _sp));
+		_out << buffer;
+		VM_NEXT();
+	}
+	L_CPRINT:
+		VM_NEED(1);
+		_out << (char)stack[--_sp];
+		VM_NEXT();
+	L_SPRINT: {
+		VM_NEED(1);
+		auto index = stack[--_sp];
+		if (index < 0 || index >= (int32_t)_module.consts.size() || !std::holds_alternative<std::string>(_module.consts[index]))
+			VM_ERROR(ErrInvalidConstant);
+		_out << std::get<std::string>(_module.consts[index]);
+		VM_NEXT();
+	}
+	L_PRINTL:
+		_out << '\n';
+		VM_NEXT();
+	L_ISCAN: {
+		VM_ROOM(1);
+		int32_t v;
+		if (!(_in >> v))
+			VM_ERROR(ErrReadFailed);
+		stack[_sp++] = v;
+		VM_NEXT();
+	}
+	L_DSCAN: {
+		VM_ROOM(2);
+		double v;
+		if (!(_in >> v))
+			VM_ERROR(ErrReadFailed);
+		storeDouble(stack + _sp, v);
+		_sp += 2;
+		VM_NEXT();
+	}
+	L_CSCAN: {
+		VM_ROOM(1);
+		char v;
+		if (!(_in >> v))
+			VM_ERROR(ErrReadFailed);
+		stack[_sp++] = (uint8_t)v;
+		VM_NEXT();
+	}
+
+	// 超级指令
+#define VM_LOAD_STORE(name, base) \
+	L_ILOAD##name: { \
+		VM_ROOM(1); \
+		auto a = (base) + ins->x; \
+		VM_ADDRESS(a, 1); \
+		stack[_sp++] = stack[a]; \
+		pc = ins->target; \
+		VM_NEXT(); \
+	} \
+	L_DLOAD##name: { \
+		VM_ROOM(2); \
+		auto a = (base) + ins->x; \
+		VM_ADDRESS(a, 2); \
+		copyDouble(stack + _sp, stack + a); \
+		_sp += 2; \
+		pc = ins->target; \
+		VM_NEXT(); \
+	} \
+	L_ISTORE##name: { \
+		VM_NEED(1); \
+		auto a = (base) + ins->x; \
+		VM_ADDRESS(a, 1); \
+		stack[a] = stack[--_sp]; \
+		VM_NEXT(); \
+	} \
+	L_DSTORE##name: { \
+		VM_NEED(2); \
+		auto a = (base) + ins->x; \
+		VM_ADDRESS(a, 2); \
+		copyDouble(stack + a, stack + _sp - 2); \
+		_sp -= 2; \
+		VM_NEXT(); \
+	}
+	VM_LOAD_STORE(L, bp)
+	VM_LOAD_STORE(G, 0)
+#undef VM_LOAD_STORE
+	L_IINC: {
+		auto a = bp + ins->x;
+		VM_ADDRESS(a, 1);
+		stack[a] = (int32_t)((uint32_t)stack[a] + (uint32_t)ins->y);
+		VM_NEXT();
+	}
+#define VM_COMPARE_JUMP(name, op) \
+	L_ICMPJ##name: { \
+		VM_NEED(2); \
+		auto rhs = stack[_sp - 1], lhs = stack[_sp - 2]; \
+		_sp -= 2; \
+		VM_JUMP(lhs op rhs); \
+		VM_NEXT(); \
+	}
+	VM_COMPARE_JUMP(E, ==)
+	VM_COMPARE_JUMP(NE, !=)
+	VM_COMPARE_JUMP(L, <)
+	VM_COMPARE_JUMP(GE, >=)
+	VM_COMPARE_JUMP(G, >)
+	VM_COMPARE_JUMP(LE, <=)
+#undef VM_COMPARE_JUMP
+
+#undef VM_IP
+#undef VM_ERROR
+#undef VM_NEED
+#undef VM_ROOM
+#undef VM_ADDRESS
+#undef VM_STEP
+#undef VM_JUMP
+#undef VM_NEXT
+	}
+
+#ifdef C0_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+#undef VM_OPERATIONS
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "instruction/instruction.h"
+#include "instruction/program.h"
+#include "instruction/profile.h"
+
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// 编译器支持标签地址时默认使用直接线索化的分派，定义 C0_SWITCH_DISPATCH 可以强制使用 switch
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(C0_SWITCH_DISPATCH)
+#define C0_THREADED_DISPATCH
+#endif
+
+namespace c0 {
+
+	// 虚拟机可以直接执行的程序，可以由编译结果或 .o0 文件得到
+	struct Module {
+		using int32_t = std::int32_t;
+
+		struct Function {
+			// 函数名在常量表中的下标
+			int32_t name;
+			// 参数所占的slot数
+			int32_t params;
+			int32_t level;
+			std::vector<Instruction> code;
+		};
+
+		// 常量表，字符串已经处理了转义
+		std::vector<std::variant<std::string, int32_t, double> > consts;
+		std::vector<Instruction> start;
+		std::vector<Function> functions;
+	};
+
+	// 处理字符串常量中的转义序列，规则与生成 .o0 文件时相同
+	std::string unescape(const std::string&);
+	Module moduleOf(const Program&);
+	// 读取 .o0 文件，格式不对或文件不完整时返回空
+	std::optional<Module> readModule(std::istream&);
+	// 指令在 .o0 文件中各个操作数的字节数
+	const std::vector<int>& operandSizesOf(Operation);
+	// 把 Module 翻译成一个可移植的 C 文件，用系统的 C 编译器编译后与虚拟机的行为一致
+	void writeCSource(const Module&, std::ostream&);
+
+	enum RuntimeErrorCode {
+		ErrStackOverflow,
+		ErrStackUnderflow,
+		ErrInvalidAddress,
+		ErrDivideByZero,
+		ErrInvalidConstant,
+		ErrInvalidFunction,
+		ErrIllegalInstruction,
+		ErrNoMainFunction,
+		ErrReadFailed,
+		ErrStepLimitExceeded,
+	};
+
+	// 解释器的分派方式
+	// 直接线索化（computed goto）需要 GCC/Clang 的标签地址扩展，否则只能用 switch
+	enum DispatchMode {
+		SwitchDispatch,
+		ThreadedDispatch,
+	};
+
+	// 栈中slot的宽度
+	// 64 位时 double 整个放在一个slot中，int 和 char 放在低 32 位，slot的编号不变，double 的第二个slot不再使用
+	enum SlotWidth {
+		NarrowSlots,
+		WideSlots,
+	};
+
+	struct RuntimeError final {
+		RuntimeErrorCode code;
+		// 出错的函数，-1 表示全局变量的初始化代码
+		std::int32_t function;
+		std::int32_t ip;
+	};
+
+	// 执行 Module 的栈式虚拟机
+	// 先执行全局变量的初始化代码，再调用 main
+	class VirtualMachine final {
+	private:
+		using int32_t = std::int32_t;
+		using uint32_t = std::uint32_t;
+		using int64_t = std::int64_t;
+		using uint64_t = std::uint64_t;
+
+		// 调用栈中的一帧
+		struct Frame {
+			// -1 表示初始化代码
+			int32_t function;
+			// 返回后继续执行的位置
+			int32_t ip;
+			// 栈帧在操作数栈中的起点
+			int32_t bp;
+		};
+	public:
+		// 栈的大小，单位是slot
+		static const int32_t StackSize = 1 << 20;
+
+		VirtualMachine(const Module& module, std::istream& in, std::ostream& out)
+			: _module(module), _in(in), _out(out), _stack(StackSize, 0), _frames(), _sp(0), _profiling(false), _counters(),
+			_steps(0), _stepLimit(UINT64_MAX), _dispatch(DefaultDispatch), _slots(NarrowSlots), _wide(false), _wideStack(),
+			_loaded(false), _verified(false), _depths(), _code(), _callees(), _constants() {}
+		VirtualMachine(const VirtualMachine&) = delete;
+		VirtualMachine& operator=(const VirtualMachine&) = delete;
+
+		// 接口
+		std::optional<RuntimeError> Run();
+		// 不执行初始化代码，直接以 args 为参数调用一个函数，返回值按slot给出
+		std::pair<std::vector<int32_t>, std::optional<RuntimeError> > Call(int32_t function, const std::vector<int32_t>& args);
+		// 限制执行的跳转和调用次数，超过时以 ErrStepLimitExceeded 结束
+		void SetStepLimit(uint64_t limit) { _stepLimit = limit; }
+		// 开启后记录函数调用、条件跳转和调用点的执行次数，需要在 Run 之前调用
+		void EnableProfiling() { _profiling = true; }
+		Profile GetProfile() const;
+		// 不支持直接线索化时总是使用 switch 分派
+		void SetDispatch(DispatchMode mode) { _dispatch = mode == ThreadedDispatch ? DefaultDispatch : SwitchDispatch; }
+		DispatchMode GetDispatch() const { return _dispatch; }
+		// 上一次 Run 的代码是否通过了 Verifier 的检查，通过时只在进入函数时检查栈空间，不再逐条检查
+		bool IsVerified() const { return _verified; }
+		// 64 位slot只用于通过检查、并且每个slot只按一种宽度使用的代码，否则仍然使用 32 位slot
+		void SetSlotWidth(SlotWidth width) { _slots = width; }
+		SlotWidth GetSlotWidth() const { return _slots; }
+		// 上一次 Run 是否使用了 64 位slot
+		bool IsWide() const { return _wide; }
+	private:
+		// 单个函数的计数，下标为指令偏移
+		// 条件跳转记录跳转与不跳转的次数，调用指令只用 taken
+		struct Counters {
+			std::vector<uint64_t> taken;
+			std::vector<uint64_t> fallthrough;
+			uint64_t calls = 0;
+		};
+
+		struct Decoded;
+		// 被调函数，CALL 指令直接指向它
+		struct Callee {
+			int32_t function;
+			int32_t params;
+			// 通过检查时栈帧最多用到的slot数
+			int32_t depth;
+			const Decoded* code;
+		};
+		// 预先翻译好的定长指令，handler 是直接线索化时处理代码的地址
+		// 跳转目标、被调函数和 double 常量都在载入时解析成指针
+		struct Decoded {
+			const void* handler;
+			int32_t op;
+			int32_t x;
+			int32_t y;
+			union {
+				const Decoded* target;
+				const Callee* callee;
+				const int32_t* constant;
+			};
+		};
+		// 每个函数末尾的哨兵指令
+		static const int32_t EndOfCode = Operation::ILL + 1;
+#ifdef C0_THREADED_DISPATCH
+		static const DispatchMode DefaultDispatch = ThreadedDispatch;
+#else
+		static const DispatchMode DefaultDispatch = SwitchDispatch;
+#endif
+
+		std::optional<RuntimeError> execute(int32_t function);
+		// Checked 为假时代码已经通过了检查，不再检查栈顶和地址，Wide 为真时在 _wideStack 上执行
+		template<bool Threaded, bool Checked, bool Wide>
+		std::optional<RuntimeError> interpret(int32_t function);
+		void load(const void* const* handlers);
+		void decode(int32_t function, Decoded* decoded, const void* const* handlers);
+		const std::vector<Instruction>& codeOf(int32_t function) const;
+		Counters& countersOf(int32_t function);
+
+	private:
+		const Module& _module;
+		std::istream& _in;
+		std::ostream& _out;
+		std::vector<int32_t> _stack;
+		std::vector<Frame> _frames;
+		int32_t _sp;
+		bool _profiling;
+		// 下标为函数下标加一，0 是初始化代码
+		std::vector<Counters> _counters;
+		uint64_t _steps;
+		uint64_t _stepLimit;
+		DispatchMode _dispatch;
+		SlotWidth _slots;
+		bool _wide;
+		// 使用 64 位slot时的栈，编号与 _stack 相同
+		std::vector<int64_t> _wideStack;
+		// 每次 Run 或 Call 开始时重新载入，执行期间不再读 Module 中的指令
+		bool _loaded;
+		bool _verified;
+		// 通过检查时每个函数栈帧的最大深度，下标为函数下标加一
+		std::vector<int32_t> _depths;
+		// 所有函数翻译后的指令，每个函数以哨兵结尾
+		std::vector<Decoded> _code;
+		// 下标为函数下标加一，0 是初始化代码
+		std::vector<Callee> _callees;
+		// double 常量拆成的slot，下标为常量下标的两倍
+		std::vector<int32_t> _constants;
+	};
+}